@@ -0,0 +1,53 @@
+/**
+ * @file
+ * @brief Selectable implementations of the sigmoid activation function.
+ * @author Arno Bastenhof
+ */
+
+#ifndef ACTIVATION_HPP_
+#define ACTIVATION_HPP_
+
+#include <cstddef>
+#include <string>
+
+namespace mnist {
+
+/**
+ * @brief Ways of computing the sigmoid activation function.
+ *
+ * The approximations are vectorized for the instruction set selected by the
+ * kernels (see kernels.hpp). The stated bounds are on the absolute error over
+ * all finite inputs. Their effect on accuracy is reported by the benchmarks.
+ */
+enum SigmoidMode {
+  kSigmoidExact,  /**< @brief std::exp, accurate up to rounding. */
+  kSigmoidFast,   /**< @brief Polynomial approximation, error below 2e-9. */
+  kSigmoidTable   /**< @brief Interpolated table, error below 3e-6. */
+};
+
+/** @brief Names of the sigmoid modes, indexed by SigmoidMode. */
+static const char * const kSigmoidModeNames[] = { "exact", "fast", "table" };
+
+void                Sigmoid(double *, const std::size_t, const SigmoidMode);
+void                Sigmoid(float *, const std::size_t, const SigmoidMode);
+
+/**
+ * @brief Looks up a sigmoid mode by name.
+ * @param[in] name One of "exact", "fast" or "table".
+ * @param[out] mode The mode with the given name, if any.
+ * @return Whether the name was recognized.
+ */
+inline bool ParseSigmoidMode(const std::string& name, SigmoidMode& mode)
+{
+  for (int i = kSigmoidExact; i <= kSigmoidTable; ++i) {
+    if (name == kSigmoidModeNames[i]) {
+      mode = static_cast<SigmoidMode>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace mnist
+
+#endif // ACTIVATION_HPP_
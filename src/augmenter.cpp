@@ -0,0 +1,217 @@
+/**
+ * @file
+ * @brief Implementation of randomly distorting training images on the fly.
+ * @author Arno Bastenhof
+ */
+
+#include "augmenter.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "kernels.hpp"
+
+using std::runtime_error;
+
+static const double kPi = 3.14159265358979323846;
+
+// The finalizer of SplitMix64, mapping distinct inputs to distinct, well
+// mixed outputs
+static inline uint64_t Mix(uint64_t x)
+{
+  x = (x ^ x >> 30) * 0xbf58476d1ce4e5b9;
+  x = (x ^ x >> 27) * 0x94d049bb133111eb;
+  return x ^ x >> 31;
+}
+
+namespace {
+
+// SplitMix64 (Steele et al., 2014), which unlike std::mt19937_64 is cheap
+// enough to seed anew for every image
+class SplitMix64 {
+public:
+  explicit SplitMix64(const uint64_t seed) : state_(seed) {}
+  uint64_t operator()() { return Mix(state_ += 0x9e3779b97f4a7c15); }
+  // A number drawn uniformly from [-1, 1)
+  double Uniform()
+  {
+    return static_cast<int64_t>((*this)() >> 11) * (1.0 / (int64_t{1} << 52))
+        - 1;
+  }
+private:
+  uint64_t state_;
+};
+
+} // namespace
+
+namespace mnist {
+
+/**
+ * @brief Constructor.
+ * @param[in] distortions The ranges of the distortions.
+ * @param[in] threads The number of threads to distort each batch with.
+ * @param[in] seed The seed from which the distortions are derived.
+ */
+template <typename T>
+Augmenter<T>::Augmenter(const Distortions& distortions, const int threads,
+    const uint64_t seed)
+  : distortions_(distortions)
+  , seed_(seed)
+  , pool_(std::max(1, threads))
+{
+  if (distortions.elastic_alpha > 0) {
+    if (!(distortions.elastic_sigma > 0)) {
+      throw runtime_error{"Elastic distortions require a positive sigma."};
+    }
+    // Truncated at three standard deviations
+    const int radius = std::min<int>(std::ceil(3 * distortions.elastic_sigma),
+        kSide - 1);
+    filter_.resize(2 * radius + 1);
+    double sum = 0;
+    for (int k = -radius; k <= radius; ++k) {
+      const double sigma = distortions.elastic_sigma;
+      sum += filter_[k + radius] = std::exp(-k * k / (2 * sigma * sigma));
+    }
+    for (T& g : filter_) {
+      g /= sum;
+    }
+  }
+}
+
+/**
+ * @brief Distorts the images of a batch in place, in parallel.
+ *
+ * The distortions of each image only depend on its position within its
+ * batch, so that any consecutive part of a batch can be distorted by itself.
+ *
+ * @param[in,out] img The images, stored one after the other, each row-wise.
+ * @param[in] n The number of images.
+ * @param[in] batch The number of the batch, which should differ between all
+ *            batches distorted with the same seed.
+ * @param[in] first The position of the first image within its batch.
+ */
+template <typename T>
+void Augmenter<T>::Apply(T * img, const int n, const unsigned long batch,
+    const int first)
+{
+  const int num = std::min(pool_.Size(), n);
+  pool_.Run([&](const int t){
+    if (t < num) {
+      for (int j = t * n / num; j != (t + 1) * n / num; ++j) {
+        Distort(img + static_cast<std::size_t>(j) * kImageSz, batch,
+            first + j);
+      }
+    }
+  });
+}
+
+/**
+ * @brief Distorts a single image in place.
+ *
+ * Uses a scratch state of the calling thread that persists between calls, so
+ * that concurrent calls from different threads are safe.
+ *
+ * @param[in,out] img The image, stored row-wise.
+ * @param[in] batch The number of the image's batch.
+ * @param[in] j The position of the image within its batch.
+ */
+template <typename T>
+void Augmenter<T>::Distort(T * img, const unsigned long batch, const int j)
+    const
+{
+  thread_local Scratch scratch;
+  SplitMix64 rng{Mix(seed_ ^ Mix(batch ^ Mix(j)))};
+
+  // Copy the image into the padding, whose zeros are never overwritten
+  for (int r = 0; r != kSide; ++r) {
+    std::copy(img + r * kSide, img + (r + 1) * kSide,
+        &scratch.padded[(r + 1) * kPaddedSide + 1]);
+  }
+
+  // Map each pixel back to its source point, by inverting a rotation and
+  // scaling about the center, followed by a shift
+  const double angle = rng.Uniform() * distortions_.rotation * kPi / 180;
+  const double scale = 1 + rng.Uniform() * distortions_.scale;
+  const double shift_x = rng.Uniform() * distortions_.shift;
+  const double shift_y = rng.Uniform() * distortions_.shift;
+  const T cos_a = std::cos(angle) / scale;
+  const T sin_a = std::sin(angle) / scale;
+  const T center = (kSide - 1) / 2.0;
+  for (int r = 0; r != kSide; ++r) {
+    const T v = r - center - shift_y;
+    for (int c = 0; c != kSide; ++c) {
+      const T u = c - center - shift_x;
+      scratch.x[r * kSide + c] = cos_a * u + sin_a * v + center;
+      scratch.y[r * kSide + c] = cos_a * v - sin_a * u + center;
+    }
+  }
+
+  // Displace the source points by smoothed random fields
+  if (!filter_.empty()) {
+    for (int i = 0; i != kImageSz; ++i) {
+      scratch.dx[i] = rng.Uniform();
+      scratch.dy[i] = rng.Uniform();
+    }
+    Smooth(scratch.dx.data(), scratch.blurred.data());
+    Smooth(scratch.dy.data(), scratch.blurred.data());
+    const T alpha = distortions_.elastic_alpha;
+    for (int i = 0; i != kImageSz; ++i) {
+      scratch.x[i] += alpha * scratch.dx[i];
+      scratch.y[i] += alpha * scratch.dy[i];
+    }
+  }
+
+  BilinearSample(scratch.padded.data(), kSide, kSide, scratch.x.data(),
+      scratch.y.data(), kImageSz, img);
+}
+
+/**
+ * @brief Constructor for a scratch state.
+ */
+template <typename T>
+Augmenter<T>::Scratch::Scratch()
+  : padded(kPaddedSz)
+  , x(kImageSz)
+  , y(kImageSz)
+  , dx(kImageSz)
+  , dy(kImageSz)
+  , blurred(kImageSz)
+{
+}
+
+// Smooths a kSide x kSide field in place with the Gaussian filter, taking
+// values beyond the edges as zero. Both passes run along the columns, with the
+// innermost loops along the rows for the compiler to vectorize, by transposing
+// the field after each
+template <typename T>
+void Augmenter<T>::Smooth(T * field, T * tmp) const
+{
+  const int radius = filter_.size() / 2;
+  const T * g = filter_.data() + radius;
+
+  for (int pass = 0; pass != 2; ++pass) {
+    std::fill(tmp, tmp + kImageSz, T(0));
+    for (int r = 0; r != kSide; ++r) {
+      T * out = tmp + r * kSide;
+      const int first = std::max(-radius, -r);
+      const int last = std::min<int>(radius, kSide - 1 - r);
+      for (int k = first; k <= last; ++k) {
+        const T * in = field + (r + k) * kSide;
+        for (int c = 0; c != kSide; ++c) {
+          out[c] += g[k] * in[c];
+        }
+      }
+    }
+    for (int r = 0; r != kSide; ++r) {
+      for (int c = 0; c != kSide; ++c) {
+        field[c * kSide + r] = tmp[r * kSide + c];
+      }
+    }
+  }
+}
+
+template class Augmenter<float>;
+template class Augmenter<double>;
+
+} // namespace mnist
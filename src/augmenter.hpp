@@ -0,0 +1,83 @@
+/**
+ * @file
+ * @brief Interface for randomly distorting training images on the fly.
+ * @author Arno Bastenhof
+ */
+
+#ifndef AUGMENTER_HPP_
+#define AUGMENTER_HPP_
+
+#include <cstdint>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+namespace mnist {
+
+/**
+ * @brief The ranges of the random distortions applied to training images.
+ *
+ * Each image is rotated, scaled and shifted by amounts drawn uniformly from
+ * the given ranges, and then optionally distorted elastically as described by
+ * Simard et al. (2003): every pixel is displaced by a random field, drawn
+ * uniformly from [-1, 1] and smoothed by a Gaussian filter.
+ */
+struct Distortions {
+  double                rotation;       // max. angle in degrees
+  double                scale;          // max. relative change in size
+  double                shift;          // max. translation in pixels
+  double                elastic_alpha;  // scale of the field, 0 to disable
+  double                elastic_sigma;  // std. dev. of the Gaussian filter
+};
+
+// Default distortions, with the elastic ones as used by Simard et al. (2003)
+static const Distortions kDefaultDistortions = { 10, 0.1, 2, 34, 4 };
+
+/**
+ * @brief Applies random distortions to 28 x 28 images with pixels of type T
+ *        (float or double), spreading the images of each batch over a pool of
+ *        threads.
+ *
+ * The distortions of each image only depend on the seed, the number of its
+ * batch and its position within, not on the number of threads. Each image is
+ * resampled once, by bilinear interpolation at the source points of all
+ * distortions combined.
+ */
+template <typename T>
+class Augmenter {
+public:
+                        Augmenter(const Distortions&, const int,
+                            const uint64_t);
+                        Augmenter(const Augmenter&) = delete;
+                        Augmenter(Augmenter&&) = delete;
+  Augmenter&            operator=(const Augmenter&) = delete;
+  void                  Apply(T *, const int, const unsigned long,
+                            const int = 0);
+  void                  Distort(T *, const unsigned long, const int) const;
+private:
+  enum {
+    kSide = 28,                         // width and height of the images
+    kImageSz = kSide * kSide,
+    kPaddedSide = kSide + 3,            // as expected by BilinearSample
+    kPaddedSz = kPaddedSide * kPaddedSide
+  };
+  // Scratch state for distorting a single image, owned by one thread
+  struct Scratch {
+                        Scratch();
+    std::vector<T>      padded;         // zeros around the source image
+    std::vector<T>      x;              // source point of each pixel
+    std::vector<T>      y;
+    std::vector<T>      dx;             // elastic displacement of each pixel
+    std::vector<T>      dy;
+    std::vector<T>      blurred;
+  };
+  const Distortions     distortions_;
+  const uint64_t        seed_;
+  std::vector<T>        filter_;        // elastic Gaussian, normalized
+  ThreadPool            pool_;
+  void                  Smooth(T *, T *) const;
+};
+
+} // namespace mnist
+
+#endif // AUGMENTER_HPP_
@@ -0,0 +1,167 @@
+/**
+ * @file
+ * @brief Implementation of tuning the batch size to the host.
+ * @author Arno Bastenhof
+ */
+
+#include "autotune.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+
+#include "neural.hpp"
+
+using std::runtime_error;
+using std::vector;
+
+using arma::Col;
+using arma::Mat;
+
+// Batch sizes to try, besides the default
+static const int kCandidates[] = {16, 25, 32, 64, 100, 128, 200, 256};
+
+enum {
+  kTrainSamples = 10000,                // max. samples to train on per trial
+  kHeldOutSamples = 2000,               // max. samples to evaluate on
+  kRuns = 2                             // per trial, the fastest one counting
+};
+
+// Cache size assumed if the host does not report it
+static const std::size_t kDefaultCacheSz = 1 << 20;
+
+// Returns the size in bytes of the cache private to each core, taken to be
+// the level 2 cache
+static std::size_t CacheSize()
+{
+  const long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  return size > 0 ? static_cast<std::size_t>(size) : kDefaultCacheSz;
+}
+
+namespace mnist {
+
+/**
+ * @brief Times training with candidate batch sizes on a part of a training
+ *        set, and evaluates the resulting networks on another part.
+ *
+ * Each candidate trains a network of type T (float or double) for a single
+ * epoch from the same initial weights and order of the samples. Candidates
+ * for which the part of a batch propagated by each thread does not fit in the
+ * cache of its core, along with the weights, are skipped, except for the
+ * default. Armadillo's random number generator is reseeded from itself,
+ * keeping subsequent training reproducible under arma_rng::set_seed.
+ *
+ * @param[in] img The input images, one per column.
+ * @param[in] lab The labels of the input images.
+ * @param[in] layers The number of units of each layer of the network.
+ * @param[in] threads The number of threads to train with.
+ * @param[in] sigmoid How to compute the sigmoid activation function.
+ * @param[in] optimizer The optimizer to train with.
+ * @param[in] rate The learning rate.
+ * @param[in] reg The regularization parameter.
+ * @return The trials, in increasing order of batch size.
+ */
+template <typename T, typename eT>
+vector<BatchSizeTrial> TryBatchSizes(const Mat<eT>& img,
+    const Col<uint8_t>& lab, const vector<int>& layers, const int threads,
+    const SigmoidMode sigmoid, const Optimizer& optimizer, const double rate,
+    const double reg)
+{
+  // Train on the first samples, and evaluate on those following
+  const arma::uword held_out = std::min<arma::uword>(img.n_cols / 6,
+      kHeldOutSamples);
+  const arma::uword train = std::min<arma::uword>(img.n_cols - held_out,
+      kTrainSamples);
+  if (train == 0 || held_out == 0 || lab.n_elem != img.n_cols) {
+    throw runtime_error{"Too few samples to tune the batch size."};
+  }
+  const Mat<eT> train_img(const_cast<eT *>(img.memptr()), img.n_rows, train,
+      false, true);
+  const Col<uint8_t> train_lab(const_cast<uint8_t *>(lab.memptr()), train,
+      false, true);
+  const Mat<eT> test_img(const_cast<eT *>(img.colptr(train)), img.n_rows,
+      held_out, false, true);
+  const Col<uint8_t> test_lab(const_cast<uint8_t *>(lab.memptr()) + train,
+      held_out, false, true);
+
+  vector<int> candidates(std::begin(kCandidates), std::end(kCandidates));
+  candidates.push_back(NeuralNet<T>::kDefaultBatchSz);
+  std::sort(candidates.begin(), candidates.end());
+
+  const arma::uword seed = arma::randi<arma::uvec>(1,
+      arma::distr_param(0, std::numeric_limits<int>::max()))[0];
+  const std::size_t cache_size = CacheSize();
+  vector<BatchSizeTrial> trials;
+  for (const int batch_size : candidates) {
+    NeuralNet<T> nn{threads, sigmoid, batch_size, layers};
+    nn.SetOptimizer(optimizer);
+    if (nn.WorkspaceSize() > cache_size
+        && batch_size != NeuralNet<T>::kDefaultBatchSz) {
+      continue;
+    }
+    double best = 0;
+    for (int run = 0; run != kRuns; ++run) {
+      arma::arma_rng::set_seed(seed);
+      const auto start = std::chrono::steady_clock::now();
+      nn.LearnWeights(train_img, train_lab, rate, reg, 1);
+      const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+      best = run == 0 ? elapsed.count() : std::min(best, elapsed.count());
+    }
+    trials.push_back(BatchSizeTrial{batch_size, train / best,
+        nn.Evaluate(test_img, test_lab)});
+  }
+  arma::arma_rng::set_seed(seed);
+  return trials;
+}
+
+/**
+ * @brief Picks the batch size with the highest throughput among the trials
+ *        reaching a target accuracy.
+ * @param[in] trials The trials.
+ * @param[in] target The accuracy (as a percentage) to reach, or a negative
+ *            value to target one within a percentage point of the most
+ *            accurate trial.
+ * @return The batch size picked, or that of the most accurate trial if none
+ *         reached the target.
+ */
+int PickBatchSize(const vector<BatchSizeTrial>& trials, const double target)
+{
+  if (trials.empty()) {
+    throw runtime_error{"No batch sizes to pick from."};
+  }
+  const auto most_accurate = std::max_element(trials.begin(), trials.end(),
+      [](const BatchSizeTrial& a, const BatchSizeTrial& b){
+        return a.accuracy < b.accuracy;
+      });
+  const double min_accuracy =
+    target < 0 ? most_accurate->accuracy - 1 : target;
+  const BatchSizeTrial * pick = nullptr;
+  for (const BatchSizeTrial& trial : trials) {
+    if (trial.accuracy >= min_accuracy
+        && (pick == nullptr || trial.samples_per_s > pick->samples_per_s)) {
+      pick = &trial;
+    }
+  }
+  return (pick != nullptr ? *pick : *most_accurate).batch_size;
+}
+
+// Networks of either precision, trained on raw images as well as preconverted
+// features of the same precision
+template vector<BatchSizeTrial> TryBatchSizes<float>(const Mat<uint8_t>&,
+    const Col<uint8_t>&, const vector<int>&, const int, const SigmoidMode,
+    const Optimizer&, const double, const double);
+template vector<BatchSizeTrial> TryBatchSizes<float>(const Mat<float>&,
+    const Col<uint8_t>&, const vector<int>&, const int, const SigmoidMode,
+    const Optimizer&, const double, const double);
+template vector<BatchSizeTrial> TryBatchSizes<double>(const Mat<uint8_t>&,
+    const Col<uint8_t>&, const vector<int>&, const int, const SigmoidMode,
+    const Optimizer&, const double, const double);
+template vector<BatchSizeTrial> TryBatchSizes<double>(const Mat<double>&,
+    const Col<uint8_t>&, const vector<int>&, const int, const SigmoidMode,
+    const Optimizer&, const double, const double);
+
+} // namespace mnist
@@ -0,0 +1,39 @@
+/**
+ * @file
+ * @brief Interface for tuning the batch size to the host.
+ * @author Arno Bastenhof
+ */
+
+#ifndef AUTOTUNE_HPP_
+#define AUTOTUNE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <armadillo>
+
+#include "activation.hpp"
+#include "optimizer.hpp"
+
+namespace mnist {
+
+/**
+ * @brief The throughput and accuracy of training with a given batch size.
+ */
+struct BatchSizeTrial {
+  int                   batch_size;
+  double                samples_per_s;  // while training
+  double                accuracy;       // percentage of held-out samples
+};
+
+template <typename T, typename eT>
+std::vector<BatchSizeTrial> TryBatchSizes(const arma::Mat<eT>&,
+    const arma::Col<uint8_t>&, const std::vector<int>&, const int,
+    const SigmoidMode, const Optimizer&, const double, const double);
+
+int PickBatchSize(const std::vector<BatchSizeTrial>&, const double);
+
+} // namespace mnist
+
+#endif // AUTOTUNE_HPP_
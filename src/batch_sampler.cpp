@@ -0,0 +1,74 @@
+/**
+ * @file
+ * @brief Implementation of drawing batches of sample indices in shuffled
+ *        order.
+ * @author Arno Bastenhof
+ */
+
+#include "batch_sampler.hpp"
+
+#include <cassert>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+using std::runtime_error;
+
+namespace mnist {
+
+/**
+ * @brief Constructor.
+ *
+ * The samples are initially in their original order, until the first call to
+ * Shuffle.
+ *
+ * @param[in] size The number of samples in the data set.
+ * @param[in] batch_size The number of samples per batch.
+ * @param[in] seed The seed from which the permutations are derived.
+ * @param[in] shard The index of the partition to draw from.
+ * @param[in] num_shards The number of partitions.
+ */
+BatchSampler::BatchSampler(const unsigned long size, const int batch_size,
+    const uint64_t seed, const int shard, const int num_shards)
+  : batch_size_(batch_size)
+  , seed_(seed)
+  , shard_(shard)
+  , first_(size * shard / num_shards)
+  , indices_(size * (shard + 1) / num_shards - first_)
+{
+  assert(batch_size > 0 && shard >= 0 && shard < num_shards);
+  if (size > UINT32_MAX) {
+    throw runtime_error{"Too many samples to shuffle."};
+  }
+  std::iota(indices_.begin(), indices_.end(), first_);
+}
+
+/**
+ * @brief Permutes the samples for a given epoch.
+ *
+ * Takes time linear in the number of samples of the partition, regardless of
+ * their size, and no memory besides their indices.
+ *
+ * @param[in] epoch The number of the epoch, starting from 0.
+ */
+void BatchSampler::Shuffle(const unsigned long epoch)
+{
+  // Seeding through seed_seq, as well as the engine itself, is fully specified
+  // by the standard, unlike std::shuffle
+  std::seed_seq seq{static_cast<uint32_t>(seed_),
+                    static_cast<uint32_t>(seed_ >> 32),
+                    static_cast<uint32_t>(shard_),
+                    static_cast<uint32_t>(epoch),
+                    static_cast<uint32_t>(epoch >> 16 >> 16)};
+  std::mt19937_64 rng{seq};
+
+  // Fisher-Yates, starting from the original order so that the permutation of
+  // each epoch can be reproduced by itself. The modulo bias is below 2^-32
+  std::iota(indices_.begin(), indices_.end(), first_);
+  for (std::size_t i = indices_.size(); i > 1; --i) {
+    std::swap(indices_[i - 1], indices_[rng() % i]);
+  }
+}
+
+} // namespace mnist
@@ -0,0 +1,75 @@
+/**
+ * @file
+ * @brief Interface for drawing batches of sample indices in shuffled order.
+ * @author Arno Bastenhof
+ */
+
+#ifndef BATCH_SAMPLER_HPP_
+#define BATCH_SAMPLER_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace mnist {
+
+/**
+ * @brief Splits the samples of a data set into batches, in an order shuffled
+ *        anew for each epoch.
+ *
+ * Rather than reordering the samples themselves, only their indices are
+ * permuted, for the samples to be gathered by index when preparing each
+ * batch. The permutation of each epoch only depends on the seed, the epoch and
+ * the shard, and is the same on every platform.
+ *
+ * In sharded mode, the samples are divided into equal, contiguous partitions,
+ * of which each sampler only draws from its own.
+ */
+class BatchSampler {
+public:
+                        BatchSampler(const unsigned long, const int,
+                            const uint64_t, const int = 0, const int = 1);
+  void                  Shuffle(const unsigned long);
+  unsigned long         NumBatches() const;
+  const uint32_t *      Batch(const unsigned long) const;
+  int                   BatchSize(const unsigned long) const;
+private:
+  const int             batch_size_;
+  const uint64_t        seed_;
+  const int             shard_;
+  const uint32_t        first_;         // first sample of the partition
+  std::vector<uint32_t> indices_;       // permuted samples of the partition
+};
+
+/**
+ * @brief Returns the number of batches per epoch, including a final partial
+ *        batch of the samples left over by the last whole one, if any.
+ */
+inline unsigned long BatchSampler::NumBatches() const
+{
+  return (indices_.size() + batch_size_ - 1) / batch_size_;
+}
+
+/**
+ * @brief Returns the sample indices of the batch with a given number.
+ * @param[in] index The number of the batch within the current epoch.
+ */
+inline const uint32_t * BatchSampler::Batch(const unsigned long index) const
+{
+  return indices_.data() + index * batch_size_;
+}
+
+/**
+ * @brief Returns the number of samples in the batch with a given number, which
+ *        is less than the batch size only for a final partial batch.
+ * @param[in] index The number of the batch within the current epoch.
+ */
+inline int BatchSampler::BatchSize(const unsigned long index) const
+{
+  return std::min<unsigned long>(batch_size_,
+      indices_.size() - index * batch_size_);
+}
+
+} // namespace mnist
+
+#endif // BATCH_SAMPLER_HPP_
@@ -0,0 +1,810 @@
+/**
+ * @file
+ * @brief Microbenchmarks for parsing the data files, and for training and
+ *        evaluating the neural network, along with checks of the properties
+ *        they rely on.
+ * @author Arno Bastenhof
+ */
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <armadillo>
+
+#include "activation.hpp"
+#include "augmenter.hpp"
+#include "img_parser.hpp"
+#include "kernels.hpp"
+#include "lab_parser.hpp"
+#include "neural.hpp"
+#include "optimizer.hpp"
+#include "quantized.hpp"
+#include "sparse_images.hpp"
+#include "validator.hpp"
+
+using std::cout;
+using std::ofstream;
+using std::runtime_error;
+using std::string;
+
+using arma::Col;
+using arma::Mat;
+
+using mnist::Augmenter;
+using mnist::Distortions;
+using mnist::ImageParser;
+using mnist::LabelParser;
+using mnist::NeuralNet;
+using mnist::NeuralNetBench;
+using mnist::Optimizer;
+using mnist::OptimizerKind;
+using mnist::QuantizedNet;
+using mnist::SigmoidMode;
+using mnist::SparseImages;
+using mnist::Validator;
+
+// The number of calls to malloc and its relatives, by any thread. Unlike
+// Telemetry::Allocations, these include the allocations by Armadillo and BLAS
+static std::atomic<uint64_t> mallocs{0};
+
+extern "C" {
+
+// The allocator of the C library, which the replacements below forward to.
+// These are exported by glibc, which is required for counting allocations
+void * __libc_malloc(std::size_t);
+void * __libc_calloc(std::size_t, std::size_t);
+void * __libc_realloc(void *, std::size_t);
+void * __libc_memalign(std::size_t, std::size_t);
+
+// Replacements of the C library's allocation functions that count their calls,
+// through which the global operator new allocates as well
+void * malloc(std::size_t size) noexcept
+{
+  mallocs.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void * calloc(std::size_t num, std::size_t size) noexcept
+{
+  mallocs.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(num, size);
+}
+
+void * realloc(void * p, std::size_t size) noexcept
+{
+  mallocs.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(p, size);
+}
+
+void * memalign(std::size_t alignment, std::size_t size) noexcept
+{
+  mallocs.fetch_add(1, std::memory_order_relaxed);
+  return __libc_memalign(alignment, size);
+}
+
+void * aligned_alloc(std::size_t alignment, std::size_t size) noexcept
+{
+  mallocs.fetch_add(1, std::memory_order_relaxed);
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void ** p, std::size_t alignment, std::size_t size) noexcept
+{
+  if (alignment % sizeof(void *) != 0
+      || (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  mallocs.fetch_add(1, std::memory_order_relaxed);
+  void * const q = __libc_memalign(alignment, size);
+  if (q == nullptr) {
+    return ENOMEM;
+  }
+  *p = q;
+  return 0;
+}
+
+} // extern "C"
+
+enum {
+  kImageSz = 784,
+  kHiddenSz = 30,           // as used by NeuralNet
+  kNumClasses = 10,
+  kNumSamples = 10000,
+  kNumTestSamples = 2000,   // held out from the synthetic samples
+  kBatchSz = 50,            // as used by NeuralNet
+  kRepetitions = 5,
+  kAllocationCheckBatches = 20, // trained on by CheckAllocations
+  kAccuracyCheckEpochs = 20, // trained for by CheckAccuracy
+  kAccuracyCheckHiddenSz = 100, // as used by CheckAccuracy
+  kMaxAccuracyLoss = 1,     // percentage points, allowed by CheckAccuracy
+  kMinAgreement = 99,       // percentage of predictions, by CheckAccuracy
+  kCheckpointCheckEpochs = 10, // at most, trained for by CheckCheckpoint
+  kCheckpointCheckValidation = 1000, // samples held out by CheckCheckpoint
+  kSigmoidSamples = 1000000, // sampled from [-50, 50)
+  kNumWeights = kHiddenSz * (kImageSz + 1) + kNumClasses * (kHiddenSz + 1),
+  // Floating point operations per sample, counting a multiply-add as two:
+  // one multiply-add per weight forward, and for the gradients plus the
+  // errors propagated back to the hidden layer backward
+  kForwardFlops = 2 * kNumWeights,
+  kBackPropFlops = 2 * kNumWeights + 2 * kHiddenSz * kNumClasses,
+  // Per batch, for summing, regularizing and applying the gradients
+  kUpdateFlops = 4 * kNumWeights
+};
+
+// Fractions of the pixels of synthetic images that are inked: of those in the
+// template of their class, as the template's pixels, and as the other pixels
+static const double kTemplateInk = 0.12;
+static const double kStrokeInk   = 0.4;
+static const double kNoiseInk    = 0.17;
+
+// File names of the MNIST database, as expected by main
+static const string kTrainingSetImageFile = "train-images.idx3-ubyte";
+static const string kTrainingSetLabelFile = "train-labels.idx1-ubyte";
+static const string kTestSetImageFile     = "t10k-images.idx3-ubyte";
+static const string kTestSetLabelFile     = "t10k-labels.idx1-ubyte";
+
+// Numbers of samples in the MNIST database, as generated by --generate
+static const int kMnistTrainingSamples = 60000;
+static const int kMnistTestSamples     = 10000;
+
+// The result of a single benchmark, for output as JSON
+struct Result {
+  string            name;
+  string            config;         // precision, sigmoid, threads, ...
+  double            seconds;        // best over the repetitions
+  double            samples;        // processed per repetition
+  double            flops;          // per repetition, 0 if not applicable
+};
+
+// Create synthetic images, with roughly the same fraction of zero pixels (80%)
+// as the MNIST database. Like a digit, each class has a fixed template of
+// pixels, which its images ink more often than the other pixels, at random
+// intensities. The labels can thus be learned from raw pixel values, as used
+// by the int8 network, so that test set accuracies are meaningful
+static void Synthesize(Mat<uint8_t>& img, Col<uint8_t>& lab)
+{
+  std::mt19937 rng{42};
+  std::bernoulli_distribution in_template{kTemplateInk};
+  std::vector<bool> templates(kNumClasses * kImageSz);
+  for (std::size_t i = 0; i != templates.size(); ++i) {
+    templates[i] = in_template(rng);
+  }
+
+  std::uniform_int_distribution<int> label{0, kNumClasses - 1};
+  std::uniform_int_distribution<int> pixel{1, 255};
+  std::bernoulli_distribution stroke{kStrokeInk};
+  std::bernoulli_distribution noise{kNoiseInk};
+  for (unsigned int j = 0; j != img.n_cols; ++j) {
+    lab[j] = label(rng);
+    for (int i = 0; i != kImageSz; ++i) {
+      const bool ink = templates[lab[j] * kImageSz + i] ? stroke(rng)
+          : noise(rng);
+      img(i, j) = ink ? pixel(rng) : 0;
+    }
+  }
+}
+
+// Write a 32-bit integer in Big Endian order, as used by IDX file headers
+static void WriteBigEndianInt32(ofstream& file, const uint32_t value)
+{
+  const char bytes[] = {static_cast<char>(value >> 24),
+                        static_cast<char>(value >> 16),
+                        static_cast<char>(value >> 8),
+                        static_cast<char>(value)};
+  file.write(bytes, sizeof(bytes));
+}
+
+// Write images (one per column, each stored row-wise) and their labels to an
+// image- and a label file in the IDX format of the MNIST database
+static void WriteIdx(const Mat<uint8_t>& img, const Col<uint8_t>& lab,
+    const string& img_filename, const string& lab_filename)
+{
+  ofstream img_file{img_filename, std::ios::out | std::ios::binary};
+  WriteBigEndianInt32(img_file, mnist::MnistFormat::kMagicNumberImageFile);
+  WriteBigEndianInt32(img_file, img.n_cols);
+  WriteBigEndianInt32(img_file, 28);
+  WriteBigEndianInt32(img_file, 28);
+  img_file.write(reinterpret_cast<const char *>(img.memptr()), img.n_elem);
+  img_file.close();
+  if (!img_file) {
+    throw runtime_error{"Could not write file: " + img_filename};
+  }
+
+  ofstream lab_file{lab_filename, std::ios::out | std::ios::binary};
+  WriteBigEndianInt32(lab_file, mnist::MnistFormat::kMagicNumberLabelFile);
+  WriteBigEndianInt32(lab_file, lab.n_elem);
+  lab_file.write(reinterpret_cast<const char *>(lab.memptr()), lab.n_elem);
+  lab_file.close();
+  if (!lab_file) {
+    throw runtime_error{"Could not write file: " + lab_filename};
+  }
+}
+
+// Write a synthetic training- and test set of the same sizes and under the same
+// file names as the MNIST database to a directory, so that main can be run
+// without downloading it
+static void Generate(const string& path)
+{
+  Mat<uint8_t> img(kImageSz, kMnistTrainingSamples + kMnistTestSamples);
+  Col<uint8_t> lab(img.n_cols);
+  Synthesize(img, lab);
+  WriteIdx(img.head_cols(kMnistTrainingSamples),
+      lab.head(kMnistTrainingSamples), path + "/" + kTrainingSetImageFile,
+      path + "/" + kTrainingSetLabelFile);
+  WriteIdx(img.tail_cols(kMnistTestSamples), lab.tail(kMnistTestSamples),
+      path + "/" + kTestSetImageFile, path + "/" + kTestSetLabelFile);
+}
+
+// Time a function in seconds, as the minimum over a number of repetitions
+// following a warm-up run
+template <typename F>
+static double Time(F fn)
+{
+  fn();
+  double best = 0;
+  for (int i = 0; i != kRepetitions; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    fn();
+    const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    best = i == 0 ? elapsed.count() : std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+// Output the throughput of a benchmark, and record it for output as JSON
+static void Report(std::vector<Result>& results, const string& name,
+    const string& config, const double seconds, const double samples,
+    const double flops = 0)
+{
+  cout << "  " << name << " (samples/s): " << samples / seconds << '\n';
+  if (flops != 0) {
+    cout << "  " << name << " (GFLOP/s): " << flops / seconds * 1e-9 << '\n';
+  }
+  results.push_back(Result{name, config, seconds, samples, flops});
+}
+
+// Write the recorded results to a file as JSON
+static void WriteJson(const std::vector<Result>& results, const int threads,
+    const string& filename)
+{
+  ofstream file{filename};
+  file << "{\n"
+       << "  \"kernels\": \"" << mnist::KernelIsa() << "\",\n"
+       << "  \"quantized_kernels\": \"" << mnist::QuantizedKernelIsa()
+       << "\",\n"
+       << "  \"threads\": " << threads << ",\n"
+       << "  \"repetitions\": " << kRepetitions << ",\n"
+       << "  \"results\": [";
+  for (std::size_t i = 0; i != results.size(); ++i) {
+    const Result& r = results[i];
+    file << (i == 0 ? "\n" : ",\n")
+         << "    {\"name\": \"" << r.name << "\", \"config\": \"" << r.config
+         << "\", \"seconds\": " << r.seconds
+         << ", \"samples_per_s\": " << r.samples / r.seconds;
+    if (r.flops != 0) {
+      file << ", \"gflops\": " << r.flops / r.seconds * 1e-9;
+    }
+    file << '}';
+  }
+  file << "\n  ]\n}\n";
+  file.close();
+  if (!file) {
+    throw runtime_error{"Could not write file: " + filename};
+  }
+}
+
+// Time parsing the images and labels of a data set after writing them to
+// temporary IDX files, which are read from the page cache after the warm-up
+static void BenchParsers(const Mat<uint8_t>& img, const Col<uint8_t>& lab,
+    std::vector<Result>& results)
+{
+  const char * tmpdir = std::getenv("TMPDIR");
+  const string prefix = string(tmpdir != nullptr ? tmpdir : "/tmp")
+      + "/mnist-bench-" + std::to_string(getpid()) + '-';
+  const string img_filename = prefix + kTrainingSetImageFile;
+  const string lab_filename = prefix + kTrainingSetLabelFile;
+  WriteIdx(img, lab, img_filename, lab_filename);
+
+  const double img_time = Time([&]{
+    ImageParser{img_filename.c_str()}.Parse();
+  });
+  const double lab_time = Time([&]{
+    LabelParser{lab_filename.c_str()}.Parse();
+  });
+  std::remove(img_filename.c_str());
+  std::remove(lab_filename.c_str());
+
+  cout << "Parsers\n";
+  Report(results, "ImageParser::Parse", "", img_time, img.n_cols);
+  Report(results, "LabelParser::Parse", "", lab_time, lab.n_elem);
+}
+
+namespace mnist {
+
+/**
+ * @brief Times the forward- and backward propagation of a network with
+ *        weights of type T on a single thread, isolated from the batch
+ *        preparation and the weight updates of training, for dense as well as
+ *        sparse input.
+ */
+template <typename T>
+class NeuralNetBench {
+public:
+  /** @brief The times taken by forward- and backward propagation. */
+  struct Times {
+    double              forward;
+    double              backward;
+  };
+  static void           Propagate(NeuralNet<T>&, const Mat<uint8_t>&,
+                            const Col<uint8_t>&, Times&, Times&);
+  static void           CopyWeights(const NeuralNet<T>&, NeuralNet<T>&);
+};
+
+/**
+ * @brief Times the propagation of the samples of a data set in batches.
+ * Backward propagation is measured as the difference with forward- and
+ * backward propagation combined.
+ *
+ * @param[in,out] nn The network, whose weights are randomly initialized.
+ * @param[in] img The images.
+ * @param[in] lab The labels.
+ * @param[out] dense The times taken with the images as dense batches.
+ * @param[out] sparse The times taken with the images compressed, and referred
+ *             to by index.
+ */
+template <typename T>
+void NeuralNetBench<T>::Propagate(NeuralNet<T>& nn, const Mat<uint8_t>& img,
+    const Col<uint8_t>& lab, Times& dense, Times& sparse)
+{
+  typedef typename NeuralNet<T>::Workspace Workspace;
+  typedef typename NeuralNet<T>::Matrix Matrix;
+  typedef typename NeuralNet<T>::SparseBatch SparseBatch;
+  nn.InitWeights();
+  const Matrix input = arma::conv_to<Matrix>::from(img);
+  Workspace ws{nn, kBatchSz};
+
+  const int num_batches = img.n_cols / kBatchSz;
+  const double forward = Time([&]{
+    for (int i = 0; i != num_batches; ++i) {
+      const Matrix batch(const_cast<T *>(input.colptr(i * kBatchSz)), kImageSz,
+          kBatchSz, false, true);
+      nn.ForwardProp(batch, ws);
+    }
+  });
+  const double both = Time([&]{
+    for (int i = 0; i != num_batches; ++i) {
+      const Matrix batch(const_cast<T *>(input.colptr(i * kBatchSz)), kImageSz,
+          kBatchSz, false, true);
+      const Col<uint8_t> labels(const_cast<uint8_t *>(lab.memptr())
+          + i * kBatchSz, kBatchSz, false, true);
+      nn.ForwardProp(batch, ws);
+      nn.BackProp(batch, labels, ws);
+    }
+  });
+  dense = Times{forward, std::max(both - forward, 0.0)};
+
+  const SparseImages<T> images{img};
+  std::vector<uint32_t> samples(img.n_cols);
+  std::iota(samples.begin(), samples.end(), 0);
+  const double sparse_forward = Time([&]{
+    for (int i = 0; i != num_batches; ++i) {
+      nn.ForwardProp(SparseBatch{&images, samples.data() + i * kBatchSz}, ws);
+    }
+  });
+  const double sparse_both = Time([&]{
+    for (int i = 0; i != num_batches; ++i) {
+      const SparseBatch batch{&images, samples.data() + i * kBatchSz};
+      const Col<uint8_t> labels(const_cast<uint8_t *>(lab.memptr())
+          + i * kBatchSz, kBatchSz, false, true);
+      nn.ForwardProp(batch, ws);
+      nn.BackProp(batch, labels, ws);
+    }
+  });
+  sparse = Times{sparse_forward, std::max(sparse_both - sparse_forward, 0.0)};
+}
+
+/**
+ * @brief Copies the weights of a network to another one of the same layer
+ *        sizes, e.g. to compare their sigmoids on the same weights.
+ * @param[in] from The network to copy the weights of.
+ * @param[out] to The network to copy the weights to.
+ */
+template <typename T>
+void NeuralNetBench<T>::CopyWeights(const NeuralNet<T>& from, NeuralNet<T>& to)
+{
+  if (from.layers_ != to.layers_) {
+    throw runtime_error{"Layer sizes differ."};
+  }
+  to.weights_ = from.weights_;
+}
+
+} // namespace mnist
+
+// Time the sigmoid of a given precision and mode in ns per value, and
+// determine its maximum absolute error relative to the exact sigmoid
+template <typename T>
+static void BenchSigmoid(const SigmoidMode mode, double& time, double& error)
+{
+  std::vector<T> x(kSigmoidSamples);
+  std::vector<T> y(kSigmoidSamples);
+  for (int i = 0; i != kSigmoidSamples; ++i) {
+    x[i] = 100.0 * i / kSigmoidSamples - 50;
+  }
+  time = Time([&]{
+    std::copy(x.begin(), x.end(), y.begin());
+    mnist::Sigmoid(y.data(), y.size(), mode);
+  }) / kSigmoidSamples * 1e9;
+  error = 0;
+  for (int i = 0; i != kSigmoidSamples; ++i) {
+    const double exact = 1.0 / (1.0 + std::exp(-static_cast<double>(x[i])));
+    error = std::max(error, std::abs(y[i] - exact));
+  }
+}
+
+// Time training and evaluation of a network of a given precision with a given
+// sigmoid, and output the results along with the test set accuracy
+template <typename T>
+static void BenchNetwork(const Mat<uint8_t>& train_img,
+    const Col<uint8_t>& train_lab, const Mat<uint8_t>& test_img,
+    const Col<uint8_t>& test_lab, const int threads, const SigmoidMode mode,
+    std::vector<Result>& results)
+{
+  NeuralNet<T> nn{threads, mode};
+
+  // Forward- and backward propagation on their own, on a single thread
+  typename NeuralNetBench<T>::Times dense, sparse;
+  NeuralNetBench<T>::Propagate(nn, train_img, train_lab, dense, sparse);
+
+  // A single epoch, consisting of forward- and backward propagation as well
+  // as the weight update for each batch. The same seed is used for every
+  // configuration, so that differences in accuracy are due to the precision
+  // and the sigmoid alone
+  const double train = Time([&]{
+    arma::arma_rng::set_seed(42);
+    nn.LearnWeights(train_img, train_lab, 0.015, 0.095, 1);
+  });
+
+  // Forward propagation only
+  double accuracy = 0;
+  const double eval = Time([&]{ accuracy = nn.Evaluate(test_img, test_lab); });
+
+  double sigmoid_time, sigmoid_error;
+  BenchSigmoid<T>(mode, sigmoid_time, sigmoid_error);
+
+  const string config = string(sizeof(T) == sizeof(float) ? "float" : "double")
+      + '/' + mnist::kSigmoidModeNames[mode];
+  const double n = train_img.n_cols;
+  const double num_batches = n / kBatchSz;
+  cout << "Precision: " << (sizeof(T) == sizeof(float) ? "float" : "double")
+       << ", sigmoid: " << mnist::kSigmoidModeNames[mode] << '\n'
+       << "  Training step (us/batch): " << train / num_batches * 1e6 << '\n'
+       << "  Forward propagation (us/batch): "
+       << eval / (test_img.n_cols / kBatchSz) * 1e6 << '\n';
+  Report(results, "ForwardProp", config, dense.forward, n,
+      n * kForwardFlops);
+  Report(results, "BackProp", config, dense.backward, n, n * kBackPropFlops);
+  Report(results, "ForwardProp (sparse)", config, sparse.forward, n,
+      n * kForwardFlops);
+  Report(results, "BackProp (sparse)", config, sparse.backward, n,
+      n * kBackPropFlops);
+  Report(results, "Training epoch", config, train, n,
+      n * (kForwardFlops + kBackPropFlops) + num_batches * kUpdateFlops);
+  Report(results, "Evaluate", config, eval, test_img.n_cols,
+      static_cast<double>(test_img.n_cols) * kForwardFlops);
+  cout << "  Test set accuracy (%): " << accuracy << '\n'
+       << "  Sigmoid (ns/value): " << sigmoid_time << '\n'
+       << "  Sigmoid max. abs. error: " << sigmoid_error << '\n';
+}
+
+// Time a training epoch of a single-precision network with each optimizer, and
+// output the results along with the test set accuracy. Adam is given a smaller
+// learning rate, as its steps are normalized by the magnitude of the gradients
+static void BenchOptimizers(const Mat<uint8_t>& train_img,
+    const Col<uint8_t>& train_lab, const Mat<uint8_t>& test_img,
+    const Col<uint8_t>& test_lab, const int threads,
+    std::vector<Result>& results)
+{
+  const double n = train_img.n_cols;
+  const double num_batches = n / kBatchSz;
+  for (int i = mnist::kOptimizerSgd; i <= mnist::kOptimizerAdam; ++i) {
+    Optimizer optimizer = mnist::kDefaultOptimizer;
+    optimizer.kind = static_cast<OptimizerKind>(i);
+    const double rate = optimizer.kind == mnist::kOptimizerAdam ? 0.003 : 0.015;
+    NeuralNet<float> nn{threads, mnist::kSigmoidFast};
+    nn.SetOptimizer(optimizer);
+    const double train = Time([&]{
+      arma::arma_rng::set_seed(42);
+      nn.LearnWeights(train_img, train_lab, rate, 0.095, 1);
+    });
+    const double accuracy = nn.Evaluate(test_img, test_lab);
+
+    cout << "Optimizer: " << mnist::kOptimizerNames[i] << '\n';
+    Report(results, "Training epoch",
+        string("float/fast/") + mnist::kOptimizerNames[i], train, n,
+        n * (kForwardFlops + kBackPropFlops) + num_batches * kUpdateFlops);
+    cout << "  Test set accuracy (%): " << accuracy << '\n';
+  }
+}
+
+// Time classification by a single-precision network and its int8 quantization
+// on a single thread, and output their throughputs and test set accuracies
+static void BenchQuantized(const Mat<uint8_t>& train_img,
+    const Col<uint8_t>& train_lab, const Mat<uint8_t>& test_img,
+    const Col<uint8_t>& test_lab, std::vector<Result>& results)
+{
+  NeuralNet<float> nn{1, mnist::kSigmoidFast};
+  arma::arma_rng::set_seed(42);
+  nn.LearnWeights(train_img, train_lab, 0.015, 0.095, 1);
+  const QuantizedNet qnn{nn};
+
+  double accuracy = 0, quantized_accuracy = 0;
+  const double eval = Time([&]{ accuracy = nn.Evaluate(test_img, test_lab); });
+  const double quantized_eval = Time([&]{
+    quantized_accuracy = qnn.Evaluate(test_img, test_lab);
+  });
+
+  cout << "Quantized kernels: " << mnist::QuantizedKernelIsa() << '\n'
+       << "  Float classification (images/s): "
+       << test_img.n_cols / eval << '\n'
+       << "  Int8 classification (images/s): "
+       << test_img.n_cols / quantized_eval << '\n'
+       << "  Float test set accuracy (%): " << accuracy << '\n'
+       << "  Int8 test set accuracy (%): " << quantized_accuracy << '\n';
+  results.push_back(Result{"Evaluate", "float/fast/1 thread", eval,
+      static_cast<double>(test_img.n_cols), 0});
+  results.push_back(Result{"QuantizedNet::Evaluate", "int8/1 thread",
+      quantized_eval, static_cast<double>(test_img.n_cols), 0});
+}
+
+// Time the distortion of a batch of single-precision images with a given
+// number of threads, with and without elastic distortions, for comparison
+// against the training step
+static void BenchAugment(const Mat<uint8_t>& img, const int threads,
+    std::vector<Result>& results)
+{
+  Distortions affine = mnist::kDefaultDistortions;
+  affine.elastic_alpha = 0;
+  Augmenter<float> affine_augmenter{affine, threads, 42};
+  Augmenter<float> elastic_augmenter{mnist::kDefaultDistortions, threads, 42};
+
+  const Mat<float> batch = arma::conv_to<Mat<float>>::from(
+      img.head_cols(kBatchSz));
+  Mat<float> distorted(batch);
+  unsigned long index = 0;
+  const double affine_time = Time([&]{
+    distorted = batch;
+    affine_augmenter.Apply(distorted.memptr(), kBatchSz, index++);
+  });
+  const double elastic_time = Time([&]{
+    distorted = batch;
+    elastic_augmenter.Apply(distorted.memptr(), kBatchSz, index++);
+  });
+
+  cout << "Augmentation (" << threads << " threads)\n"
+       << "  Affine (us/batch): " << affine_time * 1e6 << '\n'
+       << "  Affine and elastic (us/batch): " << elastic_time * 1e6 << '\n';
+  results.push_back(Result{"Augmenter::Apply", "affine", affine_time,
+      kBatchSz, 0});
+  results.push_back(Result{"Augmenter::Apply", "elastic", elastic_time,
+      kBatchSz, 0});
+}
+
+// Check that a training step performs no heap allocations once warmed up, on
+// any thread and including those by Armadillo and BLAS, for sparse input or
+// for distorted dense input. As training over twice as many batches would
+// allocate the same to start and finish, it must allocate exactly as much in
+// total. Outputs the allocations per batch, returning whether there were none
+template <typename T>
+static bool CheckAllocations(const Mat<uint8_t>& img, const Col<uint8_t>& lab,
+    const int threads, const bool augment)
+{
+  NeuralNet<T> nn{threads, mnist::kSigmoidFast};
+  if (augment) {
+    nn.Augment(mnist::kDefaultDistortions, threads);
+  }
+  uint64_t counts[3];
+  for (int i = 0; i != 3; ++i) {
+    // The first run warms up, and the last trains on twice as many batches
+    const arma::uword n = (i == 2 ? 2 : 1) * kAllocationCheckBatches
+        * kBatchSz;
+    const Mat<uint8_t> train_img(const_cast<uint8_t *>(img.memptr()),
+        img.n_rows, n, false, true);
+    const Col<uint8_t> train_lab(const_cast<uint8_t *>(lab.memptr()), n,
+        false, true);
+    const uint64_t before = mallocs.load();
+    nn.LearnWeights(train_img, train_lab, 0.015, 0.095, 1);
+    counts[i] = mallocs.load() - before;
+  }
+  const double per_batch = (static_cast<double>(counts[2]) - counts[1])
+      / kAllocationCheckBatches;
+  cout << "  " << (sizeof(T) == sizeof(float) ? "float" : "double") << ", "
+       << threads << " thread(s), " << (augment ? "distorted" : "sparse")
+       << " (allocations/batch): " << per_batch << '\n';
+  return counts[2] == counts[1];
+}
+
+// Returns the percentage of labels that two vectors agree on
+static double Agreement(const Col<uint8_t>& lab, const Col<uint8_t>& other)
+{
+  int cnt = 0;
+  for (arma::uword i = 0; i != lab.n_elem; ++i) {
+    cnt += lab[i] == other[i];
+  }
+  return static_cast<double>(cnt) / lab.n_elem * 100;
+}
+
+// Check that neither approximating the sigmoid nor quantizing a network to
+// int8 costs more than kMaxAccuracyLoss percentage points of test set accuracy,
+// nor changes the predictions for more than a few samples (kMinAgreement).
+// A network with the exact sigmoid is trained once, and the approximations
+// are evaluated on its weights, so that the difference is due to them alone
+// rather than to a diverging course of training. Outputs the accuracies and
+// agreements, returning whether all are within the bounds
+template <typename T>
+static bool CheckAccuracy(const Mat<uint8_t>& train_img,
+    const Col<uint8_t>& train_lab, const Mat<uint8_t>& test_img,
+    const Col<uint8_t>& test_lab, const int threads)
+{
+  const std::vector<int> layers = {kImageSz, kAccuracyCheckHiddenSz,
+      kNumClasses};
+  NeuralNet<T> exact{threads, mnist::kSigmoidExact, kBatchSz, layers};
+  arma::arma_rng::set_seed(42);
+  exact.LearnWeights(train_img, train_lab, 0.05, 0.095, kAccuracyCheckEpochs);
+  const Col<uint8_t> expected = exact.Predict(test_img);
+  const double reference = Agreement(expected, test_lab);
+
+  const string precision = sizeof(T) == sizeof(float) ? "float" : "double";
+  cout << "  " << precision << ", exact sigmoid (%): " << reference << '\n';
+  bool passed = true;
+  const auto report = [&](const string& config, const Col<uint8_t>& lab){
+    const double accuracy = Agreement(lab, test_lab);
+    const double agreement = Agreement(lab, expected);
+    const bool within = accuracy >= reference - kMaxAccuracyLoss
+        && agreement >= kMinAgreement;
+    cout << "  " << precision << ", " << config << " (%): " << accuracy
+         << ", agreeing with exact (%): " << agreement
+         << (within ? "\n" : " (too low)\n");
+    passed &= within;
+  };
+  for (int i = mnist::kSigmoidFast; i <= mnist::kSigmoidTable; ++i) {
+    NeuralNet<T> nn{threads, static_cast<SigmoidMode>(i), kBatchSz, layers};
+    NeuralNetBench<T>::CopyWeights(exact, nn);
+    report(string(mnist::kSigmoidModeNames[i]) + " sigmoid",
+        nn.Predict(test_img));
+  }
+  report("int8", QuantizedNet{exact}.Classify(test_img));
+  return passed;
+}
+
+// Check that the checkpoint written by training with a validator, after every
+// epoch, holds the weights of the most accurate snapshot that the network is
+// left with, rather than those of the last epoch. Outputs the accuracies of
+// the network and of the checkpoint, returning whether they are the same
+template <typename T>
+static bool CheckCheckpoint(const Mat<uint8_t>& train_img,
+    const Col<uint8_t>& train_lab, const Mat<uint8_t>& test_img,
+    const Col<uint8_t>& test_lab, const int threads)
+{
+  const arma::uword train = train_img.n_cols - kCheckpointCheckValidation;
+  const Mat<uint8_t> val_img(const_cast<uint8_t *>(train_img.colptr(train)),
+      kImageSz, kCheckpointCheckValidation, false, true);
+  const Col<uint8_t> val_lab(const_cast<uint8_t *>(train_lab.memptr()) + train,
+      kCheckpointCheckValidation, false, true);
+  const string filename = string{"/tmp/mnist-bench-"}
+      + std::to_string(getpid()) + ".ckpt";
+
+  NeuralNet<T> nn{threads, mnist::kSigmoidFast};
+  nn.SetCheckpoint(filename, 1);
+  arma::arma_rng::set_seed(42);
+  {
+    const Mat<uint8_t> img(const_cast<uint8_t *>(train_img.memptr()),
+        kImageSz, train, false, true);
+    const Col<uint8_t> lab(const_cast<uint8_t *>(train_lab.memptr()), train,
+        false, true);
+    Validator<T> validator{nn, val_img, val_lab, 1};
+    nn.LearnWeights(img, lab, 0.015, 0.095, kCheckpointCheckEpochs,
+        &validator);
+  }
+  NeuralNet<T> loaded{threads, mnist::kSigmoidFast};
+  loaded.Load(filename.c_str());
+  std::remove(filename.c_str());
+
+  const double expected = nn.Evaluate(test_img, test_lab);
+  const double actual = loaded.Evaluate(test_img, test_lab);
+  const bool same = actual == expected && loaded.Epochs() == nn.Epochs();
+  cout << "  " << (sizeof(T) == sizeof(float) ? "float" : "double")
+       << ", after epoch " << nn.Epochs() << " (%): " << expected
+       << ", loaded: " << actual << ", after epoch " << loaded.Epochs()
+       << (same ? "\n" : " (differs)\n");
+  return same;
+}
+
+int main(int argc, char *argv[])
+{
+  // Number of threads, optionally supplied on the command line, along with a
+  // file to write the results to as JSON (--json=FILE). Alternatively, write
+  // a synthetic stand-in for the MNIST database to a directory instead
+  // (--generate=DIR), or check the properties that the benchmarks rely on,
+  // exiting with a non-zero status if any fails (--check)
+  int threads = 1;
+  string json;
+  bool check = false;
+  for (int i = 1; i != argc; ++i) {
+    const string arg = argv[i];
+    if (arg.compare(0, 7, "--json=") == 0) {
+      json = arg.substr(7);
+    } else if (arg == "--check") {
+      check = true;
+    } else if (arg.compare(0, 11, "--generate=") == 0) {
+      Generate(arg.substr(11));
+      return 0;
+    } else {
+      threads = std::atoi(argv[i]);
+    }
+  }
+
+  Mat<uint8_t> img(kImageSz, kNumSamples);
+  Col<uint8_t> lab(kNumSamples);
+  Synthesize(img, lab);
+  const Mat<uint8_t> train_img = img.head_cols(kNumSamples - kNumTestSamples);
+  const Col<uint8_t> train_lab = lab.head(kNumSamples - kNumTestSamples);
+  const Mat<uint8_t> test_img = img.tail_cols(kNumTestSamples);
+  const Col<uint8_t> test_lab = lab.tail(kNumTestSamples);
+  cout << "Kernels: " << mnist::KernelIsa() << '\n';
+
+  if (check) {
+    cout << "Heap allocations per training step\n";
+    bool passed = true;
+    for (const bool augment : {false, true}) {
+      passed &= CheckAllocations<float>(train_img, train_lab, threads, augment);
+      passed &= CheckAllocations<double>(train_img, train_lab, threads,
+          augment);
+    }
+    cout << "Test set accuracy\n";
+    passed &= CheckAccuracy<float>(train_img, train_lab, test_img, test_lab,
+        threads);
+    passed &= CheckAccuracy<double>(train_img, train_lab, test_img, test_lab,
+        threads);
+    cout << "Test set accuracy of the checkpoint kept by validation\n";
+    passed &= CheckCheckpoint<float>(train_img, train_lab, test_img, test_lab,
+        threads);
+    passed &= CheckCheckpoint<double>(train_img, train_lab, test_img, test_lab,
+        threads);
+    cout << (passed ? "All checks passed.\n" : "Some checks failed.\n");
+    return passed ? 0 : 1;
+  }
+
+  std::vector<Result> results;
+  BenchParsers(train_img, train_lab, results);
+  for (int i = mnist::kSigmoidExact; i <= mnist::kSigmoidTable; ++i) {
+    const SigmoidMode mode = static_cast<SigmoidMode>(i);
+    BenchNetwork<double>(train_img, train_lab, test_img, test_lab, threads,
+        mode, results);
+    BenchNetwork<float>(train_img, train_lab, test_img, test_lab, threads,
+        mode, results);
+  }
+  BenchOptimizers(train_img, train_lab, test_img, test_lab, threads, results);
+  BenchQuantized(train_img, train_lab, test_img, test_lab, results);
+  BenchAugment(train_img, threads, results);
+
+  if (!json.empty()) {
+    WriteJson(results, threads, json);
+  }
+  return 0;
+}
@@ -0,0 +1,179 @@
+/**
+ * @file
+ * @brief Implementation of checkpoints of the learned network parameters.
+ * @author Arno Bastenhof
+ */
+
+#include "checkpoint.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "checksum.hpp"
+
+using std::ofstream;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+static const char kMagic[8] = {'M', 'N', 'S', 'T', 'C', 'K', 'P', 'T'};
+
+// Rounds a size up to the nearest multiple of the checkpoint alignment
+static inline uint64_t Align(const uint64_t size)
+{
+  const uint64_t alignment = mnist::CheckpointHeader::kAlignment;
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+// Copies weights from a checkpoint, converting them to the requested type
+template <typename T, typename eT>
+static inline void CopyWeights(const uint8_t * data, const std::size_t n,
+    T * out)
+{
+  const eT * weights = reinterpret_cast<const eT *>(data);
+  std::copy(weights, weights + n, out);
+}
+
+namespace mnist {
+
+/**
+ * @brief Writes the weights of a network to a checkpoint file.
+ *
+ * The file is written under a temporary name first and then renamed, so that
+ * an interrupted write never leaves behind a partial checkpoint, nor destroys
+ * the previous one.
+ *
+ * @param[in] weights The weights, including biases.
+ * @param[in] num_weights The number of weights.
+ * @param[in] layer_sizes The number of units of each layer, excluding biases.
+ * @param[in] num_layers The number of layers, including the input layer.
+ * @param[in] epochs The number of epochs the network was trained for.
+ * @param[in] filename The full path of the checkpoint file.
+ */
+template <typename T>
+void WriteCheckpoint(const T * weights, const std::size_t num_weights,
+    const uint32_t * layer_sizes, const int num_layers,
+    const unsigned long epochs, const char * filename)
+{
+  if (num_layers < 2 || num_layers > CheckpointHeader::kMaxLayers) {
+    throw runtime_error{"Unsupported number of layers for checkpoint."};
+  }
+
+  CheckpointHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = CheckpointHeader::kVersion;
+  header.elem_size = sizeof(T);
+  header.epochs = epochs;
+  header.num_weights = num_weights;
+  header.weights_offset = Align(sizeof(CheckpointHeader));
+  header.num_layers = num_layers;
+  std::copy(layer_sizes, layer_sizes + num_layers, header.layer_sizes);
+
+  // The weights, padded up to the end of the file
+  vector<uint8_t> body(Align(num_weights * sizeof(T)), 0);
+  std::memcpy(body.data(), weights, num_weights * sizeof(T));
+  Checksum checksum;
+  checksum.Update(body.data(), body.size());
+  header.checksum = checksum.Value();
+
+  // Write to a temporary file first, so that an interrupted write leaves the
+  // previous checkpoint intact. Its name is unique to the process, as with
+  // data set caches
+  const string tmp_filename = string(filename) + ".tmp"
+      + std::to_string(getpid());
+  ofstream file{tmp_filename, std::ios::out | std::ios::binary};
+  if (!file) {
+    throw runtime_error{string("Could not create file: ") + filename};
+  }
+  vector<char> padding(header.weights_offset, 0);
+  std::memcpy(padding.data(), &header, sizeof(header));
+  file.write(padding.data(), padding.size());
+  file.write(reinterpret_cast<const char *>(body.data()), body.size());
+  file.close();
+  if (!file || std::rename(tmp_filename.c_str(), filename) != 0) {
+    std::remove(tmp_filename.c_str());
+    throw runtime_error{string("Could not write file: ") + filename};
+  }
+}
+
+/**
+ * @brief Constructor that maps a checkpoint file into memory and validates its
+ *        header and checksum.
+ * @param[in] filename The full path of the checkpoint file.
+ */
+Checkpoint::Checkpoint(const char * filename)
+  : file_{filename}
+  , header_(ValidateHeader(file_))
+{
+}
+
+/**
+ * @brief Copies the weights into a buffer, converting them to type T (float
+ *        or double) if they were stored in the other precision.
+ * @param[out] out The buffer, holding at least NumWeights() elements.
+ */
+template <typename T>
+void Checkpoint::ReadWeights(T * out) const
+{
+  const uint8_t * data = file_.Data() + header_.weights_offset;
+  if (header_.elem_size == sizeof(float)) {
+    CopyWeights<T, float>(data, header_.num_weights, out);
+  } else {
+    CopyWeights<T, double>(data, header_.num_weights, out);
+  }
+}
+
+// Validates the header and checksum of a mapped checkpoint file and returns
+// the header
+const CheckpointHeader& Checkpoint::ValidateHeader(const MappedFile& file)
+{
+  if (file.Size() < sizeof(CheckpointHeader)) {
+    throw runtime_error{"Could not read checkpoint file header."};
+  }
+  const CheckpointHeader& header =
+    *reinterpret_cast<const CheckpointHeader *>(file.Data());
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+    throw runtime_error{"Unexpected magic number for checkpoint file."};
+  }
+  if (header.version != CheckpointHeader::kVersion) {
+    throw runtime_error{"Unsupported checkpoint file version."};
+  }
+  if (header.elem_size != sizeof(float)
+      && header.elem_size != sizeof(double)) {
+    throw runtime_error{"Unexpected element size in checkpoint file."};
+  }
+  if (header.num_layers < 2
+      || header.num_layers > CheckpointHeader::kMaxLayers
+      || header.weights_offset != Align(sizeof(CheckpointHeader))
+      || file.Size() != header.weights_offset
+          + Align(header.num_weights * header.elem_size)) {
+    throw runtime_error{"Unexpected dimensions in checkpoint file header."};
+  }
+
+  // Validate the file's body
+  Checksum checksum;
+  checksum.Update(file.Data() + header.weights_offset,
+      file.Size() - header.weights_offset);
+  if (checksum.Value() != header.checksum) {
+    throw runtime_error{"Checksum mismatch in checkpoint file."};
+  }
+  return header;
+}
+
+// Weights are stored and read in single or double precision
+template void WriteCheckpoint<float>(const float *, const std::size_t,
+    const uint32_t *, const int, const unsigned long, const char *);
+template void WriteCheckpoint<double>(const double *, const std::size_t,
+    const uint32_t *, const int, const unsigned long, const char *);
+template void Checkpoint::ReadWeights<float>(float *) const;
+template void Checkpoint::ReadWeights<double>(double *) const;
+
+} // namespace mnist
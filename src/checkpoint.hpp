@@ -0,0 +1,104 @@
+/**
+ * @file
+ * @brief Interface for checkpoints of the learned network parameters.
+ * @author Arno Bastenhof
+ */
+
+#ifndef CHECKPOINT_HPP_
+#define CHECKPOINT_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mapped_file.hpp"
+
+namespace mnist {
+
+/**
+ * @brief Header of a checkpoint file.
+ *
+ * A checkpoint file consists of this header, followed by the weights of the
+ * network, stored as floats or doubles (see elem_size) in the order used by
+ * NeuralNet. The weights start at an offset that is a multiple of kAlignment,
+ * and are padded to such a multiple as well. The checksum is computed over
+ * everything following the header. All fields are in native byte order.
+ */
+struct CheckpointHeader {
+  enum {
+    kVersion = 1,
+    kAlignment = 64,                // cache line size
+    kMaxLayers = 8
+  };
+  char              magic[8];       // "MNSTCKPT"
+  uint32_t          version;        // format version
+  uint32_t          elem_size;      // bytes per weight
+  uint64_t          epochs;         // number of epochs trained
+  uint64_t          num_weights;
+  uint64_t          weights_offset; // file offset of the weights
+  uint64_t          checksum;       // checksum of the file's body
+  uint32_t          num_layers;
+  uint32_t          layer_sizes[kMaxLayers];  // units, excluding biases
+};
+
+template <typename T>
+void WriteCheckpoint(const T *, const std::size_t, const uint32_t *,
+    const int, const unsigned long, const char *);
+
+/**
+ * @brief A checkpoint file mapped into memory.
+ */
+class Checkpoint {
+public:
+  explicit                  Checkpoint(const char *);
+                            Checkpoint(const Checkpoint&) = delete;
+                            Checkpoint(Checkpoint&&) = delete;
+  Checkpoint&               operator=(const Checkpoint&) = delete;
+  int                       NumLayers() const;
+  int                       LayerSize(const int) const;
+  unsigned long             Epochs() const;
+  std::size_t               NumWeights() const;
+  template <typename T>
+  void                      ReadWeights(T *) const;
+private:
+  MappedFile                file_;
+  const CheckpointHeader&   header_;
+  static const CheckpointHeader& ValidateHeader(const MappedFile&);
+};
+
+/**
+ * @brief Returns the number of layers of the network, including the input
+ *        layer.
+ */
+inline int Checkpoint::NumLayers() const
+{
+  return header_.num_layers;
+}
+
+/**
+ * @brief Returns the number of units of a layer, excluding the bias unit.
+ * @param[in] i The index of the layer, with 0 the input layer.
+ */
+inline int Checkpoint::LayerSize(const int i) const
+{
+  return header_.layer_sizes[i];
+}
+
+/**
+ * @brief Returns the number of epochs the network was trained for.
+ */
+inline unsigned long Checkpoint::Epochs() const
+{
+  return header_.epochs;
+}
+
+/**
+ * @brief Returns the number of weights, including biases.
+ */
+inline std::size_t Checkpoint::NumWeights() const
+{
+  return header_.num_weights;
+}
+
+} // namespace mnist
+
+#endif // CHECKPOINT_HPP_
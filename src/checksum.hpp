@@ -0,0 +1,66 @@
+/**
+ * @file
+ * @brief Checksum used for validating binary files written by this program.
+ * @author Arno Bastenhof
+ */
+
+#ifndef CHECKSUM_HPP_
+#define CHECKSUM_HPP_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace mnist {
+
+/**
+ * @brief Incremental FNV-1a style checksum over 64-bit words.
+ *
+ * Hashing whole words rather than single bytes keeps validation of large
+ * files close to memory bandwidth. Input sizes must be multiples of 8 bytes.
+ */
+class Checksum {
+public:
+                    Checksum();
+  void              Update(const void *, std::size_t);
+  uint64_t          Value() const;
+private:
+  uint64_t          hash_;
+};
+
+/**
+ * @brief Default constructor.
+ */
+inline Checksum::Checksum()
+  : hash_(0xcbf29ce484222325ull)
+{
+}
+
+/**
+ * @brief Adds a block of data to the checksum.
+ * @param[in] data The data to add.
+ * @param[in] size The size of the data in bytes (a multiple of 8).
+ */
+inline void Checksum::Update(const void * data, const std::size_t size)
+{
+  assert(size % sizeof(uint64_t) == 0);
+  const uint8_t * bytes = static_cast<const uint8_t *>(data);
+  for (std::size_t i = 0; i != size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, sizeof(word));
+    hash_ = (hash_ ^ word) * 0x100000001b3ull;
+  }
+}
+
+/**
+ * @brief Returns the checksum of all data added so far.
+ */
+inline uint64_t Checksum::Value() const
+{
+  return hash_;
+}
+
+} // namespace mnist
+
+#endif // CHECKSUM_HPP_
@@ -0,0 +1,129 @@
+/**
+ * @file
+ * @brief Implementation of collective operations among the processes of a
+ *        ring, as used by distributed training.
+ * @author Arno Bastenhof
+ */
+
+#include "communicator.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+using std::runtime_error;
+
+// Number of bytes sent along the ring at once, so that each process forwards
+// the start of an array while the end is still on its way
+static const std::size_t kChunkSz = 1 << 16;
+
+namespace mnist {
+
+/**
+ * @brief Constructor.
+ * @param[in] rank The rank of this process, from 0.
+ * @param[in] world The number of processes.
+ * @param[in] transport The links to the neighbours of this process, or
+ *            nullptr if it is the only one.
+ */
+Communicator::Communicator(const int rank, const int world,
+    std::unique_ptr<Transport> transport)
+  : rank_(rank), world_(world), transport_(std::move(transport))
+{
+  if (world < 1 || rank < 0 || rank >= world
+      || (world > 1) != (transport_ != nullptr)) {
+    throw runtime_error{"Invalid rank or world size."};
+  }
+}
+
+/**
+ * @brief Sums a number of arrays of each process element-wise, such that every
+ *        process obtains the sum over all of them.
+ *
+ * Equivalent to a single process adding all arrays in turn to the first, those
+ * of rank 0 first and in the given order within each process. To that end,
+ * the partial sums are passed along the ring from rank 0 to the last rank,
+ * each adding its own arrays, after which the last rank passes the total
+ * around to the others. Both run in chunks, in a pipeline along the ring.
+ * Unlike a reduce-scatter followed by an all-gather, each link thus carries
+ * the whole array twice rather than 2(W - 1)/W times, in return for a fixed
+ * order of summation.
+ *
+ * @param[in] arrays The arrays of this process.
+ * @param[in] num_arrays The number of arrays of this process (at least 1).
+ * @param[in] size The number of elements of each array.
+ * @param[out] sum The sum, which may not overlap the arrays.
+ */
+template <typename T>
+void Communicator::AllReduce(const T * const * arrays, const int num_arrays,
+    const std::size_t size, T * sum)
+{
+  const std::size_t chunk = kChunkSz / sizeof(T);
+  const int last = world_ - 1;
+  for (std::size_t begin = 0; begin < size; begin += chunk) {
+    const std::size_t end = std::min(size, begin + chunk);
+    if (rank_ == 0) {
+      std::copy(arrays[0] + begin, arrays[0] + end, sum + begin);
+    } else {
+      transport_->Receive(sum + begin, (end - begin) * sizeof(T));
+      for (std::size_t i = begin; i != end; ++i) {
+        sum[i] += arrays[0][i];
+      }
+    }
+    for (int k = 1; k < num_arrays; ++k) {
+      for (std::size_t i = begin; i != end; ++i) {
+        sum[i] += arrays[k][i];
+      }
+    }
+    if (rank_ != last) {
+      transport_->Send(sum + begin, (end - begin) * sizeof(T));
+    }
+  }
+
+  // Pass the total around from the last rank, via rank 0, to the one before
+  // the last. Each rank only starts once it has sent all of its partial sums,
+  // so that no link waits on one that waits on it in turn
+  if (world_ > 1) {
+    Broadcast(sum, size * sizeof(T), last);
+  }
+}
+
+/**
+ * @brief Copies data from rank 0 to every other process.
+ * @param[in,out] data The data to send on rank 0, and to receive into on the
+ *                others.
+ * @param[in] size The number of bytes.
+ */
+void Communicator::Broadcast(void * data, const std::size_t size)
+{
+  if (world_ > 1) {
+    Broadcast(data, size, 0);
+  }
+}
+
+// Passes data from a given rank around the ring to the one before it, in
+// chunks, with each rank forwarding a chunk as soon as it has received it
+void Communicator::Broadcast(void * data, const std::size_t size,
+    const int root)
+{
+  uint8_t * const bytes = static_cast<uint8_t *>(data);
+  const int before = (root + world_ - 1) % world_;
+  for (std::size_t begin = 0; begin < size; begin += kChunkSz) {
+    const std::size_t n = std::min(size - begin, kChunkSz);
+    if (rank_ != root) {
+      transport_->Receive(bytes + begin, n);
+    }
+    if (rank_ != before) {
+      transport_->Send(bytes + begin, n);
+    }
+  }
+}
+
+// Single and double precision gradients
+template void Communicator::AllReduce(const float * const *, const int,
+    const std::size_t, float *);
+template void Communicator::AllReduce(const double * const *, const int,
+    const std::size_t, double *);
+
+} // namespace mnist
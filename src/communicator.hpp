@@ -0,0 +1,64 @@
+/**
+ * @file
+ * @brief Interface for collective operations among the processes of a ring,
+ *        as used by distributed training.
+ * @author Arno Bastenhof
+ */
+
+#ifndef COMMUNICATOR_HPP_
+#define COMMUNICATOR_HPP_
+
+#include <cstddef>
+#include <memory>
+
+#include "transport.hpp"
+
+namespace mnist {
+
+/**
+ * @brief Sums arrays across a ring of processes and broadcasts data from the
+ *        first, over a Transport to each process's neighbours.
+ *
+ * Sums are computed in a fixed order, from rank 0 up, regardless of the
+ * transport and the timing of the processes, so that each process obtains
+ * the same result as a single process summing all arrays by itself.
+ */
+class Communicator {
+public:
+                        Communicator(const int, const int,
+                            std::unique_ptr<Transport>);
+                        Communicator(const Communicator&) = delete;
+                        Communicator(Communicator&&) = delete;
+  Communicator&         operator=(const Communicator&) = delete;
+  int                   Rank() const;
+  int                   WorldSize() const;
+  template <typename T>
+  void                  AllReduce(const T * const *, const int,
+                            const std::size_t, T *);
+  void                  Broadcast(void *, const std::size_t);
+private:
+  void                  Broadcast(void *, const std::size_t, const int);
+  const int             rank_;
+  const int             world_;
+  const std::unique_ptr<Transport> transport_;  // nullptr if alone
+};
+
+/**
+ * @brief Returns the rank of this process, from 0.
+ */
+inline int Communicator::Rank() const
+{
+  return rank_;
+}
+
+/**
+ * @brief Returns the number of processes.
+ */
+inline int Communicator::WorldSize() const
+{
+  return world_;
+}
+
+} // namespace mnist
+
+#endif // COMMUNICATOR_HPP_
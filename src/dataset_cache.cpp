@@ -0,0 +1,182 @@
+/**
+ * @file
+ * @brief Implementation of preconverted, memory-mapped MNIST data set caches.
+ * @author Arno Bastenhof
+ */
+
+#include "dataset_cache.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "checksum.hpp"
+#include "mnist_parser.hpp"
+
+using std::ofstream;
+using std::runtime_error;
+using std::string;
+using std::transform;
+using std::vector;
+
+using arma::Col;
+using arma::Mat;
+
+static const char kMagic[8] = {'M', 'N', 'S', 'T', 'C', 'A', 'C', 'H'};
+
+// Rounds a size up to the nearest multiple of the cache file alignment
+static inline uint64_t Align(const uint64_t size)
+{
+  const uint64_t alignment = mnist::CacheHeader::kAlignment;
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+namespace mnist {
+
+/**
+ * @brief Writes a data set to a cache file.
+ *
+ * The images are converted to eT (float or double) and multiplied by a scale
+ * factor once, so that subsequent runs can map them into memory in the layout
+ * consumed by the network, without parsing or converting them again.
+ *
+ * @param[in] img The images, one per column.
+ * @param[in] lab The labels of the images.
+ * @param[in] filename The full path of the cache file.
+ * @param[in] scale The factor by which to multiply the raw pixel values.
+ */
+template <typename eT>
+void WriteDatasetCache(const Mat<uint8_t>& img, const Col<uint8_t>& lab,
+    const char * filename, const double scale)
+{
+  if (img.n_cols != lab.n_rows) {
+    throw runtime_error{"Numbers of images and labels differ."};
+  }
+
+  CacheHeader header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = CacheHeader::kVersion;
+  header.elem_size = sizeof(eT);
+  header.num_items = img.n_cols;
+  header.num_features = img.n_rows;
+  header.lab_offset = Align(sizeof(CacheHeader));
+  header.img_offset = header.lab_offset + Align(lab.n_rows);
+  header.checksum = 0;
+  header.scale = scale;
+
+  // Write to a temporary file first, so that an interrupted write never leaves
+  // behind a partial cache file. Its name is unique to the process, so that
+  // processes writing the same cache at once do not write the same file
+  const string tmp_filename = string(filename) + ".tmp"
+      + std::to_string(getpid());
+  ofstream file{tmp_filename, std::ios::out | std::ios::binary};
+  if (!file) {
+    throw runtime_error{string("Could not create file: ") + filename};
+  }
+
+  // Write a provisional header, to be overwritten once the checksum is known
+  vector<char> padding(header.lab_offset, 0);
+  std::memcpy(padding.data(), &header, sizeof(header));
+  file.write(padding.data(), padding.size());
+
+  // Labels, padded up to the start of the features
+  Checksum checksum;
+  vector<uint8_t> labels(header.img_offset - header.lab_offset, 0);
+  std::copy(lab.begin(), lab.end(), labels.begin());
+  file.write(reinterpret_cast<const char *>(labels.data()), labels.size());
+  checksum.Update(labels.data(), labels.size());
+
+  // Features, converted one sample at a time
+  vector<eT> features(img.n_rows);
+  const std::size_t size = features.size() * sizeof(eT);
+  for (unsigned int i = 0; i != img.n_cols; ++i) {
+    transform(img.colptr(i), img.colptr(i) + img.n_rows, features.begin(),
+        [scale](const uint8_t val){ return static_cast<eT>(scale * val); });
+    file.write(reinterpret_cast<const char *>(features.data()), size);
+    checksum.Update(features.data(), size);
+  }
+
+  // Rewrite the header
+  header.checksum = checksum.Value();
+  file.seekp(0);
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.close();
+  if (!file || std::rename(tmp_filename.c_str(), filename) != 0) {
+    std::remove(tmp_filename.c_str());
+    throw runtime_error{string("Could not write file: ") + filename};
+  }
+}
+
+/**
+ * @brief Constructor that maps a cache file into memory.
+ *
+ * The header, checksum and labels are validated, after which the features and labels
+ * are exposed as views over the mapped file.
+ *
+ * @param[in] filename The full path of the cache file.
+ */
+template <typename eT>
+CachedDataset<eT>::CachedDataset(const char * filename)
+  : file_{filename}
+  , header_(ValidateHeader(file_))
+  , images_(reinterpret_cast<eT *>(
+        const_cast<uint8_t *>(file_.Data()) + header_.img_offset),
+      header_.num_features, header_.num_items, false, true)
+  , labels_(const_cast<uint8_t *>(file_.Data()) + header_.lab_offset,
+      header_.num_items, false, true)
+{
+}
+
+// Validates the header and checksum of a mapped cache file and returns the
+// header
+template <typename eT>
+const CacheHeader& CachedDataset<eT>::ValidateHeader(const MappedFile& file)
+{
+  if (file.Size() < sizeof(CacheHeader)) {
+    throw runtime_error{"Could not read cache file header."};
+  }
+  const CacheHeader& header =
+    *reinterpret_cast<const CacheHeader *>(file.Data());
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+    throw runtime_error{"Unexpected magic number for cache file."};
+  }
+  if (header.version != CacheHeader::kVersion) {
+    throw runtime_error{"Unsupported cache file version."};
+  }
+  if (header.elem_size != sizeof(eT)) {
+    throw runtime_error{"Unexpected element size in cache file."};
+  }
+  if (header.lab_offset != Align(sizeof(CacheHeader))
+      || header.img_offset != header.lab_offset + Align(header.num_items)
+      || file.Size() != header.img_offset
+          + header.num_items * header.num_features * sizeof(eT)) {
+    throw runtime_error{"Unexpected dimensions in cache file header."};
+  }
+
+  // Validate the file's body
+  Checksum checksum;
+  checksum.Update(file.Data() + header.lab_offset,
+      file.Size() - header.lab_offset);
+  if (checksum.Value() != header.checksum) {
+    throw runtime_error{"Checksum mismatch in cache file."};
+  }
+  MnistFormat::ValidateLabels(file.Data() + header.lab_offset,
+      header.num_items);
+  return header;
+}
+
+// Features are cached in single or double precision
+template void WriteDatasetCache<float>(const Mat<uint8_t>&,
+    const Col<uint8_t>&, const char *, const double);
+template void WriteDatasetCache<double>(const Mat<uint8_t>&,
+    const Col<uint8_t>&, const char *, const double);
+template class CachedDataset<float>;
+template class CachedDataset<double>;
+
+} // namespace mnist
@@ -0,0 +1,126 @@
+/**
+ * @file
+ * @brief Interface for preconverted, memory-mapped MNIST data set caches.
+ * @author Arno Bastenhof
+ */
+
+#ifndef DATASET_CACHE_HPP_
+#define DATASET_CACHE_HPP_
+
+#include <cstdint>
+
+#include <armadillo>
+
+#include "mapped_file.hpp"
+
+namespace mnist {
+
+/**
+ * @brief Header of a data set cache file.
+ *
+ * A cache file consists of this header, followed by the labels (one byte
+ * each) and the features of all samples, stored as floats or doubles (see
+ * elem_size) with the features of each sample contiguous. Both the labels and
+ * the features start at offsets that are multiples of kAlignment, and the
+ * checksum is computed over everything following the header. All fields are in native byte order.
+ */
+struct CacheHeader {
+  enum {
+    kVersion = 1,
+    kAlignment = 64                 // cache line size
+  };
+  char              magic[8];       // "MNSTCACH"
+  uint32_t          version;        // format version
+  uint32_t          elem_size;      // bytes per feature
+  uint64_t          num_items;      // number of samples
+  uint64_t          num_features;   // number of features per sample
+  uint64_t          lab_offset;     // file offset of the labels
+  uint64_t          img_offset;     // file offset of the features
+  uint64_t          checksum;       // checksum of the file's body
+  double            scale;          // factor applied to the raw pixel values
+};
+
+template <typename eT>
+void WriteDatasetCache(const arma::Mat<uint8_t>&, const arma::Col<uint8_t>&,
+    const char *, const double);
+
+/**
+ * @brief A data set cache file mapped into memory, with features of type eT
+ *        (float or double).
+ */
+template <typename eT>
+class CachedDataset {
+public:
+  explicit                  CachedDataset(const char *);
+                            CachedDataset(const CachedDataset&) = delete;
+                            CachedDataset(CachedDataset&&) = delete;
+  CachedDataset&            operator=(const CachedDataset&) = delete;
+  const arma::Mat<eT>&      Images() const;
+  const arma::Col<uint8_t>& Labels() const;
+  const arma::Mat<eT>       Batch(const int, const int) const;
+  int                       Size() const;
+  double                    Scale() const;
+private:
+  MappedFile                file_;
+  const CacheHeader&        header_;
+  const arma::Mat<eT>       images_;    // views over file_
+  const arma::Col<uint8_t>  labels_;
+  static const CacheHeader& ValidateHeader(const MappedFile&);
+};
+
+/**
+ * @brief Returns the features as a read-only m x n matrix, with m the number
+ *        of features and n the number of samples.
+ *
+ * Each column holds the features of one sample. The matrix is a view directly
+ * over the mapped file and does not own its memory.
+ */
+template <typename eT>
+inline const arma::Mat<eT>& CachedDataset<eT>::Images() const
+{
+  return images_;
+}
+
+/**
+ * @brief Returns the labels as a read-only column vector of length n.
+ */
+template <typename eT>
+inline const arma::Col<uint8_t>& CachedDataset<eT>::Labels() const
+{
+  return labels_;
+}
+
+/**
+ * @brief Returns a read-only view of a batch of consecutive samples.
+ * @param[in] first The index of the first sample in the batch.
+ * @param[in] size The number of samples in the batch.
+ */
+template <typename eT>
+inline const arma::Mat<eT> CachedDataset<eT>::Batch(const int first,
+    const int size) const
+{
+  return arma::Mat<eT>(const_cast<eT *>(images_.colptr(first)),
+      images_.n_rows, size, false, true);
+}
+
+/**
+ * @brief Returns the number of samples in the data set.
+ */
+template <typename eT>
+inline int CachedDataset<eT>::Size() const
+{
+  return header_.num_items;
+}
+
+/**
+ * @brief Returns the factor by which the raw pixel values were multiplied.
+ */
+template <typename eT>
+inline double CachedDataset<eT>::Scale() const
+{
+  return header_.scale;
+}
+
+} // namespace mnist
+
+#endif // DATASET_CACHE_HPP_
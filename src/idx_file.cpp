@@ -0,0 +1,204 @@
+/**
+ * @file
+ * @brief Implementation of reading IDX files into memory, gzip-compressed or
+ *        not.
+ * @author Arno Bastenhof
+ */
+
+#include "idx_file.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "thread_pool.hpp"
+
+using std::min;
+using std::runtime_error;
+using std::size_t;
+using std::vector;
+
+// Minimum size of a gzip member: a 10-byte header and an 8-byte trailer
+static const size_t kMinMemberSz = 18;
+
+// Largest number of bytes passed to zlib at once, which counts them in 32 bits
+static const size_t kMaxChunkSz = std::numeric_limits<uInt>::max();
+
+// Reads a little-endian integer of a given number of bytes
+static inline size_t ReadLittleEndian(const uint8_t * bytes, const int n)
+{
+  size_t val = 0;
+  for (int i = n - 1; i >= 0; --i) {
+    val = val << 8 | bytes[i];
+  }
+  return val;
+}
+
+namespace {
+
+// A zlib stream decoding gzip members, ended on destruction
+struct Inflater {
+  Inflater()
+    : zs()
+  {
+    // Maximum window size, expecting a gzip header and trailer
+    if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+      throw runtime_error{"Could not initialize zlib."};
+    }
+  }
+  ~Inflater() { inflateEnd(&zs); }
+  z_stream zs;
+};
+
+} // namespace
+
+// Returns the sizes of the members of a gzip file if each records its size in
+// its header (i.e., in the BC subfield used by BGZF), or nothing otherwise
+static vector<size_t> BgzfMembers(const uint8_t * data, const size_t size)
+{
+  vector<size_t> members;
+  for (size_t pos = 0; pos != size; pos += members.back()) {
+    const uint8_t * header = data + pos;
+    if (size - pos < kMinMemberSz + 2 || !mnist::IsGzip(header, size - pos)
+        || (header[3] & 0x04) == 0) {           // FEXTRA flag
+      return {};
+    }
+    const size_t end = 12 + ReadLittleEndian(header + 10, 2);
+    if (end > size - pos) {
+      return {};
+    }
+    size_t member_size = 0;
+    for (size_t i = 12; i + 4 <= end; i += 4 + ReadLittleEndian(header + i + 2,
+          2)) {
+      if (header[i] == 'B' && header[i + 1] == 'C'
+          && ReadLittleEndian(header + i + 2, 2) == 2 && i + 6 <= end) {
+        member_size = ReadLittleEndian(header + i + 4, 2) + 1;
+      }
+    }
+    if (member_size < end + 8 || member_size > size - pos) {
+      return {};
+    }
+    members.push_back(member_size);
+  }
+  return members;
+}
+
+// Decompresses a single gzip member into a buffer of exactly its uncompressed
+// size, verifying its checksum
+static void InflateMember(const uint8_t * in, const size_t in_size,
+    uint8_t * out, const size_t out_size)
+{
+  Inflater inflater;
+  z_stream& zs = inflater.zs;
+  zs.next_in = const_cast<Bytef *>(in);
+  zs.avail_in = in_size;
+  zs.next_out = out;
+  zs.avail_out = out_size;
+  if (inflate(&zs, Z_FINISH) != Z_STREAM_END || zs.avail_out != 0) {
+    throw runtime_error{"Corrupt gzip member."};
+  }
+}
+
+// Decompresses BGZF members in parallel, each directly into its place in the
+// output, as determined by the uncompressed sizes in their trailers
+static void InflateParallel(const uint8_t * data,
+    const vector<size_t>& members, vector<uint8_t>& out)
+{
+  vector<size_t> in_offsets(members.size() + 1, 0);
+  vector<size_t> out_offsets(members.size() + 1, 0);
+  for (size_t i = 0; i != members.size(); ++i) {
+    in_offsets[i + 1] = in_offsets[i] + members[i];
+    out_offsets[i + 1] = out_offsets[i]
+        + ReadLittleEndian(data + in_offsets[i + 1] - 4, 4);
+  }
+  out.resize(out_offsets.back());
+
+  const int threads = std::max(1u, std::thread::hardware_concurrency());
+  mnist::ThreadPool pool{min<int>(threads, members.size())};
+  pool.Run([&](const int t){
+    for (size_t i = t; i < members.size(); i += pool.Size()) {
+      InflateMember(data + in_offsets[i], members[i],
+          out.data() + out_offsets[i], out_offsets[i + 1] - out_offsets[i]);
+    }
+  });
+}
+
+// Decompresses the members of a gzip file one after the other, growing the
+// output as needed
+static void InflateSequential(const uint8_t * data, const size_t size,
+    vector<uint8_t>& out)
+{
+  // The trailer of the last member holds its uncompressed size modulo 2^32,
+  // which is that of the whole file for most files
+  out.resize(std::max<size_t>(ReadLittleEndian(data + size - 4, 4), 1));
+
+  Inflater inflater;
+  z_stream& zs = inflater.zs;
+  size_t in_pos = 0;
+  size_t out_pos = 0;
+  for (;;) {
+    if (out_pos == out.size()) {
+      out.resize(2 * out.size());
+    }
+    zs.next_in = const_cast<Bytef *>(data + in_pos);
+    zs.avail_in = min(size - in_pos, kMaxChunkSz);
+    zs.next_out = out.data() + out_pos;
+    zs.avail_out = min(out.size() - out_pos, kMaxChunkSz);
+    const size_t avail_in = zs.avail_in;
+    const size_t avail_out = zs.avail_out;
+    const int ret = inflate(&zs, Z_NO_FLUSH);
+    in_pos += avail_in - zs.avail_in;
+    out_pos += avail_out - zs.avail_out;
+    if (ret == Z_STREAM_END) {
+      // Continue with the next member, if any
+      if (in_pos == size) {
+        break;
+      }
+      inflateReset(&zs);
+    } else if (ret != Z_OK && (ret != Z_BUF_ERROR || out_pos != out.size())) {
+      throw runtime_error{"Corrupt or truncated gzip file."};
+    }
+  }
+  out.resize(out_pos);
+}
+
+namespace mnist {
+
+/**
+ * @brief Constructor that maps a file into memory, decompressing it if needed.
+ * @param[in] filename The full path of the file.
+ */
+IdxFile::IdxFile(const char * filename)
+  : file_{filename}
+  , compressed_(IsGzip(file_.Data(), file_.Size()))
+{
+  if (!compressed_) {
+    return;
+  }
+  if (file_.Size() < kMinMemberSz) {
+    throw runtime_error{std::string("Truncated gzip file: ") + filename};
+  }
+  const vector<size_t> members = BgzfMembers(file_.Data(), file_.Size());
+  if (members.size() > 1) {
+    InflateParallel(file_.Data(), members, inflated_);
+  } else {
+    InflateSequential(file_.Data(), file_.Size(), inflated_);
+  }
+}
+
+/**
+ * @brief Returns whether a buffer starts with the magic number of gzip, using
+ *        the deflate method.
+ * @param[in] data The buffer.
+ * @param[in] size The size of the buffer in bytes.
+ */
+bool IsGzip(const uint8_t * data, const std::size_t size)
+{
+  return size >= 3 && data[0] == 0x1f && data[1] == 0x8b && data[2] == 8;
+}
+
+} // namespace mnist
@@ -0,0 +1,61 @@
+/**
+ * @file
+ * @brief Interface for reading IDX files into memory, gzip-compressed or not.
+ * @author Arno Bastenhof
+ */
+
+#ifndef IDX_FILE_HPP_
+#define IDX_FILE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mapped_file.hpp"
+
+namespace mnist {
+
+/**
+ * @brief The contents of a file, either mapped into memory directly or, if it
+ *        is gzip-compressed, decompressed into memory.
+ *
+ * Compressed files are recognized by their magic number rather than their
+ * name. Their members are decompressed in parallel if their boundaries are
+ * recorded in their headers, as is done by bgzip (BGZF), and sequentially
+ * otherwise.
+ */
+class IdxFile {
+public:
+  explicit              IdxFile(const char *);
+                        IdxFile(const IdxFile&) = delete;
+                        IdxFile(IdxFile&&) = delete;
+  IdxFile&              operator=(const IdxFile&) = delete;
+  const uint8_t *       Data() const;
+  std::size_t           Size() const;
+private:
+  MappedFile            file_;
+  std::vector<uint8_t>  inflated_;      // contents, if file_ is compressed
+  const bool            compressed_;
+};
+
+/**
+ * @brief Returns a pointer to the first byte of the (decompressed) contents.
+ */
+inline const uint8_t * IdxFile::Data() const
+{
+  return compressed_ ? inflated_.data() : file_.Data();
+}
+
+/**
+ * @brief Returns the size of the (decompressed) contents in bytes.
+ */
+inline std::size_t IdxFile::Size() const
+{
+  return compressed_ ? inflated_.size() : file_.Size();
+}
+
+bool                    IsGzip(const uint8_t *, const std::size_t);
+
+} // namespace mnist
+
+#endif // IDX_FILE_HPP_
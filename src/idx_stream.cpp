@@ -0,0 +1,139 @@
+/**
+ * @file
+ * @brief Implementation of streaming MNIST data sets from disk in shuffled
+ *        order.
+ * @author Arno Bastenhof
+ */
+
+#include "idx_stream.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using std::runtime_error;
+
+namespace mnist {
+
+/**
+ * @brief Constructor that opens an image- and a label file and validates their
+ *        headers.
+ *
+ * Reading only starts after the first call to Rewind.
+ *
+ * @param[in] img_filename The full path of the image file.
+ * @param[in] lab_filename The full path of the label file.
+ * @param[in] capacity The number of samples held by the shuffle buffer, which
+ *            is raised to at least a single chunk.
+ */
+IdxStream::IdxStream(const char * img_filename, const char * lab_filename,
+    const int capacity)
+  : img_file_{img_filename}
+  , lab_file_{lab_filename}
+  , num_items_(NumItems(img_file_, lab_file_))
+  , capacity_(std::max<int>(capacity, kChunkSz))
+  , unread_(0)
+  , buffered_(0)
+  , images_(static_cast<std::size_t>(capacity_) * kImageSize)
+  , labels_(capacity_)
+{
+}
+
+/**
+ * @brief Starts a new pass over the files.
+ *
+ * The order in which the samples are drawn only depends on the seed and the
+ * number of the pass.
+ *
+ * @param[in] seed The seed from which the order of each pass is derived.
+ * @param[in] pass The number of the pass, starting from 0.
+ */
+void IdxStream::Rewind(const uint64_t seed, const unsigned long pass)
+{
+  std::seed_seq seq{static_cast<uint32_t>(seed),
+                    static_cast<uint32_t>(seed >> 32),
+                    static_cast<uint32_t>(pass),
+                    static_cast<uint32_t>(pass >> 16 >> 16)};
+  rng_.seed(seq);
+  img_file_.Seek(kHeaderSizeImageFile);
+  lab_file_.Seek(kHeaderSizeLabelFile);
+  unread_ = num_items_;
+  buffered_ = 0;
+}
+
+/**
+ * @brief Draws the next samples of the current pass.
+ * @param[in] n The number of samples to draw.
+ * @param[out] img The images, stored one after the other.
+ * @param[out] lab The labels.
+ */
+void IdxStream::Read(const int n, uint8_t * img, uint8_t * lab)
+{
+  for (int i = 0; i != n; ++i) {
+    Fill();
+    if (buffered_ == 0) {
+      throw runtime_error{"No samples left in this pass."};
+    }
+
+    // Draw a sample at random, moving the last one into its slot
+    const int slot = rng_() % buffered_;
+    const int last = --buffered_;
+    uint8_t * const slot_img = &images_[std::size_t{kImageSize} * slot];
+    std::memcpy(img + std::size_t{kImageSize} * i, slot_img, kImageSize);
+    lab[i] = labels_[slot];
+    if (slot != last) {
+      std::memcpy(slot_img, &images_[std::size_t{kImageSize} * last],
+          kImageSize);
+      labels_[slot] = labels_[last];
+    }
+  }
+}
+
+// Validates the headers and sizes of the files and returns the number of items
+// they contain. The sizes of compressed files are not known in advance, and
+// are only checked while reading.
+int IdxStream::NumItems(SequentialFile& img_file, SequentialFile& lab_file)
+{
+  uint8_t header[kHeaderSizeImageFile];
+  if (!img_file.Compressed() && img_file.Size() < kHeaderSizeImageFile) {
+    throw runtime_error{"Could not read image file header."};
+  }
+  img_file.Read(header, kHeaderSizeImageFile);
+  const int num_items = ValidateImageHeader(header);
+  if (!lab_file.Compressed() && lab_file.Size() < kHeaderSizeLabelFile) {
+    throw runtime_error{"Could not read label file header."};
+  }
+  lab_file.Read(header, kHeaderSizeLabelFile);
+  if (ValidateLabelHeader(header) != num_items) {
+    throw runtime_error{"Numbers of images and labels differ."};
+  }
+  if (!img_file.Compressed() && img_file.Size() - kHeaderSizeImageFile
+      < static_cast<std::size_t>(num_items) * kImageSize) {
+    throw runtime_error{"Could not read images."};
+  }
+  if (!lab_file.Compressed() && lab_file.Size() - kHeaderSizeLabelFile
+      < static_cast<std::size_t>(num_items)) {
+    throw runtime_error{"Could not read labels."};
+  }
+  return num_items;
+}
+
+// Reads the next samples from the files into the free slots at the end of the
+// shuffle buffer, once there is room for at least a whole chunk (or for all
+// remaining samples)
+void IdxStream::Fill()
+{
+  const int free = capacity_ - buffered_;
+  if (unread_ == 0 || free < std::min<int>(kChunkSz, unread_)) {
+    return;
+  }
+  const int n = std::min(free, unread_);
+  img_file_.Read(&images_[static_cast<std::size_t>(buffered_) * kImageSize],
+      static_cast<std::size_t>(n) * kImageSize);
+  lab_file_.Read(&labels_[buffered_], n);
+  ValidateLabels(&labels_[buffered_], n);
+  buffered_ += n;
+  unread_ -= n;
+}
+
+} // namespace mnist
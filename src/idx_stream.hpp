@@ -0,0 +1,64 @@
+/**
+ * @file
+ * @brief Interface for streaming MNIST data sets from disk in shuffled order.
+ * @author Arno Bastenhof
+ */
+
+#ifndef IDX_STREAM_HPP_
+#define IDX_STREAM_HPP_
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "mnist_parser.hpp"
+#include "sequential_file.hpp"
+
+namespace mnist {
+
+/**
+ * @brief An MNIST image- and label file pair, read sequentially in passes
+ *        through a bounded shuffle buffer.
+ *
+ * Samples are read from the files in large chunks into the free slots of the
+ * buffer, and drawn from it at random. The order is thus only shuffled locally
+ * (within a window the size of the buffer), but memory use does not depend on
+ * the size of the files.
+ */
+class IdxStream : public MnistFormat {
+public:
+                        IdxStream(const char *, const char *, const int);
+                        IdxStream(const IdxStream&) = delete;
+                        IdxStream(IdxStream&&) = delete;
+  IdxStream&            operator=(const IdxStream&) = delete;
+  int                   Size() const;
+  void                  Rewind(const uint64_t, const unsigned long);
+  void                  Read(const int, uint8_t *, uint8_t *);
+private:
+  enum {
+    kChunkSz = 1024                     // min. samples read at once
+  };
+  SequentialFile        img_file_;
+  SequentialFile        lab_file_;
+  const int             num_items_;
+  const int             capacity_;      // of the shuffle buffer, in samples
+  int                   unread_;        // samples not yet read in this pass
+  int                   buffered_;      // samples in the shuffle buffer
+  std::vector<uint8_t>  images_;        // shuffle buffer, one image per slot
+  std::vector<uint8_t>  labels_;
+  std::mt19937_64       rng_;
+  static int            NumItems(SequentialFile&, SequentialFile&);
+  void                  Fill();
+};
+
+/**
+ * @brief Returns the number of samples read per pass.
+ */
+inline int IdxStream::Size() const
+{
+  return num_items_;
+}
+
+} // namespace mnist
+
+#endif // IDX_STREAM_HPP_
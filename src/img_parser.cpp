@@ -28,13 +28,9 @@ ImageParser::ImageParser(const char * filename)
     throw runtime_error{"Could not read image file header."};
   }
 
-  // Validate magic number
-  if (ReadBigEndianInt32(buffer_) != kMagicNumberImageFile) {
-    throw runtime_error{"Unexpected magic number for image file."};
-  }
-
-  // Read numbers of images and of rows and columns per image
-  num_items_ = ReadBigEndianInt32(buffer_ + 4);
+  // Validate header and read numbers of images and of rows and columns per
+  // image
+  num_items_ = ValidateImageHeader(buffer_);
   num_row_   = ReadBigEndianInt32(buffer_ + 8);
   num_col_   = ReadBigEndianInt32(buffer_ + 12);
 }
@@ -55,7 +51,7 @@ Mat<uint8_t> ImageParser::Parse()
     throw runtime_error{"Image file already parsed."};
   }
   Mat<uint8_t> mat(num_items_, kImageSize);
-  for (int i = 0; --num_items_ != 0; ++i) {
+  for (int i = 0; num_items_ != 0; ++i, --num_items_) {
     // read a single image into an input buffer ...
     if (!file_.read(reinterpret_cast<char *>(buffer_), kImageSize)) {
       throw runtime_error{"Could not read image."};
@@ -0,0 +1,401 @@
+/**
+ * @file
+ * @brief Portable implementations of the kernels and selection of the
+ *        implementation best suited to the host at runtime.
+ * @author Arno Bastenhof
+ */
+
+#include "kernels.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "kernels_impl.hpp"
+
+namespace {
+
+// Plain scalar code, treated as vectors of a single lane
+template <typename T>
+struct Scalar {
+  typedef T         Elem;
+  typedef T         Vec;
+  typedef bool      Mask;
+  enum { kWidth = 1, kSamples = 2 };
+  static Mask       MakeMask(const int lanes) { return lanes > 0; }
+  static Vec        Load(const T * p) { return *p; }
+  static Vec        MaskLoad(const T * p, const Mask m) { return m ? *p : 0; }
+  static void       MaskStore(T * p, const Mask m, const Vec v)
+                    { if (m) *p = v; }
+  static void       Store(T * p, const Vec v) { *p = v; }
+  static Vec        Broadcast(const T x) { return x; }
+  static Vec        Add(const Vec a, const Vec b) { return a + b; }
+  static Vec        Sub(const Vec a, const Vec b) { return a - b; }
+  static Vec        Mul(const Vec a, const Vec b) { return a * b; }
+  static Vec        Div(const Vec a, const Vec b) { return a / b; }
+  static Vec        Sqrt(const Vec a) { return std::sqrt(a); }
+  static Vec        Min(const Vec a, const Vec b) { return a < b ? a : b; }
+  static Vec        Max(const Vec a, const Vec b) { return a > b ? a : b; }
+  static Vec        Fma(const Vec a, const Vec b, const Vec c)
+                    { return a * b + c; }
+  static Vec        Round(const Vec a) { return std::nearbyint(a); }
+  static Vec        Floor(const Vec a) { return std::floor(a); }
+  static Vec        Ldexp(const Vec a, const Vec k)
+                    { return std::ldexp(a, static_cast<int>(k)); }
+  static Vec        Lookup(const T * table, const Vec i)
+                    { return table[static_cast<int>(i)]; }
+};
+
+// Plain scalar code for the integer kernel, one byte at a time
+struct ScalarInt8 {
+  typedef int32_t   Vec;
+  enum { kBytes = 1, kSamples = 2 };
+  static Vec        Zero() { return 0; }
+  static Vec        LoadInputs(const uint8_t * p) { return *p; }
+  static Vec        LoadWeights(const int8_t * p) { return *p; }
+  static Vec        DotAdd(const Vec acc, const Vec x, const Vec w)
+                    { return acc + x * w; }
+  static int32_t    Sum(const Vec acc) { return acc; }
+};
+
+} // namespace
+
+namespace mnist {
+
+extern const KernelTable kScalarKernels = {
+  "scalar",
+  MakeKernelFunctions<Scalar<double>>(),
+  MakeKernelFunctions<Scalar<float>>()
+};
+
+extern const QuantizedKernelTable kScalarQuantizedKernels = {
+  "scalar",
+  &QuantizedDenseImpl<ScalarInt8>
+};
+
+/**
+ * @brief Constructor, sampling the sigmoid over [-kRange, kRange].
+ */
+SigmoidTable::SigmoidTable()
+{
+  for (int i = 0; i != kSize; ++i) {
+    const double x = static_cast<double>(i) / kSteps - kRange;
+    values[i] = 1.0 / (1.0 + std::exp(-x));
+    float_values[i] = static_cast<float>(values[i]);
+  }
+}
+
+extern const SigmoidTable kSigmoidValues{};
+
+// Selects the kernels for the most capable instruction set supported by the
+// host, unless overridden through the MNIST_KERNELS environment variable
+static const KernelTable& SelectKernels()
+{
+  const bool avx512 = __builtin_cpu_supports("avx512f");
+  const bool avx2 = __builtin_cpu_supports("avx2")
+                 && __builtin_cpu_supports("fma");
+
+  const char * isa = std::getenv("MNIST_KERNELS");
+  if (isa != nullptr) {
+    if (std::strcmp(isa, kScalarKernels.isa) == 0) {
+      return kScalarKernels;
+    }
+    if (std::strcmp(isa, kAvx2Kernels.isa) == 0 && avx2) {
+      return kAvx2Kernels;
+    }
+    if (std::strcmp(isa, kAvx512Kernels.isa) == 0 && avx512) {
+      return kAvx512Kernels;
+    }
+  }
+  return avx512 ? kAvx512Kernels : avx2 ? kAvx2Kernels : kScalarKernels;
+}
+
+// The kernels in use, selected once
+static inline const KernelTable& Kernels()
+{
+  static const KernelTable& kernels = SelectKernels();
+  return kernels;
+}
+
+// Selects the integer kernel for the most capable instruction set supported by
+// the host, unless overridden as in SelectKernels, where "avx512" requires
+// support for VNNI
+static const QuantizedKernelTable& SelectQuantizedKernels()
+{
+  const bool vnni = __builtin_cpu_supports("avx512vnni")
+                 && __builtin_cpu_supports("avx512bw");
+  const bool avx2 = __builtin_cpu_supports("avx2");
+
+  const char * isa = std::getenv("MNIST_KERNELS");
+  if (isa != nullptr) {
+    if (std::strcmp(isa, kScalarKernels.isa) == 0) {
+      return kScalarQuantizedKernels;
+    }
+    if (std::strcmp(isa, kAvx2Kernels.isa) == 0 && avx2) {
+      return kAvx2QuantizedKernels;
+    }
+    if (std::strcmp(isa, kAvx512Kernels.isa) == 0 && vnni) {
+      return kVnniQuantizedKernels;
+    }
+  }
+  return vnni ? kVnniQuantizedKernels
+       : avx2 ? kAvx2QuantizedKernels : kScalarQuantizedKernels;
+}
+
+// The integer kernel in use, selected once
+static inline const QuantizedKernelTable& QuantizedKernels()
+{
+  static const QuantizedKernelTable& kernels = SelectQuantizedKernels();
+  return kernels;
+}
+
+/**
+ * @brief Computes the activations of a layer with sigmoid activations.
+ *
+ * Computes out = Sigmoid(W * in + b) in a single pass over a batch, keeping
+ * the weighted sums in registers until the biases have been added.
+ *
+ * @param[in] weights The weights, stored column-major as a rows x (cols + 1)
+ *            matrix with the biases in the first column.
+ * @param[in] rows The number of outputs.
+ * @param[in] cols The number of inputs.
+ * @param[in] in The inputs, stored column-major as a cols x n matrix.
+ * @param[in] n The number of samples.
+ * @param[out] out The activations, stored column-major as a rows x n matrix.
+ * @param[in] mode How to compute the sigmoid.
+ */
+void DenseSigmoid(const double * weights, const int rows, const int cols,
+    const double * in, const int n, double * out, const SigmoidMode mode)
+{
+  Kernels().f64.dense_sigmoid(weights, rows, cols, in, n, out, mode);
+}
+
+/**
+ * @brief Single-precision overload of DenseSigmoid.
+ */
+void DenseSigmoid(const float * weights, const int rows, const int cols,
+    const float * in, const int n, float * out, const SigmoidMode mode)
+{
+  Kernels().f32.dense_sigmoid(weights, rows, cols, in, n, out, mode);
+}
+
+/**
+ * @brief Computes the activations of a layer with sigmoid activations for
+ *        sparse inputs.
+ *
+ * Computes out = Sigmoid(W * in + b) as DenseSigmoid, visiting only the
+ * non-zero inputs, for selected columns of a sparse matrix.
+ *
+ * @param[in] weights The weights, stored as for DenseSigmoid.
+ * @param[in] rows The number of outputs.
+ * @param[in] in The inputs, one per column.
+ * @param[in] samples The indices of the n columns of in to propagate.
+ * @param[in] n The number of samples.
+ * @param[out] out The activations, stored column-major as a rows x n matrix.
+ * @param[in] mode How to compute the sigmoid.
+ */
+void SparseDenseSigmoid(const double * weights, const int rows,
+    const SparseColumns<double>& in, const uint32_t * samples, const int n,
+    double * out, const SigmoidMode mode)
+{
+  Kernels().f64.sparse_dense_sigmoid(weights, rows, in, samples, n, out, mode);
+}
+
+/**
+ * @brief Single-precision overload of SparseDenseSigmoid.
+ */
+void SparseDenseSigmoid(const float * weights, const int rows,
+    const SparseColumns<float>& in, const uint32_t * samples, const int n,
+    float * out, const SigmoidMode mode)
+{
+  Kernels().f32.sparse_dense_sigmoid(weights, rows, in, samples, n, out, mode);
+}
+
+/**
+ * @brief Computes the product of a dense matrix with the transpose of selected
+ *        columns of a sparse matrix.
+ *
+ * Computes out = err * in^T, i.e. the gradients of the weights of a layer
+ * (excluding the biases) given its errors and sparse inputs, visiting only
+ * the non-zero inputs.
+ *
+ * @param[in] err The errors, stored column-major as a rows x n matrix.
+ * @param[in] rows The number of outputs.
+ * @param[in] cols The number of inputs.
+ * @param[in] in The inputs, one per column, each with cols rows.
+ * @param[in] samples The indices of the n columns of in to multiply with.
+ * @param[in] n The number of samples.
+ * @param[out] out The product, stored column-major as a rows x cols matrix.
+ */
+void SparseOuterProduct(const double * err, const int rows, const int cols,
+    const SparseColumns<double>& in, const uint32_t * samples, const int n,
+    double * out)
+{
+  Kernels().f64.sparse_outer_product(err, rows, cols, in, samples, n, out);
+}
+
+/**
+ * @brief Single-precision overload of SparseOuterProduct.
+ */
+void SparseOuterProduct(const float * err, const int rows, const int cols,
+    const SparseColumns<float>& in, const uint32_t * samples, const int n,
+    float * out)
+{
+  Kernels().f32.sparse_outer_product(err, rows, cols, in, samples, n, out);
+}
+
+/**
+ * @brief Computes the errors of an output layer with sigmoid activations.
+ *
+ * Combines the difference with the one-hot encoded labels and the derivative
+ * of the sigmoid in a single pass.
+ *
+ * @param[in] activ The activations, stored column-major as a rows x n matrix.
+ * @param[in] lab The labels, each less than rows.
+ * @param[in] rows The number of outputs.
+ * @param[in] n The number of samples.
+ * @param[out] err The errors, stored column-major as a rows x n matrix.
+ */
+void OutputError(const double * activ, const uint8_t * lab, const int rows,
+    const int n, double * err)
+{
+  Kernels().f64.output_error(activ, lab, rows, n, err);
+}
+
+/**
+ * @brief Single-precision overload of OutputError.
+ */
+void OutputError(const float * activ, const uint8_t * lab, const int rows,
+    const int n, float * err)
+{
+  Kernels().f32.output_error(activ, lab, rows, n, err);
+}
+
+/**
+ * @brief Applies the sigmoid function in place.
+ * @param[in,out] x The values to apply the sigmoid to.
+ * @param[in] n The number of values.
+ * @param[in] mode How to compute the sigmoid.
+ */
+void Sigmoid(double * x, const std::size_t n, const SigmoidMode mode)
+{
+  Kernels().f64.sigmoid(x, n, mode);
+}
+
+/**
+ * @brief Single-precision overload of Sigmoid.
+ */
+void Sigmoid(float * x, const std::size_t n, const SigmoidMode mode)
+{
+  Kernels().f32.sigmoid(x, n, mode);
+}
+
+/**
+ * @brief Sums the gradients computed by a number of threads and applies them
+ *        to a range of the weights.
+ *
+ * Computes g = scale * (sum of the gradients + reg * w) and updates the
+ * optimizer's moments, if any, and the weights from g in a single pass over
+ * memory. The gradients are summed in the order given.
+ *
+ * @param[in] grads The gradients of all weights, one array per thread.
+ * @param[in] num_grads The number of threads, at least 1.
+ * @param[in] begin The index of the first weight to update.
+ * @param[in] end The index past the last weight to update.
+ * @param[in] step The optimizer and its coefficients.
+ * @param[in,out] weights The weights.
+ * @param[in,out] first_moments The first moments kept by the optimizer, if
+ *                any, indexed as the weights.
+ * @param[in,out] second_moments The second moments kept by Adam, if used,
+ *                indexed as the weights.
+ */
+void ApplyGradients(const double * const * grads, const int num_grads,
+    const std::size_t begin, const std::size_t end, const OptimizerStep& step,
+    double * weights, double * first_moments, double * second_moments)
+{
+  Kernels().f64.apply_gradients(grads, num_grads, begin, end, step, weights,
+      first_moments, second_moments);
+}
+
+/**
+ * @brief Single-precision overload of ApplyGradients.
+ */
+void ApplyGradients(const float * const * grads, const int num_grads,
+    const std::size_t begin, const std::size_t end, const OptimizerStep& step,
+    float * weights, float * first_moments, float * second_moments)
+{
+  Kernels().f32.apply_gradients(grads, num_grads, begin, end, step, weights,
+      first_moments, second_moments);
+}
+
+/**
+ * @brief Samples an image at arbitrary points by bilinear interpolation.
+ *
+ * Points outside the image are sampled as zero, with the pixels fading out
+ * over the distance of a single pixel beyond its edges.
+ *
+ * @param[in] img The image, stored row-major and padded with zeros as a
+ *            (height + 3) x (width + 3) matrix, with the first pixel of the
+ *            image in row 1, column 1.
+ * @param[in] width The width of the image, excluding padding.
+ * @param[in] height The height of the image, excluding padding.
+ * @param[in] x The columns of the points, relative to the first pixel.
+ * @param[in] y The rows of the points, relative to the first pixel.
+ * @param[in] n The number of points.
+ * @param[out] out The sampled values.
+ */
+void BilinearSample(const double * img, const int width, const int height,
+    const double * x, const double * y, const int n, double * out)
+{
+  Kernels().f64.bilinear_sample(img, width, height, x, y, n, out);
+}
+
+/**
+ * @brief Single-precision overload of BilinearSample.
+ */
+void BilinearSample(const float * img, const int width, const int height,
+    const float * x, const float * y, const int n, float * out)
+{
+  Kernels().f32.bilinear_sample(img, width, height, x, y, n, out);
+}
+
+/**
+ * @brief Computes the products of int8 weights with uint8 inputs.
+ *
+ * Computes out = W * in exactly in 32-bit integers, using the integer dot
+ * product instructions of the host (VNNI or AVX2) where available.
+ *
+ * @param[in] weights The weights, stored row-major as a rows x stride matrix.
+ *            Their magnitudes may not exceed kMaxQuantizedWeight, the stride
+ *            must be a multiple of kQuantizedPadding, and weights past the
+ *            first cols of each row must be zero.
+ * @param[in] rows The number of outputs.
+ * @param[in] stride The distance between the rows of the weights.
+ * @param[in] in The inputs, stored column-major as a cols x n matrix.
+ * @param[in] cols The number of inputs.
+ * @param[in] n The number of samples.
+ * @param[out] out The results, stored column-major as a rows x n matrix.
+ */
+void QuantizedDense(const int8_t * weights, const int rows, const int stride,
+    const uint8_t * in, const int cols, const int n, int32_t * out)
+{
+  QuantizedKernels().dense(weights, rows, stride, in, cols, n, out);
+}
+
+/**
+ * @brief Returns the name of the instruction set used by the kernels.
+ */
+const char * KernelIsa()
+{
+  return Kernels().isa;
+}
+
+/**
+ * @brief Returns the name of the instruction set used by QuantizedDense.
+ */
+const char * QuantizedKernelIsa()
+{
+  return QuantizedKernels().isa;
+}
+
+} // namespace mnist
@@ -0,0 +1,76 @@
+/**
+ * @file
+ * @brief Interface for the hand-vectorized kernels used by the neural network.
+ * @author Arno Bastenhof
+ */
+
+#ifndef KERNELS_HPP_
+#define KERNELS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "activation.hpp"
+#include "optimizer.hpp"
+
+namespace mnist {
+
+/** @brief Constraints on the weights passed to QuantizedDense. */
+enum {
+  kQuantizedPadding = 64,  /**< @brief Rows are padded to multiples of this. */
+  kMaxQuantizedWeight = 63 /**< @brief Pairs of products fit in 16 bits. */
+};
+
+/**
+ * @brief A read-only view of the columns of a sparse matrix with elements of
+ *        type T, in compressed sparse column form.
+ *
+ * The non-zeros of column j are at positions offsets[j] up to offsets[j + 1]
+ * of indices (their rows, ascending) and values.
+ */
+template <typename T>
+struct SparseColumns {
+  const uint64_t *  offsets;
+  const uint32_t *  indices;
+  const T *         values;
+};
+
+void                DenseSigmoid(const double *, const int, const int,
+                        const double *, const int, double *,
+                        const SigmoidMode);
+void                DenseSigmoid(const float *, const int, const int,
+                        const float *, const int, float *, const SigmoidMode);
+void                SparseDenseSigmoid(const double *, const int,
+                        const SparseColumns<double>&, const uint32_t *,
+                        const int, double *, const SigmoidMode);
+void                SparseDenseSigmoid(const float *, const int,
+                        const SparseColumns<float>&, const uint32_t *,
+                        const int, float *, const SigmoidMode);
+void                SparseOuterProduct(const double *, const int, const int,
+                        const SparseColumns<double>&, const uint32_t *,
+                        const int, double *);
+void                SparseOuterProduct(const float *, const int, const int,
+                        const SparseColumns<float>&, const uint32_t *,
+                        const int, float *);
+void                OutputError(const double *, const uint8_t *, const int,
+                        const int, double *);
+void                OutputError(const float *, const uint8_t *, const int,
+                        const int, float *);
+void                ApplyGradients(const double * const *, const int,
+                        const std::size_t, const std::size_t,
+                        const OptimizerStep&, double *, double *, double *);
+void                ApplyGradients(const float * const *, const int,
+                        const std::size_t, const std::size_t,
+                        const OptimizerStep&, float *, float *, float *);
+void                BilinearSample(const double *, const int, const int,
+                        const double *, const double *, const int, double *);
+void                BilinearSample(const float *, const int, const int,
+                        const float *, const float *, const int, float *);
+void                QuantizedDense(const int8_t *, const int, const int,
+                        const uint8_t *, const int, const int, int32_t *);
+const char *        KernelIsa();
+const char *        QuantizedKernelIsa();
+
+} // namespace mnist
+
+#endif // KERNELS_HPP_
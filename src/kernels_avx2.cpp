@@ -0,0 +1,153 @@
+/**
+ * @file
+ * @brief Implementations of the kernels for AVX2 with FMA.
+ *
+ * This file is compiled with -mavx2 -mfma, and its kernels are only called on
+ * hosts supporting both.
+ *
+ * @author Arno Bastenhof
+ */
+
+#include <immintrin.h>
+
+#include "kernels_impl.hpp"
+
+namespace {
+
+template <typename T> struct Avx2;
+
+template <>
+struct Avx2<double> {
+  typedef double    Elem;
+  typedef __m256d   Vec;
+  typedef __m256i   Mask;
+  enum { kWidth = 4, kSamples = 2 };
+  static Mask       MakeMask(const int lanes)
+                    { return _mm256_cmpgt_epi64(_mm256_set1_epi64x(lanes),
+                        _mm256_setr_epi64x(0, 1, 2, 3)); }
+  static Vec        Load(const double * p) { return _mm256_loadu_pd(p); }
+  static Vec        MaskLoad(const double * p, const Mask m)
+                    { return _mm256_maskload_pd(p, m); }
+  static void       MaskStore(double * p, const Mask m, const Vec v)
+                    { _mm256_maskstore_pd(p, m, v); }
+  static void       Store(double * p, const Vec v) { _mm256_storeu_pd(p, v); }
+  static Vec        Broadcast(const double x) { return _mm256_set1_pd(x); }
+  static Vec        Add(const Vec a, const Vec b)
+                    { return _mm256_add_pd(a, b); }
+  static Vec        Sub(const Vec a, const Vec b)
+                    { return _mm256_sub_pd(a, b); }
+  static Vec        Mul(const Vec a, const Vec b)
+                    { return _mm256_mul_pd(a, b); }
+  static Vec        Div(const Vec a, const Vec b)
+                    { return _mm256_div_pd(a, b); }
+  static Vec        Sqrt(const Vec a) { return _mm256_sqrt_pd(a); }
+  static Vec        Min(const Vec a, const Vec b)
+                    { return _mm256_min_pd(a, b); }
+  static Vec        Max(const Vec a, const Vec b)
+                    { return _mm256_max_pd(a, b); }
+  static Vec        Fma(const Vec a, const Vec b, const Vec c)
+                    { return _mm256_fmadd_pd(a, b, c); }
+  static Vec        Round(const Vec a)
+                    { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT
+                        | _MM_FROUND_NO_EXC); }
+  static Vec        Floor(const Vec a) { return _mm256_floor_pd(a); }
+  // a * 2^k for integral k within the range of normal exponents
+  static Vec        Ldexp(const Vec a, const Vec k)
+                    { return _mm256_mul_pd(a, _mm256_castsi256_pd(
+                        _mm256_slli_epi64(_mm256_add_epi64(
+                        _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(k)),
+                        _mm256_set1_epi64x(1023)), 52))); }
+  // table[i] for integral, non-negative i
+  static Vec        Lookup(const double * table, const Vec i)
+                    { return _mm256_mask_i32gather_pd(_mm256_setzero_pd(),
+                        table, _mm256_cvtpd_epi32(i),
+                        _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8); }
+};
+
+template <>
+struct Avx2<float> {
+  typedef float     Elem;
+  typedef __m256    Vec;
+  typedef __m256i   Mask;
+  enum { kWidth = 8, kSamples = 2 };
+  static Mask       MakeMask(const int lanes)
+                    { return _mm256_cmpgt_epi32(_mm256_set1_epi32(lanes),
+                        _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)); }
+  static Vec        Load(const float * p) { return _mm256_loadu_ps(p); }
+  static Vec        MaskLoad(const float * p, const Mask m)
+                    { return _mm256_maskload_ps(p, m); }
+  static void       MaskStore(float * p, const Mask m, const Vec v)
+                    { _mm256_maskstore_ps(p, m, v); }
+  static void       Store(float * p, const Vec v) { _mm256_storeu_ps(p, v); }
+  static Vec        Broadcast(const float x) { return _mm256_set1_ps(x); }
+  static Vec        Add(const Vec a, const Vec b)
+                    { return _mm256_add_ps(a, b); }
+  static Vec        Sub(const Vec a, const Vec b)
+                    { return _mm256_sub_ps(a, b); }
+  static Vec        Mul(const Vec a, const Vec b)
+                    { return _mm256_mul_ps(a, b); }
+  static Vec        Div(const Vec a, const Vec b)
+                    { return _mm256_div_ps(a, b); }
+  static Vec        Sqrt(const Vec a) { return _mm256_sqrt_ps(a); }
+  static Vec        Min(const Vec a, const Vec b)
+                    { return _mm256_min_ps(a, b); }
+  static Vec        Max(const Vec a, const Vec b)
+                    { return _mm256_max_ps(a, b); }
+  static Vec        Fma(const Vec a, const Vec b, const Vec c)
+                    { return _mm256_fmadd_ps(a, b, c); }
+  static Vec        Round(const Vec a)
+                    { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT
+                        | _MM_FROUND_NO_EXC); }
+  static Vec        Floor(const Vec a) { return _mm256_floor_ps(a); }
+  // a * 2^k for integral k within the range of normal exponents
+  static Vec        Ldexp(const Vec a, const Vec k)
+                    { return _mm256_mul_ps(a, _mm256_castsi256_ps(
+                        _mm256_slli_epi32(_mm256_add_epi32(
+                        _mm256_cvtps_epi32(k), _mm256_set1_epi32(127)),
+                        23))); }
+  // table[i] for integral, non-negative i
+  static Vec        Lookup(const float * table, const Vec i)
+                    { return _mm256_mask_i32gather_ps(_mm256_setzero_ps(),
+                        table, _mm256_cvtps_epi32(i),
+                        _mm256_castsi256_ps(_mm256_set1_epi32(-1)), 4); }
+};
+
+// Products of uint8 inputs and int8 weights are summed pairwise into 16 bits
+// (which cannot saturate for weights up to kMaxQuantizedWeight), then into 32
+struct Avx2Int8 {
+  typedef __m256i   Vec;
+  enum { kBytes = 32, kSamples = 2 };
+  static Vec        Zero() { return _mm256_setzero_si256(); }
+  static Vec        LoadInputs(const uint8_t * p)
+                    { return _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i *>(p)); }
+  static Vec        LoadWeights(const int8_t * p)
+                    { return _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i *>(p)); }
+  static Vec        DotAdd(const Vec acc, const Vec x, const Vec w)
+                    { return _mm256_add_epi32(acc, _mm256_madd_epi16(
+                        _mm256_maddubs_epi16(x, w), _mm256_set1_epi16(1))); }
+  static int32_t    Sum(const Vec v)
+                    { __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v),
+                        _mm256_extracti128_si256(v, 1));
+                      s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+                      s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+                      return _mm_cvtsi128_si32(s); }
+};
+
+} // namespace
+
+namespace mnist {
+
+extern const KernelTable kAvx2Kernels = {
+  "avx2",
+  MakeKernelFunctions<Avx2<double>>(),
+  MakeKernelFunctions<Avx2<float>>()
+};
+
+extern const QuantizedKernelTable kAvx2QuantizedKernels = {
+  "avx2",
+  &QuantizedDenseImpl<Avx2Int8>
+};
+
+} // namespace mnist
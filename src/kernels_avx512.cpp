@@ -0,0 +1,124 @@
+/**
+ * @file
+ * @brief Implementations of the kernels for AVX-512.
+ *
+ * This file is compiled with -mavx512f, and its kernels are only called on
+ * hosts supporting it.
+ *
+ * @author Arno Bastenhof
+ */
+
+// Older versions of GCC wrongly warn about the undefined vectors passed to
+// masked builtins by the AVX-512 intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+
+#include "kernels_impl.hpp"
+
+namespace {
+
+template <typename T> struct Avx512;
+
+template <>
+struct Avx512<double> {
+  typedef double    Elem;
+  typedef __m512d   Vec;
+  typedef __mmask8  Mask;
+  enum { kWidth = 8, kSamples = 4 };
+  static Mask       MakeMask(const int lanes)
+                    { return static_cast<Mask>((1u << lanes) - 1); }
+  static Vec        Load(const double * p) { return _mm512_loadu_pd(p); }
+  static Vec        MaskLoad(const double * p, const Mask m)
+                    { return _mm512_maskz_loadu_pd(m, p); }
+  static void       MaskStore(double * p, const Mask m, const Vec v)
+                    { _mm512_mask_storeu_pd(p, m, v); }
+  static void       Store(double * p, const Vec v) { _mm512_storeu_pd(p, v); }
+  static Vec        Broadcast(const double x) { return _mm512_set1_pd(x); }
+  static Vec        Add(const Vec a, const Vec b)
+                    { return _mm512_add_pd(a, b); }
+  static Vec        Sub(const Vec a, const Vec b)
+                    { return _mm512_sub_pd(a, b); }
+  static Vec        Mul(const Vec a, const Vec b)
+                    { return _mm512_mul_pd(a, b); }
+  static Vec        Div(const Vec a, const Vec b)
+                    { return _mm512_div_pd(a, b); }
+  static Vec        Sqrt(const Vec a) { return _mm512_sqrt_pd(a); }
+  static Vec        Min(const Vec a, const Vec b)
+                    { return _mm512_min_pd(a, b); }
+  static Vec        Max(const Vec a, const Vec b)
+                    { return _mm512_max_pd(a, b); }
+  static Vec        Fma(const Vec a, const Vec b, const Vec c)
+                    { return _mm512_fmadd_pd(a, b, c); }
+  static Vec        Round(const Vec a)
+                    { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT
+                        | _MM_FROUND_NO_EXC); }
+  static Vec        Floor(const Vec a)
+                    { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEG_INF
+                        | _MM_FROUND_NO_EXC); }
+  // a * 2^k for integral k
+  static Vec        Ldexp(const Vec a, const Vec k)
+                    { return _mm512_scalef_pd(a, k); }
+  // table[i] for integral, non-negative i
+  static Vec        Lookup(const double * table, const Vec i)
+                    { return _mm512_i32gather_pd(_mm512_cvtpd_epi32(i), table,
+                        8); }
+};
+
+template <>
+struct Avx512<float> {
+  typedef float     Elem;
+  typedef __m512    Vec;
+  typedef __mmask16 Mask;
+  enum { kWidth = 16, kSamples = 4 };
+  static Mask       MakeMask(const int lanes)
+                    { return static_cast<Mask>((1u << lanes) - 1); }
+  static Vec        Load(const float * p) { return _mm512_loadu_ps(p); }
+  static Vec        MaskLoad(const float * p, const Mask m)
+                    { return _mm512_maskz_loadu_ps(m, p); }
+  static void       MaskStore(float * p, const Mask m, const Vec v)
+                    { _mm512_mask_storeu_ps(p, m, v); }
+  static void       Store(float * p, const Vec v) { _mm512_storeu_ps(p, v); }
+  static Vec        Broadcast(const float x) { return _mm512_set1_ps(x); }
+  static Vec        Add(const Vec a, const Vec b)
+                    { return _mm512_add_ps(a, b); }
+  static Vec        Sub(const Vec a, const Vec b)
+                    { return _mm512_sub_ps(a, b); }
+  static Vec        Mul(const Vec a, const Vec b)
+                    { return _mm512_mul_ps(a, b); }
+  static Vec        Div(const Vec a, const Vec b)
+                    { return _mm512_div_ps(a, b); }
+  static Vec        Sqrt(const Vec a) { return _mm512_sqrt_ps(a); }
+  static Vec        Min(const Vec a, const Vec b)
+                    { return _mm512_min_ps(a, b); }
+  static Vec        Max(const Vec a, const Vec b)
+                    { return _mm512_max_ps(a, b); }
+  static Vec        Fma(const Vec a, const Vec b, const Vec c)
+                    { return _mm512_fmadd_ps(a, b, c); }
+  static Vec        Round(const Vec a)
+                    { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT
+                        | _MM_FROUND_NO_EXC); }
+  static Vec        Floor(const Vec a)
+                    { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF
+                        | _MM_FROUND_NO_EXC); }
+  // a * 2^k for integral k
+  static Vec        Ldexp(const Vec a, const Vec k)
+                    { return _mm512_scalef_ps(a, k); }
+  // table[i] for integral, non-negative i
+  static Vec        Lookup(const float * table, const Vec i)
+                    { return _mm512_i32gather_ps(_mm512_cvtps_epi32(i), table,
+                        4); }
+};
+
+} // namespace
+
+namespace mnist {
+
+extern const KernelTable kAvx512Kernels = {
+  "avx512",
+  MakeKernelFunctions<Avx512<double>>(),
+  MakeKernelFunctions<Avx512<float>>()
+};
+
+} // namespace mnist
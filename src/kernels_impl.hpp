@@ -0,0 +1,747 @@
+/**
+ * @file
+ * @brief Generic implementations of the kernels, instantiated for each
+ *        instruction set by a translation unit compiled for that instruction
+ *        set.
+ * @author Arno Bastenhof
+ */
+
+#ifndef KERNELS_IMPL_HPP_
+#define KERNELS_IMPL_HPP_
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "activation.hpp"
+#include "kernels.hpp"
+#include "optimizer.hpp"
+
+namespace mnist {
+
+/** @brief The kernels for a single instruction set and element type. */
+template <typename T>
+struct KernelFunctions {
+  void              (*dense_sigmoid)(const T *, const int, const int,
+                        const T *, const int, T *, const SigmoidMode);
+  void              (*sparse_dense_sigmoid)(const T *, const int,
+                        const SparseColumns<T>&, const uint32_t *, const int,
+                        T *, const SigmoidMode);
+  void              (*sparse_outer_product)(const T *, const int, const int,
+                        const SparseColumns<T>&, const uint32_t *, const int,
+                        T *);
+  void              (*output_error)(const T *, const uint8_t *, const int,
+                        const int, T *);
+  void              (*sigmoid)(T *, const std::size_t, const SigmoidMode);
+  void              (*apply_gradients)(const T * const *, const int,
+                        const std::size_t, const std::size_t,
+                        const OptimizerStep&, T *, T *, T *);
+  void              (*bilinear_sample)(const T *, const int, const int,
+                        const T *, const T *, const int, T *);
+};
+
+/** @brief The kernels implemented for a single instruction set. */
+struct KernelTable {
+  const char *      isa;
+  KernelFunctions<double> f64;
+  KernelFunctions<float> f32;
+};
+
+/**
+ * @brief Values of the sigmoid sampled at regular intervals, for linear
+ *        interpolation in mode kSigmoidTable.
+ *
+ * The interpolation error is bounded by h^2 / 8 * max |sigmoid''| (about
+ * 2.9e-6 for h = 1/64), and clamping the inputs to the sampled range adds at
+ * most 1 - sigmoid(16) (about 1.1e-7).
+ */
+struct SigmoidTable {
+  enum {
+    kRange = 16,                            // samples cover [-kRange, kRange]
+    kSteps = 64,                            // samples per unit
+    kSize = 2 * kRange * kSteps + 2         // one extra for interpolation
+  };
+                    SigmoidTable();
+  double            values[kSize];
+  float             float_values[kSize];
+  // The samples of a given type, selected by the type of the argument
+  const double *    Values(double) const { return values; }
+  const float *     Values(float) const { return float_values; }
+};
+
+/**
+ * @brief The integer kernel for a single instruction set, selected separately
+ *        from the others as it may require extensions of its own.
+ */
+struct QuantizedKernelTable {
+  const char *      isa;
+  void              (*dense)(const int8_t *, const int, const int,
+                        const uint8_t *, const int, const int, int32_t *);
+};
+
+extern const SigmoidTable kSigmoidValues;
+extern const KernelTable kScalarKernels;
+extern const KernelTable kAvx2Kernels;
+extern const KernelTable kAvx512Kernels;
+extern const QuantizedKernelTable kScalarQuantizedKernels;
+extern const QuantizedKernelTable kAvx2QuantizedKernels;
+extern const QuantizedKernelTable kVnniQuantizedKernels;
+
+// Everything below gets internal linkage, so that code compiled for different
+// instruction sets is never merged by the linker
+namespace {
+
+// ln(2), split into a leading part with few enough significant bits that its
+// product with k is exact in T, and the remainder
+template <typename T> struct Ln2;
+template <> struct Ln2<double> {
+  static constexpr double kHi = 6.93145751953125e-1;
+  static constexpr double kLo = 1.42860682030941723212e-6;
+};
+template <> struct Ln2<float> {
+  static constexpr float kHi = 6.93359375e-1f;
+  static constexpr float kLo = -2.12194440e-4f;
+};
+
+// The exact sigmoid
+template <typename T>
+inline T ExactSigmoid(const T x)
+{
+  return T(1) / (T(1) + std::exp(-x));
+}
+
+// Sigmoid(x) = 1 / (1 + exp(-x)), with exp(-x) = 2^k * exp(r) for the integer
+// k nearest to -x / ln(2) and |r| <= ln(2) / 2, where exp(r) is approximated
+// by its Taylor polynomial of degree 7 (relative error below 6e-9). Inputs are
+// clamped to [-40, 40], beyond which the sigmoid is within 5e-18 of 0 or 1
+template <typename Isa>
+inline typename Isa::Vec FastSigmoid(typename Isa::Vec x)
+{
+  typedef typename Isa::Elem T;
+  typedef typename Isa::Vec Vec;
+  const Vec one = Isa::Broadcast(1);
+
+  x = Isa::Min(Isa::Max(x, Isa::Broadcast(-40)), Isa::Broadcast(40));
+  const Vec t = Isa::Sub(Isa::Broadcast(0), x);
+  const Vec k = Isa::Round(Isa::Mul(t, Isa::Broadcast(1.4426950408889634)));
+  Vec r = Isa::Fma(k, Isa::Broadcast(-Ln2<T>::kHi), t);
+  r = Isa::Fma(k, Isa::Broadcast(-Ln2<T>::kLo), r);
+
+  Vec p = Isa::Broadcast(1.0 / 5040);
+  p = Isa::Fma(p, r, Isa::Broadcast(1.0 / 720));
+  p = Isa::Fma(p, r, Isa::Broadcast(1.0 / 120));
+  p = Isa::Fma(p, r, Isa::Broadcast(1.0 / 24));
+  p = Isa::Fma(p, r, Isa::Broadcast(1.0 / 6));
+  p = Isa::Fma(p, r, Isa::Broadcast(0.5));
+  p = Isa::Fma(p, r, one);
+  p = Isa::Fma(p, r, one);
+  return Isa::Div(one, Isa::Add(one, Isa::Ldexp(p, k)));
+}
+
+// Sigmoid(x) by linear interpolation between the samples in kSigmoidValues
+template <typename Isa>
+inline typename Isa::Vec TableSigmoid(typename Isa::Vec x)
+{
+  typedef typename Isa::Elem T;
+  typedef typename Isa::Vec Vec;
+  enum { kRange = SigmoidTable::kRange, kSteps = SigmoidTable::kSteps };
+
+  const T * values = kSigmoidValues.Values(T());
+  const Vec range = Isa::Broadcast(kRange);
+  x = Isa::Min(Isa::Max(x, Isa::Sub(Isa::Broadcast(0), range)), range);
+  const Vec u = Isa::Mul(Isa::Add(x, range), Isa::Broadcast(kSteps));
+  const Vec i = Isa::Floor(u);
+  const Vec lo = Isa::Lookup(values, i);
+  const Vec hi = Isa::Lookup(values + 1, i);
+  return Isa::Fma(Isa::Sub(u, i), Isa::Sub(hi, lo), lo);
+}
+
+// Applies an approximation of the sigmoid to a vector (not kSigmoidExact)
+template <typename Isa>
+inline typename Isa::Vec ApproxSigmoid(const typename Isa::Vec x,
+    const SigmoidMode mode)
+{
+  return mode == kSigmoidFast ? FastSigmoid<Isa>(x) : TableSigmoid<Isa>(x);
+}
+
+// Computes out = Sigmoid(w * in + bias) for a block of rows, spanning kVecs
+// vectors, and Isa::kSamples samples. Row counts that are not a multiple of
+// the vector width are handled through masking
+template <typename Isa, int kVecs>
+inline void DenseSigmoidBlock(const typename Isa::Elem * w, const int rows,
+    const int cols, const typename Isa::Elem * bias, const int block_rows,
+    const typename Isa::Elem * const * in, typename Isa::Elem * const * out,
+    const SigmoidMode mode)
+{
+  typedef typename Isa::Elem T;
+  typedef typename Isa::Vec Vec;
+  typedef typename Isa::Mask Mask;
+  enum { kWidth = Isa::kWidth, kSamples = Isa::kSamples };
+
+  Mask mask[kVecs];
+  for (int v = 0; v != kVecs; ++v) {
+    const int lanes = block_rows - v * kWidth;
+    mask[v] = Isa::MakeMask(lanes > kWidth ? static_cast<int>(kWidth) : lanes);
+  }
+
+  // Accumulators, initialized with the biases
+  Vec acc[kSamples][kVecs];
+  for (int v = 0; v != kVecs; ++v) {
+    const Vec b = Isa::MaskLoad(bias + v * kWidth, mask[v]);
+    for (int s = 0; s != kSamples; ++s) {
+      acc[s][v] = b;
+    }
+  }
+
+  // Each column of the weights is loaded once for all samples. Only the last
+  // vector can be partial, the others use plain (faster) unaligned loads
+  for (int k = 0; k != cols; ++k) {
+    const T * col = w + static_cast<std::size_t>(k) * rows;
+    Vec wv[kVecs];
+    for (int v = 0; v != kVecs; ++v) {
+      wv[v] = v + 1 < kVecs ? Isa::Load(col + v * kWidth)
+                            : Isa::MaskLoad(col + v * kWidth, mask[v]);
+    }
+    for (int s = 0; s != kSamples; ++s) {
+      const Vec x = Isa::Broadcast(in[s][k]);
+      for (int v = 0; v != kVecs; ++v) {
+        acc[s][v] = Isa::Fma(wv[v], x, acc[s][v]);
+      }
+    }
+  }
+
+  // Approximations of the sigmoid are applied in registers, whereas the exact
+  // sigmoid is applied after storing, while the results are still in cache
+  if (mode != kSigmoidExact) {
+    for (int s = 0; s != kSamples; ++s) {
+      for (int v = 0; v != kVecs; ++v) {
+        acc[s][v] = ApproxSigmoid<Isa>(acc[s][v], mode);
+      }
+    }
+  }
+  for (int s = 0; s != kSamples; ++s) {
+    for (int v = 0; v != kVecs; ++v) {
+      Isa::MaskStore(out[s] + v * kWidth, mask[v], acc[s][v]);
+    }
+    if (mode == kSigmoidExact) {
+      for (int r = 0; r != block_rows; ++r) {
+        out[s][r] = ExactSigmoid(out[s][r]);
+      }
+    }
+  }
+}
+
+// Computes out = Sigmoid(W * in + b) for a layer with the given numbers of
+// rows (outputs) and columns (inputs), where the weights are stored column-
+// major with the biases in the first column. The n inputs and outputs are
+// stored one per column
+template <typename Isa, typename T = typename Isa::Elem>
+void DenseSigmoidImpl(const T * weights, const int rows, const int cols,
+    const T * in, const int n, T * out, const SigmoidMode mode)
+{
+  enum { kWidth = Isa::kWidth, kSamples = Isa::kSamples };
+  enum { kBlockRows = 4 * kWidth };
+
+  const T * bias = weights;
+  const T * w = weights + rows;
+  for (int j = 0; j < n; j += kSamples) {
+    // Samples past the end of the batch are clamped to the last one, which is
+    // then harmlessly computed more than once
+    const T * in_block[kSamples];
+    T * out_block[kSamples];
+    for (int s = 0; s != kSamples; ++s) {
+      const std::size_t sample = j + s < n ? j + s : n - 1;
+      in_block[s] = in + sample * cols;
+      out_block[s] = out + sample * rows;
+    }
+
+    for (int r = 0; r < rows; r += kBlockRows) {
+      const int block_rows = rows - r < kBlockRows ? rows - r : kBlockRows;
+      T * out_rows[kSamples];
+      for (int s = 0; s != kSamples; ++s) {
+        out_rows[s] = out_block[s] + r;
+      }
+      switch ((block_rows + kWidth - 1) / kWidth) {
+      case 1:
+        DenseSigmoidBlock<Isa, 1>(w + r, rows, cols, bias + r, block_rows,
+            in_block, out_rows, mode);
+        break;
+      case 2:
+        DenseSigmoidBlock<Isa, 2>(w + r, rows, cols, bias + r, block_rows,
+            in_block, out_rows, mode);
+        break;
+      case 3:
+        DenseSigmoidBlock<Isa, 3>(w + r, rows, cols, bias + r, block_rows,
+            in_block, out_rows, mode);
+        break;
+      default:
+        DenseSigmoidBlock<Isa, 4>(w + r, rows, cols, bias + r, block_rows,
+            in_block, out_rows, mode);
+        break;
+      }
+    }
+  }
+}
+
+// Computes out = Sigmoid(w * in + bias) for a block of rows, spanning kVecs
+// vectors, and a single sample given by the rows and values of its nnz
+// non-zero inputs. Each non-zero adds a multiple of a column of the weights,
+// which is contiguous
+template <typename Isa, int kVecs>
+inline void SparseDenseSigmoidBlock(const typename Isa::Elem * w,
+    const int rows, const typename Isa::Elem * bias, const int block_rows,
+    const uint32_t * indices, const typename Isa::Elem * values,
+    const std::size_t nnz, typename Isa::Elem * out, const SigmoidMode mode)
+{
+  typedef typename Isa::Elem T;
+  typedef typename Isa::Vec Vec;
+  typedef typename Isa::Mask Mask;
+  enum { kWidth = Isa::kWidth };
+
+  Mask mask[kVecs];
+  Vec acc[kVecs];
+  for (int v = 0; v != kVecs; ++v) {
+    const int lanes = block_rows - v * kWidth;
+    mask[v] = Isa::MakeMask(lanes > kWidth ? static_cast<int>(kWidth) : lanes);
+    acc[v] = Isa::MaskLoad(bias + v * kWidth, mask[v]);
+  }
+
+  for (std::size_t i = 0; i != nnz; ++i) {
+    const T * col = w + static_cast<std::size_t>(indices[i]) * rows;
+    const Vec x = Isa::Broadcast(values[i]);
+    for (int v = 0; v != kVecs; ++v) {
+      const Vec wv = v + 1 < kVecs ? Isa::Load(col + v * kWidth)
+                                   : Isa::MaskLoad(col + v * kWidth, mask[v]);
+      acc[v] = Isa::Fma(wv, x, acc[v]);
+    }
+  }
+
+  // The sigmoid is applied as in DenseSigmoidBlock
+  for (int v = 0; v != kVecs; ++v) {
+    if (mode != kSigmoidExact) {
+      acc[v] = ApproxSigmoid<Isa>(acc[v], mode);
+    }
+    Isa::MaskStore(out + v * kWidth, mask[v], acc[v]);
+  }
+  if (mode == kSigmoidExact) {
+    for (int r = 0; r != block_rows; ++r) {
+      out[r] = ExactSigmoid(out[r]);
+    }
+  }
+}
+
+// Computes out = Sigmoid(W * in + b) as DenseSigmoidImpl, for the n columns of
+// a sparse matrix in with the given indices. Only the non-zero inputs are
+// visited, so that the cost is proportional to their number
+template <typename Isa, typename T = typename Isa::Elem>
+void SparseDenseSigmoidImpl(const T * weights, const int rows,
+    const SparseColumns<T>& in, const uint32_t * samples, const int n,
+    T * out, const SigmoidMode mode)
+{
+  enum { kWidth = Isa::kWidth };
+  enum { kBlockRows = 4 * kWidth };
+
+  const T * bias = weights;
+  const T * w = weights + rows;
+  for (int j = 0; j != n; ++j) {
+    const uint64_t first = in.offsets[samples[j]];
+    const std::size_t nnz = in.offsets[samples[j] + 1] - first;
+    const uint32_t * indices = in.indices + first;
+    const T * values = in.values + first;
+    T * out_col = out + static_cast<std::size_t>(j) * rows;
+
+    for (int r = 0; r < rows; r += kBlockRows) {
+      const int block_rows = rows - r < kBlockRows ? rows - r : kBlockRows;
+      switch ((block_rows + kWidth - 1) / kWidth) {
+      case 1:
+        SparseDenseSigmoidBlock<Isa, 1>(w + r, rows, bias + r, block_rows,
+            indices, values, nnz, out_col + r, mode);
+        break;
+      case 2:
+        SparseDenseSigmoidBlock<Isa, 2>(w + r, rows, bias + r, block_rows,
+            indices, values, nnz, out_col + r, mode);
+        break;
+      case 3:
+        SparseDenseSigmoidBlock<Isa, 3>(w + r, rows, bias + r, block_rows,
+            indices, values, nnz, out_col + r, mode);
+        break;
+      default:
+        SparseDenseSigmoidBlock<Isa, 4>(w + r, rows, bias + r, block_rows,
+            indices, values, nnz, out_col + r, mode);
+        break;
+      }
+    }
+  }
+}
+
+// Computes out = err * in^T for the errors of a layer (rows x n, column-major)
+// and the n columns of a sparse matrix in with the given indices, i.e. the
+// gradients of the layer's weights (rows x cols, column-major, excluding the
+// biases). Each non-zero input adds a multiple of its sample's errors to a
+// column of the gradients
+template <typename Isa, typename T = typename Isa::Elem>
+void SparseOuterProductImpl(const T * err, const int rows, const int cols,
+    const SparseColumns<T>& in, const uint32_t * samples, const int n, T * out)
+{
+  typedef typename Isa::Vec Vec;
+  enum { kWidth = Isa::kWidth };
+
+  std::fill(out, out + static_cast<std::size_t>(rows) * cols, T(0));
+  const int full = rows / kWidth * kWidth;
+  const typename Isa::Mask mask = Isa::MakeMask(rows - full);
+  for (int j = 0; j != n; ++j) {
+    const T * e = err + static_cast<std::size_t>(j) * rows;
+    for (uint64_t i = in.offsets[samples[j]]; i != in.offsets[samples[j] + 1];
+        ++i) {
+      T * col = out + static_cast<std::size_t>(in.indices[i]) * rows;
+      const Vec x = Isa::Broadcast(in.values[i]);
+      int r = 0;
+      for (; r != full; r += kWidth) {
+        Isa::Store(col + r, Isa::Fma(Isa::Load(e + r), x, Isa::Load(col + r)));
+      }
+      if (r != rows) {
+        Isa::MaskStore(col + r, mask, Isa::Fma(Isa::MaskLoad(e + r, mask), x,
+            Isa::MaskLoad(col + r, mask)));
+      }
+    }
+  }
+}
+
+// Computes the errors of an output layer with sigmoid activations, given the
+// activations and labels of n samples: err = (activ - y) * activ * (1 - activ),
+// where y is the one-hot encoding of the label. The loop is left to the
+// compiler to vectorize for the instruction set of the including unit
+template <typename Isa, typename T = typename Isa::Elem>
+void OutputErrorImpl(const T * activ, const uint8_t * lab, const int rows,
+    const int n, T * err)
+{
+  const std::size_t size = static_cast<std::size_t>(rows) * n;
+  for (std::size_t i = 0; i != size; ++i) {
+    const T a = activ[i];
+    err[i] = a * a * (1 - a);
+  }
+
+  // Correct the entries for the actual labels, validated when loaded
+  for (int j = 0; j != n; ++j) {
+    assert(lab[j] < rows);
+    const std::size_t i = static_cast<std::size_t>(j) * rows + lab[j];
+    const T a = activ[i];
+    err[i] = (a - 1) * a * (1 - a);
+  }
+}
+
+// Applies the sigmoid in place to n values
+template <typename Isa, typename T = typename Isa::Elem>
+void SigmoidImpl(T * x, const std::size_t n, const SigmoidMode mode)
+{
+  enum { kWidth = Isa::kWidth };
+
+  if (mode == kSigmoidExact) {
+    for (std::size_t i = 0; i != n; ++i) {
+      x[i] = ExactSigmoid(x[i]);
+    }
+    return;
+  }
+  std::size_t i = 0;
+  for (; i + kWidth <= n; i += kWidth) {
+    Isa::Store(x + i, ApproxSigmoid<Isa>(Isa::Load(x + i), mode));
+  }
+  if (i != n) {
+    const typename Isa::Mask mask = Isa::MakeMask(static_cast<int>(n - i));
+    Isa::MaskStore(x + i, mask,
+        ApproxSigmoid<Isa>(Isa::MaskLoad(x + i, mask), mode));
+  }
+}
+
+// Loads a vector, or only the lanes of a mask unless kFull
+template <typename Isa, bool kFull>
+inline typename Isa::Vec LoadPart(const typename Isa::Elem * p,
+    const typename Isa::Mask mask)
+{
+  return kFull ? Isa::Load(p) : Isa::MaskLoad(p, mask);
+}
+
+// Stores a vector, or only the lanes of a mask unless kFull
+template <typename Isa, bool kFull>
+inline void StorePart(typename Isa::Elem * p, const typename Isa::Mask mask,
+    const typename Isa::Vec v)
+{
+  if (kFull) {
+    Isa::Store(p, v);
+  } else {
+    Isa::MaskStore(p, mask, v);
+  }
+}
+
+// The coefficients of an OptimizerStep, broadcast once for all vectors
+template <typename Isa>
+struct StepVecs {
+  typedef typename Isa::Vec Vec;
+  explicit          StepVecs(const OptimizerStep& step)
+                      : scale(Isa::Broadcast(step.scale))
+                      , neg_rate(Isa::Broadcast(-step.rate))
+                      , reg(Isa::Broadcast(step.reg))
+                      , momentum(Isa::Broadcast(step.momentum))
+                      , momentum_c(Isa::Broadcast(1 - step.momentum))
+                      , decay(Isa::Broadcast(step.decay))
+                      , decay_c(Isa::Broadcast(1 - step.decay))
+                      , epsilon(Isa::Broadcast(step.epsilon)) {}
+  Vec               scale;
+  Vec               neg_rate;
+  Vec               reg;
+  Vec               momentum;
+  Vec               momentum_c;             // 1 - momentum
+  Vec               decay;
+  Vec               decay_c;                // 1 - decay
+  Vec               epsilon;
+};
+
+// Applies the update of an optimizer to the vector of weights at index i, or
+// only the lanes of a mask unless kFull. The gradients of the threads are
+// summed in a fixed order, so that results do not depend on thread timing,
+// before the regularization term is added and the sum scaled. The moments
+// are only accessed by the optimizers keeping them
+template <typename Isa, OptimizerKind kKind, bool kFull>
+inline void ApplyGradientsVec(const typename Isa::Elem * const * grads,
+    const int num_grads, const std::size_t i, const typename Isa::Mask mask,
+    const StepVecs<Isa>& c, typename Isa::Elem * weights,
+    typename Isa::Elem * first_moments, typename Isa::Elem * second_moments)
+{
+  typedef typename Isa::Vec Vec;
+
+  Vec g = LoadPart<Isa, kFull>(grads[0] + i, mask);
+  for (int k = 1; k < num_grads; ++k) {
+    g = Isa::Add(g, LoadPart<Isa, kFull>(grads[k] + i, mask));
+  }
+  const Vec w = LoadPart<Isa, kFull>(weights + i, mask);
+  g = Isa::Mul(Isa::Fma(c.reg, w, g), c.scale);
+
+  Vec step = g;
+  if (kKind == kOptimizerMomentum || kKind == kOptimizerNesterov) {
+    const Vec v = Isa::Fma(c.momentum,
+        LoadPart<Isa, kFull>(first_moments + i, mask), g);
+    StorePart<Isa, kFull>(first_moments + i, mask, v);
+    step = kKind == kOptimizerMomentum ? v : Isa::Fma(c.momentum, v, g);
+  } else if (kKind == kOptimizerAdam) {
+    const Vec m = Isa::Fma(c.momentum,
+        LoadPart<Isa, kFull>(first_moments + i, mask),
+        Isa::Mul(c.momentum_c, g));
+    const Vec v = Isa::Fma(c.decay,
+        LoadPart<Isa, kFull>(second_moments + i, mask),
+        Isa::Mul(c.decay_c, Isa::Mul(g, g)));
+    StorePart<Isa, kFull>(first_moments + i, mask, m);
+    StorePart<Isa, kFull>(second_moments + i, mask, v);
+    step = Isa::Div(m, Isa::Add(Isa::Sqrt(v), c.epsilon));
+  }
+  StorePart<Isa, kFull>(weights + i, mask, Isa::Fma(c.neg_rate, step, w));
+}
+
+// Applies the update of a given optimizer to the weights [begin, end)
+template <typename Isa, OptimizerKind kKind, typename T = typename Isa::Elem>
+void ApplyGradientsKind(const T * const * grads, const int num_grads,
+    const std::size_t begin, const std::size_t end, const OptimizerStep& step,
+    T * weights, T * first_moments, T * second_moments)
+{
+  enum { kWidth = Isa::kWidth };
+
+  const StepVecs<Isa> c{step};
+  const typename Isa::Mask all = Isa::MakeMask(kWidth);
+  std::size_t i = begin;
+  for (; i + kWidth <= end; i += kWidth) {
+    ApplyGradientsVec<Isa, kKind, true>(grads, num_grads, i, all, c, weights,
+        first_moments, second_moments);
+  }
+  if (i != end) {
+    ApplyGradientsVec<Isa, kKind, false>(grads, num_grads, i,
+        Isa::MakeMask(static_cast<int>(end - i)), c, weights, first_moments,
+        second_moments);
+  }
+}
+
+// Sums the gradients of a number of threads for the weights [begin, end) and
+// applies them with the optimizer of the given step in a single pass,
+// dispatching on the optimizer once rather than per vector
+template <typename Isa, typename T = typename Isa::Elem>
+void ApplyGradientsImpl(const T * const * grads, const int num_grads,
+    const std::size_t begin, const std::size_t end, const OptimizerStep& step,
+    T * weights, T * first_moments, T * second_moments)
+{
+  switch (step.kind) {
+  case kOptimizerMomentum:
+    ApplyGradientsKind<Isa, kOptimizerMomentum>(grads, num_grads, begin, end,
+        step, weights, first_moments, second_moments);
+    break;
+  case kOptimizerNesterov:
+    ApplyGradientsKind<Isa, kOptimizerNesterov>(grads, num_grads, begin, end,
+        step, weights, first_moments, second_moments);
+    break;
+  case kOptimizerAdam:
+    ApplyGradientsKind<Isa, kOptimizerAdam>(grads, num_grads, begin, end,
+        step, weights, first_moments, second_moments);
+    break;
+  default:
+    ApplyGradientsKind<Isa, kOptimizerSgd>(grads, num_grads, begin, end,
+        step, weights, first_moments, second_moments);
+    break;
+  }
+}
+
+// Samples a padded image (see BilinearSampleImpl) at a vector of points by
+// bilinear interpolation between the four nearest pixels, looked up by index
+template <typename Isa>
+inline typename Isa::Vec BilinearSampleVec(const typename Isa::Elem * img,
+    const int width, const int height, typename Isa::Vec x,
+    typename Isa::Vec y)
+{
+  typedef typename Isa::Vec Vec;
+  const Vec one = Isa::Broadcast(1);
+  const Vec stride = Isa::Broadcast(width + 3);
+
+  x = Isa::Min(Isa::Max(x, Isa::Broadcast(-1)), Isa::Broadcast(width));
+  y = Isa::Min(Isa::Max(y, Isa::Broadcast(-1)), Isa::Broadcast(height));
+  const Vec x0 = Isa::Floor(x);
+  const Vec y0 = Isa::Floor(y);
+  const Vec i = Isa::Fma(Isa::Add(y0, one), stride, Isa::Add(x0, one));
+  const Vec top_left = Isa::Lookup(img, i);
+  const Vec top_right = Isa::Lookup(img + 1, i);
+  const Vec bottom_left = Isa::Lookup(img + width + 3, i);
+  const Vec bottom_right = Isa::Lookup(img + width + 4, i);
+  const Vec dx = Isa::Sub(x, x0);
+  const Vec top = Isa::Fma(dx, Isa::Sub(top_right, top_left), top_left);
+  const Vec bottom = Isa::Fma(dx, Isa::Sub(bottom_right, bottom_left),
+      bottom_left);
+  return Isa::Fma(Isa::Sub(y, y0), Isa::Sub(bottom, top), top);
+}
+
+// Samples an image at n points (x[i], y[i]) by bilinear interpolation, where
+// the image is padded with zeros, one pixel wide on the top and left and two
+// on the bottom and right. Clamping the points to [-1, width] x [-1, height]
+// thus keeps all lookups within the padded image, while points outside the
+// image are sampled as zero
+template <typename Isa, typename T = typename Isa::Elem>
+void BilinearSampleImpl(const T * img, const int width, const int height,
+    const T * x, const T * y, const int n, T * out)
+{
+  enum { kWidth = Isa::kWidth };
+
+  int i = 0;
+  for (; i + kWidth <= n; i += kWidth) {
+    Isa::Store(out + i, BilinearSampleVec<Isa>(img, width, height,
+        Isa::Load(x + i), Isa::Load(y + i)));
+  }
+  if (i != n) {
+    const typename Isa::Mask mask = Isa::MakeMask(n - i);
+    Isa::MaskStore(out + i, mask, BilinearSampleVec<Isa>(img, width, height,
+        Isa::MaskLoad(x + i, mask), Isa::MaskLoad(y + i, mask)));
+  }
+}
+
+// Computes the dot products of kRows rows of int8 weights with the uint8
+// inputs of Isa::kSamples samples. Each chunk of Isa::kBytes inputs is loaded
+// once for all rows. A partial chunk at the end of the inputs is first copied
+// into a zero-padded buffer, whereas the weights are required to be padded
+// with zeros up to the next multiple of Isa::kBytes
+template <typename Isa, int kRows>
+inline void QuantizedDenseBlock(const int8_t * w, const int stride,
+    const uint8_t * const * in, const int cols, int32_t * const * out)
+{
+  typedef typename Isa::Vec Vec;
+  enum { kBytes = Isa::kBytes, kSamples = Isa::kSamples };
+
+  Vec acc[kSamples][kRows];
+  for (int s = 0; s != kSamples; ++s) {
+    for (int r = 0; r != kRows; ++r) {
+      acc[s][r] = Isa::Zero();
+    }
+  }
+
+  uint8_t tail[kSamples][kBytes] = {};
+  for (int k = 0; k < cols; k += kBytes) {
+    Vec x[kSamples];
+    for (int s = 0; s != kSamples; ++s) {
+      if (k + kBytes <= cols) {
+        x[s] = Isa::LoadInputs(in[s] + k);
+      } else {
+        std::copy(in[s] + k, in[s] + cols, tail[s]);
+        x[s] = Isa::LoadInputs(tail[s]);
+      }
+    }
+    for (int r = 0; r != kRows; ++r) {
+      const Vec wv = Isa::LoadWeights(w + static_cast<std::size_t>(r) * stride
+          + k);
+      for (int s = 0; s != kSamples; ++s) {
+        acc[s][r] = Isa::DotAdd(acc[s][r], x[s], wv);
+      }
+    }
+  }
+
+  for (int s = 0; s != kSamples; ++s) {
+    for (int r = 0; r != kRows; ++r) {
+      out[s][r] = Isa::Sum(acc[s][r]);
+    }
+  }
+}
+
+// Computes out = W * in for int8 weights W, stored row-major with the given
+// stride, and n samples of uint8 inputs, each stored contiguously. The int32
+// results are stored one column of rows values per sample. The weights must
+// be small enough for pairwise sums of products to fit in 16 bits (see
+// kMaxQuantizedWeight), and are padded as in QuantizedDenseBlock
+template <typename Isa>
+void QuantizedDenseImpl(const int8_t * weights, const int rows,
+    const int stride, const uint8_t * in, const int cols, const int n,
+    int32_t * out)
+{
+  enum { kSamples = Isa::kSamples, kBlockRows = 4 };
+
+  for (int j = 0; j < n; j += kSamples) {
+    // Samples past the end are clamped to the last one, as in DenseSigmoid
+    const uint8_t * in_block[kSamples];
+    int32_t * out_block[kSamples];
+    for (int s = 0; s != kSamples; ++s) {
+      const std::size_t sample = j + s < n ? j + s : n - 1;
+      in_block[s] = in + sample * cols;
+      out_block[s] = out + sample * rows;
+    }
+
+    for (int r = 0; r < rows; r += kBlockRows) {
+      const int8_t * w = weights + static_cast<std::size_t>(r) * stride;
+      int32_t * out_rows[kSamples];
+      for (int s = 0; s != kSamples; ++s) {
+        out_rows[s] = out_block[s] + r;
+      }
+      switch (rows - r < kBlockRows ? rows - r : kBlockRows) {
+      case 1:
+        QuantizedDenseBlock<Isa, 1>(w, stride, in_block, cols, out_rows);
+        break;
+      case 2:
+        QuantizedDenseBlock<Isa, 2>(w, stride, in_block, cols, out_rows);
+        break;
+      case 3:
+        QuantizedDenseBlock<Isa, 3>(w, stride, in_block, cols, out_rows);
+        break;
+      default:
+        QuantizedDenseBlock<Isa, 4>(w, stride, in_block, cols, out_rows);
+        break;
+      }
+    }
+  }
+}
+
+// The kernels for a given instruction set and element type
+template <typename Isa>
+constexpr KernelFunctions<typename Isa::Elem> MakeKernelFunctions()
+{
+  return { &DenseSigmoidImpl<Isa>, &SparseDenseSigmoidImpl<Isa>,
+           &SparseOuterProductImpl<Isa>, &OutputErrorImpl<Isa>,
+           &SigmoidImpl<Isa>, &ApplyGradientsImpl<Isa>,
+           &BilinearSampleImpl<Isa> };
+}
+
+} // namespace
+
+} // namespace mnist
+
+#endif // KERNELS_IMPL_HPP_
@@ -0,0 +1,48 @@
+/**
+ * @file
+ * @brief Implementation of the integer kernel for AVX-512 VNNI.
+ *
+ * This file is compiled with -mavx512f -mavx512bw -mavx512vnni, and its
+ * kernel is only called on hosts supporting all three.
+ *
+ * @author Arno Bastenhof
+ */
+
+// Older versions of GCC wrongly warn about the undefined vectors passed to
+// masked builtins by the AVX-512 intrinsics, including the 256-bit extracts
+// underlying the horizontal sum
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+
+#include "kernels_impl.hpp"
+
+namespace {
+
+// Groups of four products of uint8 inputs and int8 weights are summed directly
+// into 32 bits
+struct Vnni {
+  typedef __m512i   Vec;
+  enum { kBytes = 64, kSamples = 4 };
+  static Vec        Zero() { return _mm512_setzero_si512(); }
+  static Vec        LoadInputs(const uint8_t * p)
+                    { return _mm512_loadu_si512(p); }
+  static Vec        LoadWeights(const int8_t * p)
+                    { return _mm512_loadu_si512(p); }
+  static Vec        DotAdd(const Vec acc, const Vec x, const Vec w)
+                    { return _mm512_dpbusd_epi32(acc, x, w); }
+  static int32_t    Sum(const Vec v) { return _mm512_reduce_add_epi32(v); }
+};
+
+} // namespace
+
+namespace mnist {
+
+extern const QuantizedKernelTable kVnniQuantizedKernels = {
+  "avx512vnni",
+  &QuantizedDenseImpl<Vnni>
+};
+
+} // namespace mnist
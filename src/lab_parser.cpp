@@ -32,13 +32,8 @@ LabelParser::LabelParser(const char *filename)
     throw runtime_error{"Could not read label file header."};
   }
 
-  // Validate magic number
-  if (ReadBigEndianInt32(buffer_) != kMagicNumberLabelFile) {
-    throw runtime_error{"Unexpected magic number for label file."};
-  }
-
-  // Read number of labels
-  num_items_ = ReadBigEndianInt32(buffer_ + 4);
+  // Validate header and read number of labels
+  num_items_ = ValidateLabelHeader(buffer_);
 }
 
 /**
@@ -63,6 +58,7 @@ Col<uint8_t> LabelParser::Parse()
       throw runtime_error{"Could not read labels."};
     }
     num_items_ -= cnt;
+    ValidateLabels(buffer_, cnt);
 
     // copy the buffer's contents to the output vector and continue
     copy(buffer_, buffer_ + cnt, it);
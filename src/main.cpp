@@ -1,34 +1,188 @@
 #include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
-#include "img_parser.hpp"
-#include "lab_parser.hpp"
-
+#include "autotune.hpp"
+#include "checkpoint.hpp"
+#include "communicator.hpp"
+#include "dataset_cache.hpp"
+#include "idx_stream.hpp"
+#include "mnist_dataset.hpp"
 #include "neural.hpp"
+#include "quantized.hpp"
+#include "telemetry.hpp"
+#include "transport.hpp"
+#include "validator.hpp"
 
 using std::cin;
 using std::cout;
+using std::ifstream;
+using std::istringstream;
+using std::map;
+using std::ofstream;
+using std::runtime_error;
 using std::string;
+using std::vector;
 
-using arma::Mat;
-
-using mnist::ImageParser;
-using mnist::LabelParser;
+using mnist::BatchSizeTrial;
+using mnist::CachedDataset;
+using mnist::Checkpoint;
+using mnist::Communicator;
+using mnist::Distortions;
+using mnist::IdxStream;
+using mnist::MnistDataset;
 using mnist::NeuralNet;
+using mnist::Optimizer;
+using mnist::QuantizedNet;
+using mnist::SigmoidMode;
+using mnist::Telemetry;
+using mnist::Validator;
+using mnist::WriteDatasetCache;
+
+// Command line options, given as --name or --name=value
+using Options = map<string, string>;
 
-// Constants regarding the MNIST data files
-enum {
-  kTrainingSetSz = 60000,
-  kTestSetSz = 10000,
-  kImageSz = 784
+// Settings for training and evaluating a network
+struct Settings {
+  string            path;           // of the MNIST data files
+  double            rate;
+  double            reg;
+  int               epochs;         // at most, when stopping early
+  int               threads;
+  int               batch_size;
+  vector<int>       layers;         // units per layer, input layer first
+  bool              autotune;       // of the batch size
+  double            target_accuracy;  // when autotuning, negative if none
+  SigmoidMode       sigmoid;
+  Optimizer         optimizer;
+  bool              hogwild;
+  int               validation;     // samples held out, 0 if none
+  int               patience;       // epochs without improvement
+  bool              cache;
+  bool              stream;
+  int               shuffle_buffer; // samples held in memory when streaming
+  bool              quantize;
+  bool              augment;
+  Distortions       distortions;
+  int               augment_threads;
+  string            checkpoint;     // empty if not checkpointing
+  int               checkpoint_interval;  // epochs, 0 if only at the end
+  bool              resume;
+  string            load;           // checkpoint to evaluate, if any
+  Telemetry *       telemetry;      // nullptr if not instrumenting
+  int               rank;           // of this process, from 0
+  int               world_size;     // no. of processes training together
+  Communicator *    comm;           // nullptr if training alone
 };
 
-// MNIST image- and label files
+// MNIST image- and label files, each of which may instead be gzip-compressed
+// and stored with the suffix below
 static const string kTrainingSetImageFile = "train-images.idx3-ubyte";
 static const string kTrainingSetLabelFile = "train-labels.idx1-ubyte";
 static const string kTestSetImageFile     = "t10k-images.idx3-ubyte";
 static const string kTestSetLabelFile     = "t10k-labels.idx1-ubyte";
+static const string kGzipSuffix           = ".gz";
+
+// Preconverted data set caches, created on first use (see --cache), with the
+// name of each single-precision cache (see --float) suffixed further
+static const string kTrainingSetCacheFile = "train.cache";
+static const string kTestSetCacheFile     = "t10k.cache";
+static const string kSinglePrecisionSuffix = ".f32";
+
+// Default number of epochs without improvement after which to stop training
+// (see --patience), which is only known after training one more
+static const int kDefaultPatience = 3;
+
+// Default number of samples held in memory when streaming (see --stream)
+static const int kDefaultShuffleBufferSz = 16384;
+
+// Default port of rank 0 when distributing training (see --port)
+static const int kDefaultPort = 29500;
+
+// Separate command line options from the (single) positional argument
+static Options ParseOptions(int argc, char *argv[], string& path)
+{
+  Options options;
+  for (int i = 1; i != argc; ++i) {
+    const string arg = argv[i];
+    if (arg.compare(0, 2, "--") != 0) {
+      path = arg;
+      continue;
+    }
+    const auto pos = arg.find('=');
+    if (pos == string::npos) {
+      options[arg.substr(2)] = "";
+    } else {
+      options[arg.substr(2, pos - 2)] = arg.substr(pos + 1);
+    }
+  }
+  return options;
+}
+
+// Read the value of a command line option or use a default otherwise
+template <typename T>
+static T GetOption(const Options& options, const string& name,
+    T default_value)
+{
+  const auto it = options.find(name);
+  if (it == options.end()) {
+    return default_value;
+  }
+  T val;
+  istringstream in{it->second};
+  if (!(in >> val)) {
+    cout << "Invalid value for --" << name << ". Using " << default_value
+         << ".\n";
+    val = default_value;
+  }
+  return val;
+}
+
+// Read the value of a command line option, or of an environment variable if
+// the option is not given, or use a default otherwise
+template <typename T>
+static T GetOption(Options options, const string& name, const char * env,
+    T default_value)
+{
+  const char * value = std::getenv(env);
+  if (options.count(name) == 0 && value != nullptr) {
+    options[name] = value;
+  }
+  return GetOption(options, name, default_value);
+}
+
+// Parse a comma-separated list of hidden layer sizes, returning the sizes of
+// all layers, or an empty list if invalid
+static vector<int> ParseLayers(const string& hidden)
+{
+  vector<int> layers{NeuralNet<double>::kInputLayerSz};
+  istringstream in{hidden};
+  string field;
+  while (std::getline(in, field, ',')) {
+    istringstream field_in{field};
+    int size;
+    if (!(field_in >> size) || !field_in.eof() || size < 1) {
+      return vector<int>{};
+    }
+    layers.push_back(size);
+  }
+  layers.push_back(NeuralNet<double>::kOutputLayerSz);
+  if (layers.size() > static_cast<std::size_t>(NeuralNet<double>::kMaxLayers)) {
+    return vector<int>{};
+  }
+  return layers;
+}
 
 // Read a value from standard input or use a default otherwise
 template <typename T>
@@ -54,57 +208,492 @@ static auto ReadValue(const string prompt, T default_value)
   return val;
 }
 
+// Return the full path of an MNIST data file, or that of its compressed form
+// if only the latter exists
+static string DataFile(const string& path, const string& name)
+{
+  const string filename = path + name;
+  if (!ifstream{filename} && ifstream{filename + kGzipSuffix}) {
+    return filename + kGzipSuffix;
+  }
+  return filename;
+}
+
+// Create a data set cache with features of type eT from an image- and label
+// file, unless it exists. If distributed, the processes share the cache, so
+// that only rank 0 creates it, while the others wait for it to finish
+template <typename eT>
+static string CreateCache(const string& path, const string& img_file,
+    const string& lab_file, const string& cache_file, Communicator * comm)
+{
+  string filename = path + cache_file;
+  if (std::is_same<eT, float>::value) {
+    filename += kSinglePrecisionSuffix;
+  }
+  uint8_t created = 1;
+  if ((comm == nullptr || comm->Rank() == 0) && !ifstream{filename}) {
+    try {
+      const MnistDataset dataset{DataFile(path, img_file).c_str(),
+                                 DataFile(path, lab_file).c_str()};
+      // Features are cached unscaled, matching the input expected by the
+      // network
+      WriteDatasetCache<eT>(dataset.Images(), dataset.Labels(),
+          filename.c_str(), 1.0);
+    } catch (...) {
+      created = 0;
+      if (comm != nullptr) {
+        comm->Broadcast(&created, sizeof created);
+      }
+      throw;
+    }
+  }
+  if (comm != nullptr) {
+    comm->Broadcast(&created, sizeof created);
+    if (!created) {
+      throw runtime_error{"Rank 0 could not create " + filename};
+    }
+  }
+  return filename;
+}
+
+// Return the batch size to train with, tuned on a training set held in memory
+// if requested
+template <typename T, typename Dataset>
+static int BatchSize(const Dataset& training_set, const Settings& s)
+{
+  if (!s.autotune) {
+    return s.batch_size;
+  }
+  const vector<BatchSizeTrial> trials = mnist::TryBatchSizes<T>(
+      training_set.Images(), training_set.Labels(), s.layers, s.threads,
+      s.sigmoid, s.optimizer, s.rate, s.reg);
+  cout << "Batch size, samples/s, accuracy (%):\n";
+  for (const BatchSizeTrial& trial : trials) {
+    cout << "  " << trial.batch_size << ", " << trial.samples_per_s << ", "
+         << trial.accuracy << '\n';
+  }
+  const int batch_size = mnist::PickBatchSize(trials, s.target_accuracy);
+  cout << "Using batch size " << batch_size << ".\n";
+  return batch_size;
+}
+
+// Return the batch size to train with on a training set streamed from disk,
+// on which tuning is not supported
+template <typename T>
+static int BatchSize(IdxStream&, const Settings& s)
+{
+  if (s.autotune) {
+    cout << "Ignoring --batch-size=auto when streaming.\n";
+  }
+  return s.batch_size;
+}
+
+// Learn the weights of a network from the images and labels of a training set
+// held in memory, of which the last samples are held out for validation,
+// stopping early once the accuracy on those stops improving
+template <typename T, typename eT>
+static void LearnValidated(NeuralNet<T>& nn, const arma::Mat<eT>& img,
+    const arma::Col<uint8_t>& lab, const Settings& s, const int epochs)
+{
+  // Keep at least one sample to train on, and one to validate on
+  if (img.n_cols < 2) {
+    cout << "Ignoring --validation with fewer than 2 training samples.\n";
+    nn.LearnWeights(img, lab, s.rate, s.reg, epochs);
+    return;
+  }
+  const arma::uword train = img.n_cols - std::min<arma::uword>(img.n_cols - 1,
+      s.validation);
+  const arma::Mat<eT> train_img(const_cast<eT *>(img.memptr()), img.n_rows,
+      train, false, true);
+  const arma::Col<uint8_t> train_lab(const_cast<uint8_t *>(lab.memptr()),
+      train, false, true);
+  const arma::Mat<eT> val_img(const_cast<eT *>(img.colptr(train)), img.n_rows,
+      img.n_cols - train, false, true);
+  const arma::Col<uint8_t> val_lab(const_cast<uint8_t *>(lab.memptr()) + train,
+      img.n_cols - train, false, true);
+
+  Validator<T> validator{nn, val_img, val_lab, s.patience};
+  nn.LearnWeights(train_img, train_lab, s.rate, s.reg, epochs, &validator);
+  cout << "Validation accuracy (%):";
+  for (const double accuracy : validator.Accuracies()) {
+    cout << ' ' << accuracy;
+  }
+  cout << "\nBest validation accuracy (%): " << validator.BestAccuracy()
+       << ", after epoch " << validator.BestEpoch() << '\n';
+}
+
+// Learn the weights of a network from a training set held in memory
+template <typename T, typename Dataset>
+static void Learn(NeuralNet<T>& nn, const Dataset& training_set,
+    const Settings& s, const int epochs)
+{
+  if (s.hogwild) {
+    if (s.validation != 0) {
+      cout << "Ignoring --validation with --hogwild.\n";
+    }
+    nn.LearnWeightsAsync(training_set.Images(), training_set.Labels(), s.rate,
+        s.reg, epochs);
+  } else if (s.validation != 0 && epochs != 0) {
+    LearnValidated(nn, training_set.Images(), training_set.Labels(), s,
+        epochs);
+  } else {
+    nn.LearnWeights(training_set.Images(), training_set.Labels(), s.rate,
+        s.reg, epochs);
+  }
+}
+
+// Learn the weights of a network from a training set streamed from disk,
+// which is only supported synchronously
+template <typename T>
+static void Learn(NeuralNet<T>& nn, IdxStream& training_set,
+    const Settings& s, const int epochs)
+{
+  if (s.hogwild) {
+    cout << "Ignoring --hogwild when streaming.\n";
+  }
+  if (s.validation != 0) {
+    cout << "Ignoring --validation when streaming.\n";
+  }
+  nn.LearnWeights(training_set, s.rate, s.reg, epochs);
+}
+
+// Output the accuracy of a network on a test set, optionally followed by that
+// of its int8 quantization
+template <typename T, typename TestSet>
+static void Evaluate(const NeuralNet<T>& nn, const TestSet& test_set,
+    const Settings& s)
+{
+  // Evaluate test set and output cost
+  cout << nn.Evaluate(test_set.Images(), test_set.Labels()) << '\n';
+
+  // Evaluate test set using integer arithmetic and output its cost
+  if (s.quantize) {
+    const QuantizedNet qnn{nn};
+    cout << "Quantized: " << qnn.Evaluate(test_set.Images(), test_set.Labels())
+         << '\n';
+  }
+}
+
+// Train a network on a training set, optionally resuming from and writing
+// checkpoints, and evaluate it on a test set
+template <typename T, typename TrainingSet, typename TestSet>
+static void Train(TrainingSet& training_set, const TestSet& test_set,
+    const Settings& s)
+{
+  // Create neural network
+  NeuralNet<T> nn{s.threads, s.sigmoid, BatchSize<T>(training_set, s),
+      s.layers};
+  nn.SetOptimizer(s.optimizer);
+  if (s.augment) {
+    nn.Augment(s.distortions, s.augment_threads);
+  }
+  nn.Instrument(s.telemetry);
+  nn.Distribute(s.comm);
+
+  // Resume from an existing checkpoint for the epochs remaining. When
+  // distributed, all processes resume, but only rank 0 writes checkpoints
+  if (!s.checkpoint.empty()) {
+    if (s.rank == 0) {
+      nn.SetCheckpoint(s.checkpoint, s.checkpoint_interval);
+    }
+    if (s.resume && ifstream{s.checkpoint}) {
+      nn.Load(s.checkpoint.c_str());
+      cout << "Resuming after epoch " << nn.Epochs() << ".\n";
+    }
+  }
+  const int epochs = std::max<long>(s.epochs - static_cast<long>(nn.Epochs()),
+      0);
+
+  // Learn weights from training set and output the time taken
+  const auto start = std::chrono::steady_clock::now();
+  Learn(nn, training_set, s, epochs);
+  const std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  cout << "Training time (s): " << elapsed.count() << '\n';
+
+  // All processes end up with the same weights, evaluated by rank 0 only
+  if (s.rank == 0) {
+    Evaluate(nn, test_set, s);
+  }
+}
+
+// Load a network from a checkpoint instead of training it, output the time
+// taken and evaluate it on the test set. The layers are those recorded by the
+// checkpoint, regardless of --hidden
+template <typename T>
+static void Load(const Settings& s)
+{
+  const MnistDataset test_set{DataFile(s.path, kTestSetImageFile).c_str(),
+                              DataFile(s.path, kTestSetLabelFile).c_str()};
+
+  const auto start = std::chrono::steady_clock::now();
+  vector<int> layers;
+  {
+    const Checkpoint checkpoint{s.load.c_str()};
+    for (int l = 0; l != checkpoint.NumLayers(); ++l) {
+      layers.push_back(checkpoint.LayerSize(l));
+    }
+  }
+  NeuralNet<T> nn{s.threads, s.sigmoid, s.batch_size, layers};
+  nn.Load(s.load.c_str());
+  const std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - start;
+  cout << "Load time (ms): " << elapsed.count() << '\n';
+
+  Evaluate(nn, test_set, s);
+}
+
+// Add the time taken to read the data sets since a given start to the
+// telemetry, if any
+static void RecordRead(const Settings& s,
+    const std::chrono::steady_clock::time_point start)
+{
+  if (s.telemetry != nullptr) {
+    s.telemetry->AddTime(Telemetry::kRead,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+  }
+}
+
+// Train a network with weights of type T on the MNIST training set, either
+// read from a cache, streamed from disk or mapped directly, and evaluate it on
+// the test set, unless loading it from a checkpoint instead
+template <typename T>
+static void Run(const Settings& s)
+{
+  const string& path = s.path;
+  const auto start = std::chrono::steady_clock::now();
+  if (!s.load.empty()) {
+    Load<T>(s);
+  } else if (s.cache) {
+    // Map the preconverted training- and test set into memory
+    const CachedDataset<T> training_set{CreateCache<T>(path,
+        kTrainingSetImageFile, kTrainingSetLabelFile,
+        kTrainingSetCacheFile, s.comm).c_str()};
+    const CachedDataset<T> test_set{CreateCache<T>(path, kTestSetImageFile,
+        kTestSetLabelFile, kTestSetCacheFile, s.comm).c_str()};
+    RecordRead(s, start);
+    Train<T>(training_set, test_set, s);
+  } else if (s.stream) {
+    // Stream the training set from disk, and map the test set into memory
+    IdxStream training_set{DataFile(path, kTrainingSetImageFile).c_str(),
+                           DataFile(path, kTrainingSetLabelFile).c_str(),
+                           s.shuffle_buffer};
+    const MnistDataset test_set{DataFile(path, kTestSetImageFile).c_str(),
+                                DataFile(path, kTestSetLabelFile).c_str()};
+    RecordRead(s, start);
+    Train<T>(training_set, test_set, s);
+  } else {
+    // Map the training- and test set images and labels into memory
+    const MnistDataset training_set{
+        DataFile(path, kTrainingSetImageFile).c_str(),
+        DataFile(path, kTrainingSetLabelFile).c_str()};
+    const MnistDataset test_set{DataFile(path, kTestSetImageFile).c_str(),
+                                DataFile(path, kTestSetLabelFile).c_str()};
+    RecordRead(s, start);
+    Train<T>(training_set, test_set, s);
+  }
+}
+
 int main(int argc, char *argv[])
 {
+  Settings s;
+
   // Set path to MNIST data files
-  string path;
-  if (argc == 2) {
-    path = argv[1];
-  } else {
+  const Options options = ParseOptions(argc, argv, s.path);
+  if (s.path.empty()) {
     cout << "Absolute path to MNIST data files: ";
-    cin >> path;
+    cin >> s.path;
     cin.get();
   }
 
-  // Set learning rate
-  const double rate = ReadValue("Learning rate (default 0.015): ", 0.015);
+  // Evaluate a network loaded from a checkpoint (--load=FILE), rather than
+  // training one
+  s.load = GetOption<string>(options, "load", "");
 
-  // Set regularization parameter
-  const double reg = ReadValue("Regularization param (default 0.095): ", 0.095);
+  s.rate = 0;
+  s.reg = 0;
+  s.epochs = 0;
+  if (s.load.empty()) {
+    // Set learning rate
+    s.rate = ReadValue("Learning rate (default 0.015): ", 0.015);
 
-  // Set no. of epochs
-  const int epochs = ReadValue("No. of epochs (default 20): ", 20);
+    // Set regularization parameter
+    s.reg = ReadValue("Regularization param (default 0.095): ", 0.095);
+
+    // Set no. of epochs
+    s.epochs = ReadValue("No. of epochs (default 20): ", 20);
+  }
+
+  // Set no. of threads used for training and evaluation
+  s.threads = GetOption(options, "threads", 1);
+
+  // Set no. of samples per batch (--batch-size=N), or tune it on the host
+  // (--batch-size=auto) for the highest throughput reaching a given accuracy
+  // (--target-accuracy=P) after a single epoch
+  s.batch_size = NeuralNet<double>::kDefaultBatchSz;
+  s.autotune = options.count("batch-size") != 0
+            && options.at("batch-size") == "auto";
+  if (!s.autotune) {
+    s.batch_size = GetOption(options, "batch-size", s.batch_size);
+    if (s.batch_size < 1) {
+      cout << "Invalid value for --batch-size. Using "
+           << NeuralNet<double>::kDefaultBatchSz << ".\n";
+      s.batch_size = NeuralNet<double>::kDefaultBatchSz;
+    }
+  }
+  s.target_accuracy = GetOption(options, "target-accuracy", -1.0);
 
-  // Training set
-  Mat<uint8_t> training_set(kTrainingSetSz, kImageSz + 1);
+  // Set the number of units of each hidden layer (--hidden=N[,N...])
+  const string default_hidden =
+    std::to_string(NeuralNet<double>::kDefaultHiddenSz);
+  s.layers = ParseLayers(GetOption(options, "hidden", default_hidden));
+  if (s.layers.empty()) {
+    cout << "Invalid value for --hidden. Using " << default_hidden << ".\n";
+    s.layers = ParseLayers(default_hidden);
+  }
 
-  // Parse images from the training set
-  ImageParser img_train_parser{(path + kTrainingSetImageFile).c_str()};
-  training_set.head_cols(kImageSz) = img_train_parser.Parse();
+  // Set the implementation of the sigmoid activation function
+  s.sigmoid = mnist::kSigmoidExact;
+  const string sigmoid_name = GetOption<string>(options, "sigmoid", "exact");
+  if (!mnist::ParseSigmoidMode(sigmoid_name, s.sigmoid)) {
+    cout << "Invalid value for --sigmoid. Using exact.\n";
+  }
 
-  // Parse labels from the training set
-  LabelParser lab_train_parser{(path + kTrainingSetLabelFile).c_str()};
-  training_set.tail_cols(1) = lab_train_parser.Parse();
+  // Set the optimizer applying the gradients (--optimizer=NAME), and the
+  // momentum of those keeping one (--momentum=X)
+  s.optimizer = mnist::kDefaultOptimizer;
+  const string optimizer_name = GetOption<string>(options, "optimizer", "sgd");
+  if (!mnist::ParseOptimizer(optimizer_name, s.optimizer.kind)) {
+    cout << "Invalid value for --optimizer. Using sgd.\n";
+  }
+  s.optimizer.momentum = GetOption(options, "momentum",
+      mnist::kDefaultOptimizer.momentum);
+  if (s.optimizer.momentum < 0 || s.optimizer.momentum >= 1) {
+    cout << "Invalid value for --momentum. Using "
+         << mnist::kDefaultOptimizer.momentum << ".\n";
+    s.optimizer.momentum = mnist::kDefaultOptimizer.momentum;
+  }
 
-  // Test set
-  Mat<uint8_t> test_set(kTestSetSz, kImageSz + 1);
+  // Use asynchronous (Hogwild-style) instead of synchronous training
+  s.hogwild = options.count("hogwild") != 0;
 
-  // Parse images from the test set
-  ImageParser img_test_parser{(path + kTestSetImageFile).c_str()};
-  test_set.head_cols(kImageSz) = img_test_parser.Parse();
+  // Hold out the last N samples of the training set for validation after each
+  // epoch (--validation=N), stopping once the accuracy has not improved for a
+  // given number of epochs (--patience=K), K + 1 epochs after the best as it
+  // is only known after the next, and keeping the best weights
+  s.validation = std::max(0, GetOption(options, "validation", 0));
+  s.patience = GetOption(options, "patience", kDefaultPatience);
+  if (s.patience < 1) {
+    cout << "Invalid value for --patience. Using " << kDefaultPatience
+         << ".\n";
+    s.patience = kDefaultPatience;
+  }
 
-  // Parse labels from the test set
-  LabelParser lab_test_parser{(path + kTestSetLabelFile).c_str()};
-  test_set.tail_cols(1) = lab_test_parser.Parse();
+  // Seed the random number generator used for initializing the weights and
+  // shuffling the training set
+  if (options.count("seed") != 0) {
+    arma::arma_rng::set_seed(GetOption(options, "seed", 0u));
+  }
 
-  // Create neural network
-  NeuralNet nn{};
+  // Read features from a preconverted cache (--cache), or stream the training
+  // set from disk through a shuffle buffer of a given number of samples
+  // (--stream[=N]), and train in single instead of double precision (--float)
+  s.cache = options.count("cache") != 0;
+  s.stream = options.count("stream") != 0;
+  s.shuffle_buffer = kDefaultShuffleBufferSz;
+  if (s.stream && !options.at("stream").empty()) {
+    s.shuffle_buffer = GetOption(options, "stream", kDefaultShuffleBufferSz);
+  }
+  const bool single = options.count("float") != 0;
 
-  // Learn weights from training set and output cost
-  nn.LearnWeights(training_set, rate, reg, epochs);
+  // Additionally evaluate an int8 quantization of the trained network
+  s.quantize = options.count("quantize") != 0;
 
-  // Evaluate test set and output cost
-  cout << nn.Evaluate(test_set) << '\n';
+  // Randomly distort the training images in each epoch, either only by affine
+  // transformations (--augment=affine) or elastically as well (--augment or
+  // --augment=elastic), on a given number of threads (--augment-threads=N)
+  s.augment = options.count("augment") != 0;
+  s.distortions = mnist::kDefaultDistortions;
+  if (s.augment && options.at("augment") == "affine") {
+    s.distortions.elastic_alpha = 0;
+  } else if (s.augment && !options.at("augment").empty()
+      && options.at("augment") != "elastic") {
+    cout << "Invalid value for --augment. Using elastic.\n";
+  }
+  s.augment_threads = GetOption(options, "augment-threads",
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency())));
+
+  // Write a checkpoint after training (--checkpoint=FILE) and optionally after
+  // every N epochs (--checkpoint-every=N), resuming from it if it exists
+  // (--resume)
+  s.checkpoint = GetOption<string>(options, "checkpoint", "");
+  s.checkpoint_interval = GetOption(options, "checkpoint-every", 0);
+  s.resume = options.count("resume") != 0;
+  if (s.resume && s.checkpoint.empty()) {
+    cout << "Ignoring --resume without --checkpoint.\n";
+  }
+
+  // Output the duration, throughput and loss of each epoch and a summary of
+  // where the time went (--telemetry), additionally writing a line of JSON for
+  // each epoch to a file (--telemetry=FILE)
+  ofstream telemetry_file;
+  if (options.count("telemetry") != 0 && !options.at("telemetry").empty()) {
+    telemetry_file.open(options.at("telemetry"));
+    if (!telemetry_file) {
+      cout << "Could not open " << options.at("telemetry") << ".\n";
+    }
+  }
+  Telemetry telemetry{&cout,
+      telemetry_file.is_open() ? &telemetry_file : nullptr};
+  s.telemetry = options.count("telemetry") != 0 ? &telemetry : nullptr;
+
+  // Distribute training over a number of processes (--world-size=N), each
+  // started with its own rank from 0 (--rank=R), which exchange gradients over
+  // shared memory (--transport=shm) or TCP on the loopback device
+  // (--transport=tcp) on ports from a given one up (--port=P). The options may
+  // instead be given by the environment variables MNIST_WORLD_SIZE, MNIST_RANK,
+  // MNIST_TRANSPORT and MNIST_PORT
+  s.world_size = GetOption(options, "world-size", "MNIST_WORLD_SIZE", 1);
+  if (s.world_size < 1) {
+    cout << "Invalid value for --world-size. Using 1.\n";
+    s.world_size = 1;
+  }
+  s.rank = GetOption(options, "rank", "MNIST_RANK", 0);
+  if (s.rank < 0 || s.rank >= s.world_size) {
+    cout << "Invalid value for --rank.\n";
+    return 1;
+  }
+  mnist::TransportKind transport = mnist::kTransportShm;
+  const string transport_name = GetOption<string>(options, "transport",
+      "MNIST_TRANSPORT", "shm");
+  if (!mnist::ParseTransport(transport_name, transport)) {
+    cout << "Invalid value for --transport. Using shm.\n";
+  }
+  const int port = GetOption(options, "port", "MNIST_PORT", kDefaultPort);
+  std::unique_ptr<Communicator> comm;
+  if (s.world_size > 1 && s.load.empty()) {
+    if (s.hogwild) {
+      cout << "Ignoring --hogwild when distributed.\n";
+      s.hogwild = false;
+    }
+    if (s.autotune) {
+      cout << "Ignoring --batch-size=auto when distributed.\n";
+      s.autotune = false;
+    }
+    comm.reset(new Communicator{s.rank, s.world_size,
+        mnist::MakeTransport(transport, s.rank, s.world_size, port)});
+  }
+  s.comm = comm.get();
+
+  if (single) {
+    Run<float>(s);
+  } else {
+    Run<double>(s);
+  }
+  if (s.telemetry != nullptr) {
+    telemetry.Summary(cout);
+  }
 
   return 0;
 }
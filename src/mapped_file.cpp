@@ -0,0 +1,71 @@
+/**
+ * @file
+ * @brief Implementation of read-only memory-mapped files.
+ * @author Arno Bastenhof
+ */
+
+#include "mapped_file.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <string>
+
+using std::runtime_error;
+using std::string;
+
+namespace mnist {
+
+/**
+ * @brief Constructor that maps a file into memory for reading.
+ *
+ * The mapping is shared, so that the page cache backing it is shared by all
+ * processes on the same host mapping the same file.
+ *
+ * @param[in] filename The full path of the file.
+ */
+MappedFile::MappedFile(const char * filename)
+  : data_(nullptr), size_(0)
+{
+  const int fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    throw runtime_error{string("File not found: ") + filename};
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    throw runtime_error{string("Could not stat file: ") + filename};
+  }
+  size_ = st.st_size;
+
+  // mmap rejects empty mappings, in which case data_ remains null
+  if (size_ != 0) {
+    void * addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      close(fd);
+      throw runtime_error{string("Could not map file: ") + filename};
+    }
+    data_ = static_cast<uint8_t *>(addr);
+
+    // The whole file is about to be read, so start paging it in right away
+    madvise(addr, size_, MADV_WILLNEED);
+  }
+
+  // The mapping stays valid after the file descriptor is closed
+  close(fd);
+}
+
+/**
+ * @brief Destructor that unmaps the file.
+ */
+MappedFile::~MappedFile()
+{
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+}
+
+} // namespace mnist
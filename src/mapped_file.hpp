@@ -0,0 +1,47 @@
+/**
+ * @file
+ * @brief Interface for read-only memory-mapped files.
+ * @author Arno Bastenhof
+ */
+
+#ifndef MAPPED_FILE_HPP_
+#define MAPPED_FILE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mnist {
+
+class MappedFile {
+public:
+  explicit          MappedFile(const char *);
+                    MappedFile(const MappedFile&) = delete;
+                    MappedFile(MappedFile&&) = delete;
+                    ~MappedFile();
+  MappedFile&       operator=(const MappedFile&) = delete;
+  const uint8_t *   Data() const;
+  std::size_t       Size() const;
+private:
+  uint8_t *         data_;          // start of the mapping (or nullptr)
+  std::size_t       size_;          // size of the file in bytes
+};
+
+/**
+ * @brief Returns a pointer to the first byte of the mapped file.
+ */
+inline const uint8_t * MappedFile::Data() const
+{
+  return data_;
+}
+
+/**
+ * @brief Returns the size of the mapped file in bytes.
+ */
+inline std::size_t MappedFile::Size() const
+{
+  return size_;
+}
+
+} // namespace mnist
+
+#endif // MAPPED_FILE_HPP_
@@ -0,0 +1,66 @@
+/**
+ * @file
+ * @brief Implementation of memory-mapped MNIST data sets.
+ * @author Arno Bastenhof
+ */
+
+#include "mnist_dataset.hpp"
+
+#include <stdexcept>
+
+using std::runtime_error;
+
+namespace mnist {
+
+/**
+ * @brief Constructor that maps an image- and a label file into memory.
+ *
+ * Both file headers and the labels are validated, after which the images and labels are
+ * exposed as views over the mapped files, without copying or transposing.
+ * Gzip-compressed files are decompressed into memory first.
+ *
+ * @param[in] img_filename The full path of the image file.
+ * @param[in] lab_filename The full path of the label file.
+ */
+MnistDataset::MnistDataset(const char * img_filename,
+    const char * lab_filename)
+  : img_file_{img_filename}
+  , lab_file_{lab_filename}
+  , num_items_(NumItems(img_file_, lab_file_))
+  , images_(const_cast<uint8_t *>(img_file_.Data()) + kHeaderSizeImageFile,
+      kImageSize, num_items_, false, true)
+  , labels_(const_cast<uint8_t *>(lab_file_.Data()) + kHeaderSizeLabelFile,
+      num_items_, false, true)
+{
+}
+
+// Validates the headers and sizes of the mapped files and returns the number
+// of items they contain
+int MnistDataset::NumItems(const IdxFile& img_file,
+    const IdxFile& lab_file)
+{
+  if (img_file.Size() < kHeaderSizeImageFile) {
+    throw runtime_error{"Could not read image file header."};
+  }
+  if (lab_file.Size() < kHeaderSizeLabelFile) {
+    throw runtime_error{"Could not read label file header."};
+  }
+  const int num_items = ValidateImageHeader(img_file.Data());
+  if (ValidateLabelHeader(lab_file.Data()) != num_items) {
+    throw runtime_error{"Numbers of images and labels differ."};
+  }
+
+  // Ensure the views taken by the constructor lie within the mapped files
+  if (img_file.Size() - kHeaderSizeImageFile
+      < static_cast<std::size_t>(num_items) * kImageSize) {
+    throw runtime_error{"Could not read images."};
+  }
+  if (lab_file.Size() - kHeaderSizeLabelFile
+      < static_cast<std::size_t>(num_items)) {
+    throw runtime_error{"Could not read labels."};
+  }
+  ValidateLabels(lab_file.Data() + kHeaderSizeLabelFile, num_items);
+  return num_items;
+}
+
+} // namespace mnist
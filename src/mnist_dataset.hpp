@@ -0,0 +1,68 @@
+/**
+ * @file
+ * @brief Interface for memory-mapped MNIST data sets.
+ * @author Arno Bastenhof
+ */
+
+#ifndef MNIST_DATASET_HPP_
+#define MNIST_DATASET_HPP_
+
+#include <armadillo>
+
+#include "idx_file.hpp"
+#include "mnist_parser.hpp"
+
+namespace mnist {
+
+class MnistDataset : public MnistFormat {
+public:
+                            MnistDataset(const char *, const char *);
+                            MnistDataset(const MnistDataset&) = delete;
+                            MnistDataset(MnistDataset&&) = delete;
+  MnistDataset&             operator=(const MnistDataset&) = delete;
+  const arma::Mat<uint8_t>& Images() const;
+  const arma::Col<uint8_t>& Labels() const;
+  int                       Size() const;
+private:
+  IdxFile                   img_file_;
+  IdxFile                   lab_file_;
+  const int                 num_items_;
+  const arma::Mat<uint8_t>  images_;  // views over img_file_ and lab_file_
+  const arma::Col<uint8_t>  labels_;
+  static int                NumItems(const IdxFile&, const IdxFile&);
+};
+
+/**
+ * @brief Returns the images as a read-only 784 x n matrix.
+ *
+ * Each column holds one image, reshaped row-wise into an array of 784 bytes,
+ * which is exactly the layout of the image file's body. The matrix is a view
+ * directly over the mapped (or decompressed) file and does not own its memory.
+ */
+inline const arma::Mat<uint8_t>& MnistDataset::Images() const
+{
+  return images_;
+}
+
+/**
+ * @brief Returns the labels as a read-only column vector of length n.
+ *
+ * The vector is a view directly over the mapped (or decompressed) file and
+ * does not own its memory.
+ */
+inline const arma::Col<uint8_t>& MnistDataset::Labels() const
+{
+  return labels_;
+}
+
+/**
+ * @brief Returns the number of images (and labels) in the data set.
+ */
+inline int MnistDataset::Size() const
+{
+  return num_items_;
+}
+
+} // namespace mnist
+
+#endif // MNIST_DATASET_HPP_
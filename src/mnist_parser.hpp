@@ -7,6 +7,7 @@
 #ifndef MNIST_PARSER_HPP_
 #define MNIST_PARSER_HPP_
 
+#include <cstddef>
 #include <cstdint>
 #include <fstream>
 #include <stdexcept>
@@ -14,8 +15,29 @@
 
 namespace mnist {
 
+/**
+ * @brief Constants and header validation shared by all readers of the MNIST
+ *        (IDX) file formats.
+ */
+class MnistFormat {
+public:
+  /** @brief Constants used in the definitions of the MNIST file formats.*/
+  enum {
+    kMagicNumberLabelFile = 0x801, /**< @brief Label file magic number. */
+    kMagicNumberImageFile = 0x803, /**< @brief Image file magic number. */
+    kHeaderSizeLabelFile = 8,      /**< @brief Label file header size. */
+    kHeaderSizeImageFile = 16,     /**< @brief Image file header size. */
+    kImageSize = 784,              /**< @brief Image size (24 x 24 pixels) */
+    kNumLabels = 10                /**< @brief Number of digits (0 to 9). */
+  };
+  static int     ReadBigEndianInt32(const uint8_t *);
+  static int     ValidateImageHeader(const uint8_t *);
+  static int     ValidateLabelHeader(const uint8_t *);
+  static void    ValidateLabels(const uint8_t *, const std::size_t);
+};
+
 template <typename T>
-class MnistParser {
+class MnistParser : public MnistFormat {
 public:
                  MnistParser(const MnistParser&) = delete;
                  MnistParser(MnistParser&&) = delete;
@@ -24,20 +46,87 @@ public:
   bool           IsDone() const;
   virtual T      Parse() = 0;      /**< @brief Parses the input file. */
 protected:
-  /** @brief Constants used in the definitions of the MNIST file formats.*/
-  enum {
-    kMagicNumberLabelFile = 0x801, /**< @brief Label file magic number. */
-    kMagicNumberImageFile = 0x803, /**< @brief Image file magic number. */
-    kHeaderSizeLabelFile = 8,      /**< @brief Label file header size. */
-    kHeaderSizeImageFile = 16,     /**< @brief Image file header size. */
-    kImageSize = 784               /**< @brief Image size (24 x 24 pixels) */
-  };
   explicit       MnistParser(const char *);
-  static int     ReadBigEndianInt32(const uint8_t *);
   std::ifstream  file_;            /**< @brief The input file stream. */
   int            num_items_;       /**< @brief No. of labels or images. */
 };
 
+/**
+ * @brief Convenience method for reading integers from the input file.
+ *
+ * Reads and returns a 32-bit integer from its representation by a byte array
+ * in Big Endian order.
+ */
+inline int MnistFormat::ReadBigEndianInt32(const uint8_t * bytes)
+{
+  return static_cast<int>(static_cast<uint32_t>(bytes[0]) << 24
+      | static_cast<uint32_t>(bytes[1]) << 16
+      | static_cast<uint32_t>(bytes[2]) << 8 | bytes[3]);
+}
+
+/**
+ * @brief Validates the header of an image file.
+ * @param[in] header The first kHeaderSizeImageFile bytes of the image file.
+ * @return The number of images contained in the file.
+ */
+inline int MnistFormat::ValidateImageHeader(const uint8_t * header)
+{
+  // Validate magic number
+  if (ReadBigEndianInt32(header) != kMagicNumberImageFile) {
+    throw std::runtime_error{"Unexpected magic number for image file."};
+  }
+
+  // Validate numbers of images and of rows and columns per image, the latter
+  // multiplied in 64 bits so that no header can overflow their product
+  const int num_items = ReadBigEndianInt32(header + 4);
+  const int num_row   = ReadBigEndianInt32(header + 8);
+  const int num_col   = ReadBigEndianInt32(header + 12);
+  if (num_items < 0 || num_row < 0 || num_col < 0
+      || static_cast<int64_t>(num_row) * num_col != kImageSize) {
+    throw std::runtime_error{"Unexpected dimensions in image file header."};
+  }
+  return num_items;
+}
+
+/**
+ * @brief Validates the header of a label file.
+ * @param[in] header The first kHeaderSizeLabelFile bytes of the label file.
+ * @return The number of labels contained in the file.
+ */
+inline int MnistFormat::ValidateLabelHeader(const uint8_t * header)
+{
+  // Validate magic number
+  if (ReadBigEndianInt32(header) != kMagicNumberLabelFile) {
+    throw std::runtime_error{"Unexpected magic number for label file."};
+  }
+
+  // Validate number of labels
+  const int num_items = ReadBigEndianInt32(header + 4);
+  if (num_items < 0) {
+    throw std::runtime_error{"Unexpected number of labels in label file."};
+  }
+  return num_items;
+}
+
+/**
+ * @brief Validates the labels read from a label file.
+ *
+ * Labels index the output layer of a network, so that one out of range would
+ * make training read and write past the end of its buffers.
+ *
+ * @param[in] labels The labels.
+ * @param[in] n The number of labels.
+ */
+inline void MnistFormat::ValidateLabels(const uint8_t * labels,
+    const std::size_t n)
+{
+  for (std::size_t i = 0; i != n; ++i) {
+    if (labels[i] >= kNumLabels) {
+      throw std::runtime_error{"Unexpected label value."};
+    }
+  }
+}
+
 /**
  * @brief Constructor that opens a given file for reading.
  * @param[in] filename The full path of the input file.
@@ -60,18 +149,6 @@ inline bool MnistParser<T>::IsDone() const
   return num_items_ == 0;
 }
 
-/**
- * @brief Convenience method for reading integers from the input file.
- *
- * Reads and returns a 32-bit integer from its representation by a byte array
- * in Big Endian order.
- */
-template <typename T>
-inline int MnistParser<T>::ReadBigEndianInt32(const uint8_t * bytes)
-{
-  return (bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
-}
-
 } // namespace mnist
 
 #endif // MNIST_PARSER_HPP_
@@ -1,42 +1,98 @@
 /**
  * @file
- * @brief Implementation of a three-layer feedforward neural network.
+ * @brief Implementation of a multilayer feedforward neural network.
  * @author Arno Bastenhof
  */
 
 #include "neural.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <limits>
+#include <vector>
 
-// Read/write access to the tail columns of a matrix (i.e., minus the first)
-#define TAIL_COLS(m) ((m).tail_cols((m).n_cols - 1))
+#include "batch_sampler.hpp"
+#include "checkpoint.hpp"
+#include "communicator.hpp"
+#include "idx_stream.hpp"
+#include "kernels.hpp"
+#include "validator.hpp"
 
-using std::begin;
-using std::end;
 using std::runtime_error;
-using std::transform;
 
 using arma::Col;
 using arma::Mat;
-using arma::accu;
-using arma::conv_to;
-using arma::join_vert;
-using arma::mat;
-using arma::rowvec;
-using arma::shuffle;
-using arma::vec;
-using arma::vectorise;
 
-static inline arma::mat Sigmoid(const arma::mat m)
+template <typename T>
+static inline T SigmoidGrad(const T a)
 {
-  return 1.0 / (1.0 + arma::exp(-m));
+  // a assumed to be of the form Sigmoid(x)
+  return a * (1 - a);
 }
 
-static inline arma::mat SigmoidGrad(const arma::mat m)
+// Converts a batch of images into the network's element type, stored in a
+// given buffer
+template <typename T, typename eT>
+static inline const Mat<T>& Convert(const Mat<eT>& img, Mat<T>& buffer)
 {
-  // m assumed to be of the form Sigmoid(n)
-  return m % (1 - m);
+  std::copy(img.begin(), img.end(), buffer.begin());
+  return buffer;
+}
+
+// Features of the network's element type are used as is, without copying them
+template <typename T>
+static inline const Mat<T>& Convert(const Mat<T>& img, Mat<T>&)
+{
+  return img;
+}
+
+// Computes the quadratic cost of a batch of output activations (one sample per
+// column), summed over the samples with the given labels
+template <typename T>
+static inline double Loss(const Mat<T>& activ, const Col<uint8_t>& lab)
+{
+  double loss = 0;
+  for (arma::uword j = 0; j != lab.n_elem; ++j) {
+    for (arma::uword r = 0; r != activ.n_rows; ++r) {
+      const double err = activ.at(r, j) - (r == lab[j]);
+      loss += err * err;
+    }
+  }
+  return loss / 2;
+}
+
+// Gathers the images and labels of the samples with the given indices into
+// buffers for a batch, converting the images to the network's element type
+template <typename T, typename eT>
+static inline void Gather(const Mat<eT>& img, const Col<uint8_t>& lab,
+    const uint32_t * indices, const int n, T * img_out, uint8_t * lab_out)
+{
+  for (int j = 0; j != n; ++j) {
+    std::copy(img.colptr(indices[j]), img.colptr(indices[j]) + img.n_rows,
+        img_out + j * img.n_rows);
+    lab_out[j] = lab[indices[j]];
+  }
+}
+
+// Gathers the labels of the samples with the given indices into a buffer for a
+// batch, whose images are referred to by index instead
+static inline void GatherLabels(const Col<uint8_t>& lab,
+    const uint32_t * indices, const int n, uint8_t * lab_out)
+{
+  for (int j = 0; j != n; ++j) {
+    lab_out[j] = lab[indices[j]];
+  }
+}
+
+// Draws the seed for shuffling from Armadillo's random number generator, so
+// that arma_rng::set_seed makes the order of the samples reproducible as well
+// as the initial weights
+static inline uint64_t DrawSeed()
+{
+  const arma::uvec seed = arma::randi<arma::uvec>(2,
+      arma::distr_param(0, std::numeric_limits<int>::max()));
+  return static_cast<uint64_t>(seed[0]) << 32 ^ seed[1];
 }
 
 // See footnote 2, p.7 of exercise set 4 (Ng's Machine Learning @ Coursera)
@@ -47,139 +103,1089 @@ static inline double Eps(const double in_sz, const double out_sz)
 
 namespace mnist {
 
+/**
+ * @brief Constructor.
+ *
+ * Each batch is split into as many parts as there are threads, each of which
+ * is propagated by its own thread in its own workspace.
+ *
+ * @param[in] threads The number of threads to use (at most the batch size).
+ * @param[in] sigmoid How to compute the sigmoid activation function.
+ * @param[in] batch_size The number of samples per batch.
+ * @param[in] layers The number of units of each layer, from the input layer
+ *            (one per pixel) to the output layer (one per class).
+ */
+template <typename T>
+NeuralNet<T>::NeuralNet(const int threads, const SigmoidMode sigmoid,
+    const int batch_size, const std::vector<int>& layers)
+  : layers_(ValidateLayers(layers))
+  , offsets_(Offsets(layers_))
+  , weights_(offsets_.back())
+  , sigmoid_(sigmoid)
+  , batch_size_(batch_size)
+  , distortions_()
+  , optimizer_(kDefaultOptimizer)
+  , first_moments_()
+  , second_moments_()
+  , steps_{0}
+  , augment_threads_(0)
+  , checkpoint_interval_(0)
+  , checkpoint_epochs_(0)
+  , epochs_(0)
+  , resume_(false)
+  , telemetry_(nullptr)
+  , comm_(nullptr)
+  , pool_(std::max(1, std::min<int>(threads, batch_size)))
+{
+  if (batch_size < 1) {
+    throw runtime_error{"Batch size must be positive."};
+  }
+  const int num = pool_.Size();
+  workspaces_.reserve(num);
+  for (int i = 0; i != num; ++i) {
+    workspaces_.emplace_back(*this, (batch_size + num - 1) / num);
+    grads_.push_back(workspaces_.back().grads.memptr());
+  }
+}
+
+/**
+ * @brief Enables random distortion of the training samples in subsequent
+ *        training.
+ *
+ * Each batch is distorted anew when it is prepared, so that no epoch sees the
+ * same images, without storing any of them. When training synchronously, this
+ * happens on the background thread preparing the batches, which spreads the
+ * images of each batch over a pool of threads of its own. When training
+ * asynchronously, each thread distorts its own batches instead.
+ *
+ * @param[in] distortions The ranges of the distortions.
+ * @param[in] threads The number of threads to distort each batch with when
+ *            training synchronously.
+ */
+template <typename T>
+void NeuralNet<T>::Augment(const Distortions& distortions, const int threads)
+{
+  distortions_ = distortions;
+  augment_threads_ = std::max(1, threads);
+}
+
+/**
+ * @brief Sets the optimizer applying the gradients of each batch to the
+ *        weights in subsequent training.
+ *
+ * The moments kept by the optimizer start at zero whenever training starts,
+ * including when resuming from a checkpoint, which only holds the weights.
+ * When training asynchronously, the threads update the moments without
+ * locking, as they do the weights.
+ *
+ * @param[in] optimizer The optimizer and its hyperparameters.
+ */
+template <typename T>
+void NeuralNet<T>::SetOptimizer(const Optimizer& optimizer)
+{
+  if (optimizer.momentum < 0 || optimizer.momentum >= 1
+      || optimizer.decay < 0 || optimizer.decay >= 1
+      || optimizer.epsilon <= 0) {
+    throw runtime_error{"Invalid optimizer hyperparameters."};
+  }
+  optimizer_ = optimizer;
+}
+
+/**
+ * @brief Enables checkpointing of the network parameters in subsequent
+ *        training.
+ *
+ * A checkpoint is written after training, and when training synchronously
+ * optionally also after every given number of epochs. Each checkpoint replaces
+ * the previous one.
+ *
+ * @param[in] filename The full path of the checkpoint file.
+ * @param[in] interval The number of epochs between checkpoints, or 0 to only
+ *            write one after training.
+ */
+template <typename T>
+void NeuralNet<T>::SetCheckpoint(const std::string& filename,
+    const int interval)
+{
+  checkpoint_file_ = filename;
+  checkpoint_interval_ = std::max(0, interval);
+}
+
+/**
+ * @brief Writes the network parameters to a checkpoint file.
+ * @param[in] filename The full path of the checkpoint file.
+ */
+template <typename T>
+void NeuralNet<T>::Save(const char * filename) const
+{
+  const std::vector<uint32_t> layer_sizes(layers_.begin(), layers_.end());
+  WriteCheckpoint(weights_.memptr(), NumWeights(), layer_sizes.data(),
+      layer_sizes.size(), epochs_, filename);
+}
+
+/**
+ * @brief Reads the network parameters from a checkpoint file.
+ *
+ * The file is mapped into memory and its weights copied, converting them if
+ * they were saved in the other precision. The network can be used for
+ * classification right away, and the next call to LearnWeights or
+ * LearnWeightsAsync resumes training from the loaded weights rather than
+ * initializing them randomly.
+ *
+ * @param[in] filename The full path of the checkpoint file.
+ */
+template <typename T>
+void NeuralNet<T>::Load(const char * filename)
+{
+  const Checkpoint checkpoint{filename};
+  bool match = checkpoint.NumLayers() == static_cast<int>(layers_.size())
+      && checkpoint.NumWeights() == NumWeights();
+  for (int l = 0; match && l != checkpoint.NumLayers(); ++l) {
+    match = checkpoint.LayerSize(l) == layers_[l];
+  }
+  if (!match) {
+    throw runtime_error{"Checkpoint does not match the network's layers."};
+  }
+  checkpoint.ReadWeights(weights_.memptr());
+  epochs_ = checkpoint.Epochs();
+  resume_ = true;
+}
+
+/**
+ * @brief Instruments subsequent training, timing its phases and counting its
+ *        samples and loss per epoch.
+ * @param[in] telemetry The Telemetry to record to, which must outlive the
+ *            training, or nullptr to stop instrumenting.
+ */
+template <typename T>
+void NeuralNet<T>::Instrument(Telemetry * telemetry)
+{
+  telemetry_ = telemetry;
+}
+
+/**
+ * @brief Distributes subsequent synchronous training over the processes of a
+ *        communicator, or stops doing so.
+ *
+ * Each process runs the same training, on the same data set, with the same
+ * number of threads and the same batch size. Every batch is split into as
+ * many parts as there are threads in all processes, each of which propagates
+ * its own parts only, after which the gradients are summed across the
+ * processes and each applies them to its own copy of the weights. All start
+ * from the initial weights and the seeds of rank 0, so that the results are
+ * the same as those of a single process with as many threads as all of them
+ * together. Asynchronous training cannot be distributed.
+ *
+ * @param[in] comm The Communicator to synchronize with, which must outlive
+ *            the training, or nullptr to train alone.
+ */
+template <typename T>
+void NeuralNet<T>::Distribute(Communicator * comm)
+{
+  if (comm != nullptr) {
+    if (comm->WorldSize() * pool_.Size() > batch_size_) {
+      throw runtime_error{"More threads in all processes than samples per "
+                          "batch."};
+    }
+    uint64_t shape[] = { static_cast<uint64_t>(pool_.Size()),
+                         static_cast<uint64_t>(batch_size_), NumWeights() };
+    const uint64_t expected[] = { shape[0], shape[1], shape[2] };
+    comm->Broadcast(shape, sizeof shape);
+    if (!std::equal(shape, shape + 3, expected)) {
+      throw runtime_error{"Threads, batch size or layers differ from rank 0."};
+    }
+    reduced_.set_size(NumWeights());
+  } else {
+    reduced_.reset();
+  }
+  comm_ = comm;
+}
+
+/**
+ * @brief Returns the size in bytes of the memory each thread works on when
+ *        propagating its part of a batch, i.e. its inputs and workspace along
+ *        with the weights.
+ */
+template <typename T>
+std::size_t NeuralNet<T>::WorkspaceSize() const
+{
+  const std::size_t capacity = workspaces_.front().labels.n_rows;
+  std::size_t units = 0;
+  for (std::size_t l = 1; l != layers_.size(); ++l) {
+    units += layers_[l];
+  }
+  return sizeof(T) * (2 * NumWeights() + capacity * (kInputLayerSz
+      + 2 * units));
+}
+
 /**
  * @brief Applies mini-batch gradient descent to learn the network parameters.
- * @param[in] data The input data, incl. labels (placed in the last column).
+ *
+ * The samples are shuffled anew for each epoch, and need not be a multiple of
+ * the batch size, in which case each epoch ends with a partial batch. The
+ * gradients for each batch are computed in parallel and summed in a fixed
+ * order, so that the results only depend on the number of threads and the
+ * random seed, not on their scheduling.
+ *
+ * If given a validator, a snapshot of the weights is submitted to it after
+ * each epoch, and training stops early once it says so. The weights of the
+ * most accurate snapshot are then kept after training, and written to the
+ * checkpoint if checkpointing.
+ *
+ * If distributed, each process only gathers the samples of its own parts of
+ * each batch.
+ *
+ * @param[in] img The input images, one per column.
+ * @param[in] lab The labels of the input images.
  * @param[in] rate The learning rate.
  * @param[in] reg The regularization parameter.
- * @param[in] epochs The number of full iterations to run over the input data.
+ * @param[in] epochs The maximum number of full iterations to run over the
+ *            input data.
+ * @param[in,out] validator The validator, or nullptr for none.
+ */
+template <typename T>
+template <typename eT>
+void NeuralNet<T>::LearnWeights(const Mat<eT>& img, const Col<uint8_t>& lab,
+    const double rate, const double reg, int epochs, Validator<T> * validator)
+{
+  ValidateSize(img, lab);
+
+  // Randomly initialize weights, unless resuming from a checkpoint
+  StartTraining();
+
+  // Batches are numbered consecutively across epochs, and gathered into buffers
+  // of the network's element type on a background thread, while the preceding
+  // ones are being propagated. Only the producer uses the sampler. Sparse
+  // images are compressed up front instead, leaving only the sample indices
+  // and labels to be gathered
+  BatchSampler sampler{img.n_cols, batch_size_, DrawSharedSeed()};
+  const unsigned long num_batches = sampler.NumBatches();
+  const std::unique_ptr<Augmenter<T>> augmenter =
+    MakeAugmenter(augment_threads_);
+  const std::unique_ptr<SparseImages<T>> sparse = MakeSparse(img);
+  const auto produce = [&](const unsigned long index, Batch& batch){
+    const ScopedTimer timer{telemetry_, Telemetry::kPrepare};
+    if (index % num_batches == 0) {
+      sampler.Shuffle(index / num_batches);
+    }
+    batch.size = sampler.BatchSize(index % num_batches);
+    const int first = FirstPart() * batch.size / NumParts();
+    const int n = (FirstPart() + pool_.Size()) * batch.size / NumParts()
+        - first;
+    const uint32_t * samples = sampler.Batch(index % num_batches) + first;
+    if (sparse) {
+      std::copy(samples, samples + n, batch.samples.begin() + first);
+      GatherLabels(lab, samples, n, batch.lab.memptr() + first);
+      return;
+    }
+    Gather(img, lab, samples, n, batch.img.colptr(first),
+        batch.lab.memptr() + first);
+    if (augmenter) {
+      augmenter->Apply(batch.img.colptr(first), n, index, first);
+    }
+  };
+  BatchPrefetcher<T> prefetcher{sparse ? 0 : kInputLayerSz, batch_size_,
+      kPrefetchDepth, epochs * num_batches, produce};
+  TrainBatches(prefetcher, sparse.get(), validator, epochs * num_batches,
+      num_batches, rate, reg);
+  if (validator != nullptr) {
+    RestoreBest(*validator);
+  }
+  FinishTraining();
+}
+
+/**
+ * @brief Applies mini-batch gradient descent to learn the network parameters
+ *        from a training set streamed from disk.
+ *
+ * Each epoch takes a single pass over the files, drawing the samples through
+ * the stream's shuffle buffer. Otherwise the same as the in-memory overload.
+ * If distributed, each process reads all samples, but only distorts and
+ * propagates those of its own parts of each batch.
+ *
+ * @param[in] stream The training set.
+ * @param[in] rate The learning rate.
+ * @param[in] reg The regularization parameter.
+ * @param[in] epochs The number of full passes to take over the training set.
  */
-void NeuralNet::LearnWeights(const Mat<uint8_t>& data, const double rate,
-    const double reg, int epochs)
+template <typename T>
+void NeuralNet<T>::LearnWeights(IdxStream& stream, const double rate,
+    const double reg, const int epochs)
 {
-  ValidateSize(data);
+  const unsigned long num_batches =
+    (stream.Size() + batch_size_ - 1) / batch_size_;
+  if (num_batches == 0) {
+    throw runtime_error{"Unexpected dimensions of input data"};
+  }
 
-  // Randomly initialize weights
-  InitWeights();
+  // Randomly initialize weights, unless resuming from a checkpoint
+  StartTraining();
 
-  while (epochs-- != 0) {
-    // Shuffle training examples at the start of each epoch
-    shuffle(data);
+  // Batches are read and converted on a background thread, which is the only
+  // one to use the stream
+  const uint64_t seed = DrawSharedSeed();
+  const std::unique_ptr<Augmenter<T>> augmenter =
+    MakeAugmenter(augment_threads_);
+  std::vector<uint8_t> buffer(kInputLayerSz * batch_size_);
+  const auto produce = [&](const unsigned long index, Batch& batch){
+    if (index % num_batches == 0) {
+      stream.Rewind(seed, index / num_batches);
+    }
+    batch.size = std::min<unsigned long>(batch_size_,
+        stream.Size() - index % num_batches * batch_size_);
+    {
+      const ScopedTimer timer{telemetry_, Telemetry::kRead};
+      stream.Read(batch.size, buffer.data(), batch.lab.memptr());
+    }
+    const ScopedTimer timer{telemetry_, Telemetry::kPrepare};
+    std::copy(buffer.begin(), buffer.begin() + kInputLayerSz * batch.size,
+        batch.img.begin());
+    if (augmenter) {
+      const int first = FirstPart() * batch.size / NumParts();
+      augmenter->Apply(batch.img.colptr(first),
+          (FirstPart() + pool_.Size()) * batch.size / NumParts() - first,
+          index, first);
+    }
+  };
+  BatchPrefetcher<T> prefetcher{kInputLayerSz, batch_size_, kPrefetchDepth,
+      epochs * num_batches, produce};
+  TrainBatches(prefetcher, nullptr, nullptr, epochs * num_batches,
+      num_batches, rate, reg);
+  FinishTraining();
+}
 
-    // Separate the images from the labels
-    const auto img = data.head_cols(kInputLayerSz);
-    const auto lab = data.tail_cols(1);
+/**
+ * @brief Applies asynchronous (Hogwild-style) mini-batch gradient descent to
+ *        learn the network parameters.
+ *
+ * Each thread draws whole batches from a partition of the samples of its own,
+ * shuffled anew for each epoch, computes their gradients in a workspace of its
+ * own and applies them to the shared weights without any locking. Reading
+ * weights while other threads update them is a deliberate, benign race: each
+ * update is small and sparse in effect, and aligned 64-bit accesses do not
+ * tear on the supported platforms. Results are consequently not reproducible
+ * between runs. Cannot be distributed (see Distribute).
+ *
+ * @param[in] img The input images, one per column.
+ * @param[in] lab The labels of the input images.
+ * @param[in] rate The learning rate.
+ * @param[in] reg The regularization parameter.
+ * @param[in] epochs The number of full iterations to run over the input data.
+ */
+template <typename T>
+template <typename eT>
+void NeuralNet<T>::LearnWeightsAsync(const Mat<eT>& img,
+    const Col<uint8_t>& lab, const double rate, const double reg,
+    const int epochs)
+{
+  ValidateSize(img, lab);
+  if (comm_ != nullptr) {
+    throw runtime_error{"Asynchronous training cannot be distributed."};
+  }
+
+  // Randomly initialize weights, unless resuming from a checkpoint
+  StartTraining();
 
-    // Run forward- and backward propagation on each single training example
-    // and update the weights accordingly
-    for (unsigned int i = 0; i != img.n_rows; i += kBatchSz) {
-      ForwardProp(img.rows(i, i + kBatchSz - 1));
-      const auto grads = BackProp(lab.rows(i, i + kBatchSz - 1), reg);
-      weights_ -= rate * grads;
+  // Each thread propagates whole batches
+  std::vector<Workspace> workspaces(pool_.Size(), Workspace{*this,
+      batch_size_});
+  const uint64_t seed = DrawSeed();
+  const std::unique_ptr<Augmenter<T>> augmenter = MakeAugmenter(1);
+  const std::unique_ptr<SparseImages<T>> sparse = MakeSparse(img);
+
+  // Rather than claiming batches from a shared counter, each thread shuffles
+  // and draws from a partition of its own, so that reshuffling for the next
+  // epoch needs no coordination with threads still finishing the last one
+  pool_.Run([&](const int t){
+    Workspace& ws = workspaces[t];
+    BatchSampler sampler{img.n_cols, batch_size_, seed, t, pool_.Size()};
+    unsigned long index = t;                // unique among all threads
+    for (int epoch = 0; epoch != epochs; ++epoch) {
+      sampler.Shuffle(epoch);
+      for (unsigned long i = 0; i != sampler.NumBatches(); ++i) {
+        ws.size = sampler.BatchSize(i);
+        const uint32_t * samples = sampler.Batch(i);
+        {
+          const ScopedTimer timer{telemetry_, Telemetry::kPrepare};
+          if (sparse) {
+            GatherLabels(lab, samples, ws.size, ws.labels.memptr());
+          } else {
+            Gather(img, lab, samples, ws.size, ws.input.memptr(),
+                ws.labels.memptr());
+          }
+          if (augmenter) {
+            for (int j = 0; j != ws.size; ++j) {
+              augmenter->Distort(ws.input.colptr(j), index, j);
+            }
+          }
+        }
+        index += pool_.Size();
+        const Col<uint8_t> labels(ws.labels.memptr(), ws.size, false, true);
+        if (sparse) {
+          Propagate(SparseBatch{sparse.get(), samples}, labels, ws);
+        } else {
+          const Matrix input(ws.input.memptr(), kInputLayerSz, ws.size, false,
+              true);
+          Propagate(input, labels, ws);
+        }
+        {
+          const ScopedTimer timer{telemetry_, Telemetry::kUpdate};
+          const T * const grads = ws.grads.memptr();
+          UpdateWeights(&grads, 1, 0, 1, NextStep(ws.size, rate, reg));
+        }
+        if (telemetry_ != nullptr) {
+          telemetry_->AddSamples(ws.size, ws.size * SampleFlops()
+              + 4 * NumWeights());
+        }
+      }
     }
+  });
+  epochs_ += epochs;
+  if (telemetry_ != nullptr) {
+    // All epochs are run concurrently, and so recorded as one
+    CollectLoss(workspaces);
+    telemetry_->EndEpoch(epochs_);
+  }
+  FinishTraining();
+}
+
+/**
+ * @brief Classifies a set of images.
+ *
+ * Inputs spanning several batches are split into as many parts as there are
+ * threads, each classified by its own thread, and smaller ones are classified
+ * by the calling thread. Either way, each thread propagates the images in
+ * batches, using a scratch state of its own that persists between calls. As
+ * such, concurrent calls are safe, though not concurrently with training.
+ *
+ * @param[in] img The input images, one per column, of any number.
+ * @param[out] probs If given, resized to receive the activations of the output
+ *             layer for each input image (one per column), i.e. the estimated
+ *             probabilities of it belonging to each of the classes.
+ * @return The predicted labels of the input images.
+ */
+template <typename T>
+template <typename eT>
+Col<uint8_t> NeuralNet<T>::Predict(const Mat<eT>& img, Mat<T> * probs) const
+{
+  if (img.n_rows != kInputLayerSz) {
+    throw runtime_error{"Unexpected dimensions of input data"};
+  }
+  Col<uint8_t> lab(img.n_cols);
+  if (probs != nullptr) {
+    probs->set_size(layers_.back(), img.n_cols);
+  }
+
+  // Assign each thread a whole number of batches
+  const int num_batches = (img.n_cols + batch_size_ - 1) / batch_size_;
+  const int num = std::min(pool_.Size(), num_batches);
+  if (num <= 1) {
+    PredictRange(img, 0, img.n_cols, lab, probs);
+  } else {
+    pool_.Run([&](const int t){
+      if (t < num) {
+        const arma::uword first = std::min<arma::uword>(
+            t * num_batches / num * batch_size_, img.n_cols);
+        const arma::uword last = std::min<arma::uword>(
+            (t + 1) * num_batches / num * batch_size_, img.n_cols);
+        PredictRange(img, first, last, lab, probs);
+      }
+    });
   }
+  return lab;
 }
 
 /**
  * @brief Evaluates the learned network parameters on a test set.
- * @param[in] data The input data, incl. labels (placed in the last column).
+ * @param[in] img The input images, one per column.
+ * @param[in] lab The labels of the input images.
  * @return The percentage of examples from the input data that were classified
  *         correctly.
  */
-double NeuralNet::Evaluate(const Mat<uint8_t>& data) const
+template <typename T>
+template <typename eT>
+double NeuralNet<T>::Evaluate(const Mat<eT>& img, const Col<uint8_t>& lab)
+    const
+{
+  if (img.n_cols != lab.n_rows) {
+    throw runtime_error{"Numbers of images and labels differ."};
+  }
+  if (img.n_cols == 0) {
+    throw runtime_error{"No images to evaluate on."};
+  }
+  const Col<uint8_t> predicted = Predict(img);
+  int cnt = 0;
+  for (arma::uword i = 0; i != img.n_cols; ++i) {
+    cnt += predicted[i] == lab[i];
+  }
+  return (static_cast<double>(cnt) / img.n_cols) * 100;
+}
+
+// Validates the layer sizes passed to the constructor, returning them
+template <typename T>
+const std::vector<int>& NeuralNet<T>::ValidateLayers(
+    const std::vector<int>& layers)
+{
+  // Loaders only accept labels that index the output layer
+  static_assert(static_cast<int>(kOutputLayerSz) == MnistFormat::kNumLabels,
+      "Output layer size differs from the number of labels");
+  if (layers.size() < 2
+      || layers.size() > static_cast<std::size_t>(kMaxLayers)) {
+    throw runtime_error{"Unsupported number of layers."};
+  }
+  if (layers.front() != kInputLayerSz || layers.back() != kOutputLayerSz) {
+    throw runtime_error{"Input and output layers must have 784 and 10 units."};
+  }
+  if (*std::min_element(layers.begin(), layers.end()) < 1) {
+    throw runtime_error{"Layers must have at least one unit."};
+  }
+  return layers;
+}
+
+// Computes the index of the first weight into each layer from the layer
+// sizes, followed by the number of weights. Each layer has a row of weights
+// per unit, with a column for the bias and one per unit of the layer below
+template <typename T>
+std::vector<std::size_t> NeuralNet<T>::Offsets(const std::vector<int>& layers)
+{
+  std::vector<std::size_t> offsets(layers.size() + 1, 0);
+  for (std::size_t l = 1; l != layers.size(); ++l) {
+    offsets[l + 1] = offsets[l]
+        + static_cast<std::size_t>(layers[l]) * (layers[l - 1] + 1);
+  }
+  return offsets;
+}
+
+// Floating point operations per sample for forward- and backward propagation
+// of dense input, counting a multiply-add as two. Those for propagating the
+// error to each hidden layer come on top of those for the weights. Updating
+// the weights of a batch takes another 4 * NumWeights()
+template <typename T>
+uint64_t NeuralNet<T>::SampleFlops() const
+{
+  uint64_t flops = 4 * NumWeights();
+  for (std::size_t l = 2; l < layers_.size(); ++l) {
+    flops += 2 * static_cast<uint64_t>(layers_[l]) * layers_[l - 1];
+  }
+  return flops;
+}
+
+// Returns the number of parts each batch is split into, one per thread of
+// each process
+template <typename T>
+int NeuralNet<T>::NumParts() const
 {
-  ValidateSize(data);
-  const auto img = data.head_cols(kInputLayerSz); // images
-  const auto lab = data.tail_cols(1);             // labels
-  double cnt = 0;
-  
-  for (unsigned int i = 0; i != data.n_rows; i += kBatchSz) {
-    // Run forward propagation on a single image
-    ForwardProp(img.rows(i, i + kBatchSz - 1));
+  return pool_.Size() * (comm_ != nullptr ? comm_->WorldSize() : 1);
+}
+
+// Returns the first of the consecutive parts of each batch that the threads of
+// this process propagate
+template <typename T>
+int NeuralNet<T>::FirstPart() const
+{
+  return pool_.Size() * (comm_ != nullptr ? comm_->Rank() : 0);
+}
+
+// Draws a seed, replaced by that of rank 0 if distributed, such that all
+// processes shuffle and distort the training set alike
+template <typename T>
+uint64_t NeuralNet<T>::DrawSharedSeed() const
+{
+  uint64_t seed = DrawSeed();
+  if (comm_ != nullptr) {
+    comm_->Broadcast(&seed, sizeof seed);
+  }
+  return seed;
+}
+
+template <typename T>
+void NeuralNet<T>::InitWeights()
+{
+  weights_.randu();
+  for (std::size_t l = 1; l != layers_.size(); ++l) {
+    const double eps = Eps(layers_[l - 1], layers_[l]);
+    auto weights = weights_.subvec(offsets_[l], offsets_[l + 1] - 1);
+    weights *= 2 * eps;
+    weights -= eps;
+  }
+}
+
+// Compresses the images of a training set if few enough of their features are
+// non-zero, or returns nothing otherwise. Distorted images are never
+// compressed, as distortions are applied to dense batches
+template <typename T>
+template <typename eT>
+std::unique_ptr<SparseImages<T>> NeuralNet<T>::MakeSparse(const Mat<eT>& img)
+    const
+{
+  if (augment_threads_ != 0
+      || SparseImages<T>::Density(img) * 100 > kMaxSparsePercent) {
+    return nullptr;
+  }
+  return std::unique_ptr<SparseImages<T>>{new SparseImages<T>{img}};
+}
+
+// Creates an augmenter with a seed of its own if augmentation is enabled, or
+// nothing otherwise, so that the random numbers drawn otherwise are unchanged
+template <typename T>
+std::unique_ptr<Augmenter<T>> NeuralNet<T>::MakeAugmenter(const int threads)
+    const
+{
+  if (augment_threads_ == 0) {
+    return nullptr;
+  }
+  return std::unique_ptr<Augmenter<T>>{
+      new Augmenter<T>{distortions_, threads, DrawSharedSeed()}};
+}
+
+// Randomly initializes the weights before training, unless resuming from a
+// checkpoint that was loaded since the last training, and resets the state of
+// the optimizer. If distributed, all processes start from the weights of
+// rank 0
+template <typename T>
+void NeuralNet<T>::StartTraining()
+{
+  if (resume_) {
+    resume_ = false;
+  } else {
+    InitWeights();
+    epochs_ = 0;
+  }
+  if (comm_ != nullptr) {
+    comm_->Broadcast(weights_.memptr(), NumWeights() * sizeof(T));
+  }
+  const int moments = OptimizerMoments(optimizer_.kind);
+  first_moments_.zeros(moments >= 1 ? NumWeights() : 0);
+  second_moments_.zeros(moments >= 2 ? NumWeights() : 0);
+  steps_ = 0;
+  checkpoint_epochs_ = std::numeric_limits<unsigned long>::max();
+  if (telemetry_ != nullptr) {
+    telemetry_->StartEpoch();
+  }
+}
+
+// Counts an update of the weights with the gradients of a batch of n samples,
+// returning the coefficients to apply them with. Adam's bias correction is
+// folded into its learning rate and epsilon, where the t-th update computes
+//   rate * sqrt(1 - decay^t) / (1 - momentum^t) * m
+//     / (sqrt(v) + epsilon * sqrt(1 - decay^t))
+// which equals the update in terms of the bias-corrected moments
+template <typename T>
+OptimizerStep NeuralNet<T>::NextStep(const int n, const double rate,
+    const double reg)
+{
+  const double t = steps_.fetch_add(1, std::memory_order_relaxed) + 1;
+  OptimizerStep step = { optimizer_.kind, 1.0 / n, rate, reg,
+      optimizer_.momentum, optimizer_.decay, optimizer_.epsilon };
+  if (optimizer_.kind == kOptimizerAdam) {
+    const double correction = std::sqrt(1 - std::pow(optimizer_.decay, t));
+    step.rate *= correction / (1 - std::pow(optimizer_.momentum, t));
+    step.epsilon *= correction;
+  }
+  return step;
+}
+
+// Counts a completed epoch of synchronous training, writing a checkpoint if
+// one is due
+template <typename T>
+void NeuralNet<T>::FinishEpoch()
+{
+  ++epochs_;
+  if (!checkpoint_file_.empty() && checkpoint_interval_ != 0
+      && epochs_ % checkpoint_interval_ == 0) {
+    Save(checkpoint_file_.c_str());
+    checkpoint_epochs_ = epochs_;
+  }
+  if (telemetry_ != nullptr) {
+    telemetry_->EndEpoch(epochs_);
+  }
+}
+
+// Adds the losses summed by the workspaces to the telemetry, resetting them
+template <typename T>
+void NeuralNet<T>::CollectLoss(std::vector<Workspace>& workspaces)
+{
+  double loss = 0;
+  for (Workspace& ws : workspaces) {
+    loss += ws.loss;
+    ws.loss = 0;
+  }
+  telemetry_->AddLoss(loss);
+}
+
+// Writes a checkpoint after training, unless one was just written
+template <typename T>
+void NeuralNet<T>::FinishTraining()
+{
+  if (!checkpoint_file_.empty() && checkpoint_epochs_ != epochs_) {
+    Save(checkpoint_file_.c_str());
+    checkpoint_epochs_ = epochs_;
+  }
+}
+
+// Classifies the images in the columns [first, last) in batches, writing their
+// labels and, if requested, output activations to the same columns
+template <typename T>
+template <typename eT>
+void NeuralNet<T>::PredictRange(const Mat<eT>& img, const arma::uword first,
+    const arma::uword last, Col<uint8_t>& lab, Mat<T> * probs) const
+{
+  thread_local Scratch scratch;
+  scratch.Reserve(layers_, batch_size_);
+  const int classes = layers_.back();
+  for (arma::uword i = first; i < last; i += batch_size_) {
+    const int n = std::min<arma::uword>(batch_size_, last - i);
+    const Mat<eT> batch(const_cast<eT *>(img.colptr(i)), kInputLayerSz, n,
+        false, true);
+    Matrix buffer(scratch.input.memptr(), kInputLayerSz, n, false, true);
+    T * const output =
+      probs != nullptr ? probs->colptr(i) : scratch.activ.back().memptr();
+    ForwardProp(Convert(batch, buffer).memptr(), n, scratch.activ, output);
 
     // Base predictions on the output nodes with the highest probabilities
-    Col<uint8_t> predictions(kBatchSz);
-    for (unsigned int j = 0; j != activ_l3_.n_rows; ++j) {
-      predictions.row(j) = activ_l3_.row(j).index_max();
+    for (int j = 0; j != n; ++j) {
+      const T * const out = output + j * classes;
+      lab[i + j] = std::max_element(out, out + classes) - out;
     }
+  }
+}
 
-    // Compare predictions to the actual labels
-    predictions -= lab.rows(i, i + kBatchSz - 1);
-    predictions.transform([](const uint8_t val){ return val == 0; });
+// Trains on a given number of batches drawn from a prefetcher, consisting of
+// epochs of a given number of batches each. Batches refer to the samples of
+// the given sparse images by index if any, and hold their images otherwise.
+// After each epoch, the weights are submitted to the given validator if any,
+// stopping early once it says so (that of rank 0, if distributed). If
+// distributed, only the parts of each batch of this process are propagated,
+// and the gradients summed across processes
+template <typename T>
+void NeuralNet<T>::TrainBatches(BatchPrefetcher<T>& prefetcher,
+    const SparseImages<T> * sparse, Validator<T> * validator,
+    const unsigned long count, const unsigned long num_batches,
+    const double rate, const double reg)
+{
+  for (unsigned long i = 0; i != count; ++i) {
+    // Run forward- and backward propagation on each part of the batch ...
+    const Batch * batch;
+    {
+      const ScopedTimer timer{telemetry_, Telemetry::kWait};
+      batch = &prefetcher.Acquire();
+    }
+    const int n = batch->size;
+    const int parts = NumParts();
+    pool_.Run([&](const int t){
+      Workspace& ws = workspaces_[t];
+      const int part = FirstPart() + t;
+      ws.offset = part * n / parts;
+      ws.size = (part + 1) * n / parts - ws.offset;
+      const Col<uint8_t> labels(
+          const_cast<uint8_t *>(batch->lab.memptr()) + ws.offset, ws.size,
+          false, true);
+      if (sparse != nullptr) {
+        Propagate(SparseBatch{sparse, batch->samples.data() + ws.offset},
+            labels, ws);
+      } else {
+        const Matrix input(const_cast<T *>(batch->img.colptr(ws.offset)),
+            kInputLayerSz, ws.size, false, true);
+        Propagate(input, labels, ws);
+      }
+    });
+    prefetcher.Release();
 
-    // Update count with the number of correctly classified images
-    cnt += accu(predictions);
+    // ... and update the weights accordingly, summing the gradients of all
+    // processes first if distributed, in the same order as a single process
+    const OptimizerStep step = NextStep(n, rate, reg);
+    const T * const * grads = grads_.data();
+    int num_grads = grads_.size();
+    const T * const reduced = reduced_.memptr();
+    if (comm_ != nullptr) {
+      const ScopedTimer timer{telemetry_, Telemetry::kReduce};
+      comm_->AllReduce(grads, num_grads, NumWeights(), reduced_.memptr());
+      grads = &reduced;
+      num_grads = 1;
+    }
+    pool_.Run([&](const int t){
+      const ScopedTimer timer{telemetry_, Telemetry::kUpdate};
+      UpdateWeights(grads, num_grads, t, pool_.Size(), step);
+    });
+    if (telemetry_ != nullptr) {
+      const int local = (FirstPart() + pool_.Size()) * n / parts
+          - FirstPart() * n / parts;
+      telemetry_->AddSamples(local, local * SampleFlops() + 4 * NumWeights());
+      CollectLoss(workspaces_);
+    }
+    if ((i + 1) % num_batches == 0) {
+      FinishEpoch();
+      if (validator != nullptr) {
+        // If distributed, all processes follow the decision of rank 0, so
+        // that none stops while the others wait on it to sum gradients
+        validator->Submit(weights_, epochs_);
+        bool stop = validator->ShouldStop();
+        if (comm_ != nullptr) {
+          comm_->Broadcast(&stop, sizeof stop);
+        }
+        if (stop) {
+          break;
+        }
+      }
+    }
   }
-  return (cnt / data.n_rows) * 100;
 }
 
-void NeuralNet::InitWeights()
+// Waits for the validator to evaluate the last snapshot, and replaces the
+// weights by those of the most accurate one (that of rank 0, if distributed),
+// counting only the epochs up to it. Any checkpoint written since holds other
+// weights, and so is written anew
+template <typename T>
+void NeuralNet<T>::RestoreBest(Validator<T>& validator)
 {
-  static const double eps_hidden = Eps(kInputLayerSz, kHiddenLayerSz);
-  static const double eps_out = Eps(kHiddenLayerSz, kOutputLayerSz);
+  validator.Finish();
+  unsigned long best = validator.BestEpoch();
+  if (best != 0) {
+    weights_ = validator.BestWeights();
+  }
+  if (comm_ != nullptr) {
+    comm_->Broadcast(weights_.memptr(), NumWeights() * sizeof(T));
+    comm_->Broadcast(&best, sizeof best);
+  }
+  if (best != 0) {
+    epochs_ = best;
+  }
+  checkpoint_epochs_ = std::numeric_limits<unsigned long>::max();
+}
 
-  weights_.randu();
-  weights_.head_rows(kWeightsHeadSz) *= 2 * eps_hidden;
-  weights_.head_rows(kWeightsHeadSz) -= eps_hidden;
-  weights_.tail_rows(kWeightsTailSz) *= 2 * eps_out;
-  weights_.tail_rows(kWeightsTailSz) -= eps_out;
+// Runs forward- and backward propagation on a batch of dense or sparse input,
+// timing each and summing the loss if instrumented
+template <typename T>
+template <typename Input>
+void NeuralNet<T>::Propagate(const Input& input, const Col<uint8_t>& lab,
+    Workspace& ws) const
+{
+  // Parts left empty by a partial batch smaller than the number of threads
+  // contribute no gradients
+  if (ws.size == 0) {
+    ws.grads.zeros();
+    return;
+  }
+  {
+    const ScopedTimer timer{telemetry_, Telemetry::kForward};
+    ForwardProp(input, ws);
+  }
+  if (telemetry_ != nullptr) {
+    ws.loss += Loss(ws.activ.back(), lab);
+  }
+  const ScopedTimer timer{telemetry_, Telemetry::kBackward};
+  BackProp(input, lab, ws);
 }
 
-void NeuralNet::ForwardProp(const Mat<uint8_t>& img) const
+// Propagates a batch of inputs (one per column) through the network
+template <typename T>
+void NeuralNet<T>::ForwardProp(const Matrix& input, Workspace& ws) const
 {
-  assert(img.n_rows == kBatchSz && img.n_cols == kInputLayerSz);
+  assert(input.n_rows == kInputLayerSz
+      && input.n_cols == static_cast<arma::uword>(ws.size));
+  ForwardProp(input.memptr(), ws.size, ws.activ, ws.activ.back().memptr());
+}
 
-  // reshape weights
-  const mat weights_l12 = reshape(weights_.head_rows(kWeightsHeadSz),
-    kHiddenLayerSz, kInputLayerSz + 1);
-  const mat weights_l23 = reshape(weights_.tail_rows(kWeightsTailSz),
-    kOutputLayerSz, kHiddenLayerSz + 1);
+// Propagates a batch of sparse inputs through the network, visiting only the
+// non-zero inputs in the first layer
+template <typename T>
+void NeuralNet<T>::ForwardProp(const SparseBatch& input, Workspace& ws) const
+{
+  T * const out = layers_.size() != 2 ? ws.activ[1].memptr()
+                                      : ws.activ.back().memptr();
+  SparseDenseSigmoid(weights_.memptr(), layers_[1], input.images->Columns(),
+      input.samples, ws.size, out, sigmoid_);
+  ForwardUpper(ws.size, ws.activ, ws.activ.back().memptr());
+}
+
+// Propagates n inputs (one per column) through the network, storing the
+// activations of each hidden layer in the given matrices (indexed by layer)
+// and those of the output layer in a given buffer. Each layer takes a single
+// fused pass computing the weighted sums, adding the biases and applying the
+// sigmoid
+template <typename T>
+void NeuralNet<T>::ForwardProp(const T * input, const int n,
+    std::vector<Matrix>& activ, T * output) const
+{
+  T * const out = layers_.size() != 2 ? activ[1].memptr() : output;
+  DenseSigmoid(weights_.memptr(), layers_[1], kInputLayerSz, input, n, out,
+      sigmoid_);
+  ForwardUpper(n, activ, output);
+}
 
-  // first activation layer (equals input)
-  TAIL_COLS(activ_l1_) = conv_to<mat>::from(img);
+// Propagates n samples from the activations of the first hidden layer through
+// the layers above it, as ForwardProp
+template <typename T>
+void NeuralNet<T>::ForwardUpper(const int n, std::vector<Matrix>& activ,
+    T * output) const
+{
+  const std::size_t num_layers = layers_.size();
+  for (std::size_t l = 2; l < num_layers; ++l) {
+    T * const out = l + 1 != num_layers ? activ[l].memptr() : output;
+    DenseSigmoid(weights_.memptr() + offsets_[l], layers_[l], layers_[l - 1],
+        activ[l - 1].memptr(), n, out, sigmoid_);
+  }
+}
 
-  // second activation layer
-  const mat prod_l2 = weights_l12 * activ_l1_.t();
-  TAIL_COLS(activ_l2_) = Sigmoid(prod_l2.t());
+// Computes the gradients for the batch last propagated by ForwardProp
+template <typename T>
+void NeuralNet<T>::BackProp(const Matrix& input, const Col<uint8_t>& lab,
+    Workspace& ws) const
+{
+  BackPropLayers(lab, ws);
 
-  // third activation layer
-  const mat prod_l3 = weights_l23 * activ_l2_.t();
-  activ_l3_ = Sigmoid(prod_l3.t());
+  // gradients of the first layer's weights, minus those for the bias
+  const Matrix err(ws.err[1].memptr(), layers_[1], ws.size, false, true);
+  Matrix tail_grads(ws.grads.memptr() + layers_[1], layers_[1], kInputLayerSz,
+      false, true);
+  tail_grads = err * input.t();
 }
 
-vec NeuralNet::BackProp(const Col<uint8_t>& lab, const double reg) const
+// Computes the gradients for the batch of sparse inputs last propagated by
+// ForwardProp, visiting only the non-zero inputs in the first layer
+template <typename T>
+void NeuralNet<T>::BackProp(const SparseBatch& input, const Col<uint8_t>& lab,
+    Workspace& ws) const
 {
-  assert(lab.n_rows == kBatchSz);
+  BackPropLayers(lab, ws);
+  SparseOuterProduct(ws.err[1].memptr(), layers_[1], kInputLayerSz,
+      input.images->Columns(), input.samples, ws.size,
+      ws.grads.memptr() + layers_[1]);
+}
 
-  // reshape weights
-  const mat weights_l12 = reshape(weights_.head_rows(kWeightsHeadSz),
-    kHiddenLayerSz, kInputLayerSz + 1);
-  const mat weights_l23 = reshape(weights_.tail_rows(kWeightsTailSz),
-    kOutputLayerSz, kHiddenLayerSz + 1);
+// Computes the errors of all layers for the batch last propagated by
+// ForwardProp, one layer at a time from the output layer down, along with the
+// gradients of all weights except those between the input and the first
+// layer, which are left to BackProp
+template <typename T>
+void NeuralNet<T>::BackPropLayers(const Col<uint8_t>& lab, Workspace& ws)
+    const
+{
+  assert(lab.n_rows == static_cast<arma::uword>(ws.size));
 
   // output layer
-  mat yk(kOutputLayerSz, kBatchSz);
-  for (int k = 0; k != kOutputLayerSz; ++k) {
-    auto dest = yk.begin_row(k);
-    transform(begin(lab), end(lab), dest, [k](uint8_t y){ return y==k; });
-  }
-  mat err_l3 = activ_l3_.t() - yk;
-  err_l3 %= SigmoidGrad(activ_l3_.t());
+  const int last = layers_.size() - 1;
+  OutputError(ws.activ[last].memptr(), lab.memptr(), layers_[last], ws.size,
+      ws.err[last].memptr());
 
-  // hidden layer
-  mat err_l2 = TAIL_COLS(weights_l23).t() * err_l3;
-  err_l2 %= SigmoidGrad(TAIL_COLS(activ_l2_).t());
+  for (int l = last; l != 0; --l) {
+    const int rows = layers_[l];
+    const int cols = layers_[l - 1];
 
-  // gradients
-  mat grad_l23 = (err_l3 * activ_l2_) / kBatchSz;
-  mat grad_l12 = (err_l2 * activ_l1_) / kBatchSz;
+    // view the columns of the workspace in use, as a partial batch leaves the
+    // rest stale
+    const Matrix err(ws.err[l].memptr(), rows, ws.size, false, true);
 
-  // regularization
-  TAIL_COLS(grad_l23) += (reg * TAIL_COLS(weights_l23)) / kBatchSz;
-  TAIL_COLS(grad_l12) += (reg * TAIL_COLS(weights_l12)) / kBatchSz;
+    // gradients, summed over the samples (scaling and regularization are left
+    // to UpdateWeights) and written directly into their unrolled form, with
+    // those for the bias in the first column
+    T * const grads = ws.grads.memptr() + offsets_[l];
+    Vector bias(grads, rows, false, true);
+    bias = arma::sum(err, 1);
+    if (l == 1) {
+      break;
+    }
+    const Matrix in(ws.activ[l - 1].memptr(), cols, ws.size, false, true);
+    Matrix tail_grads(grads + rows, rows, cols, false, true);
+    tail_grads = err * in.t();
 
-  // unroll gradients
-  return join_vert(vectorise(grad_l12), vectorise(grad_l23));
+    // error of the layer below, given the weights minus those for the bias
+    const Matrix tail(const_cast<T *>(weights_.memptr()) + offsets_[l] + rows,
+        rows, cols, false, true);
+    Matrix err_below(ws.err[l - 1].memptr(), cols, ws.size, false, true);
+    err_below = tail.t() * err;
+    for (int j = 0; j != ws.size; ++j) {
+      for (int r = 0; r != cols; ++r) {
+        err_below.at(r, j) *= SigmoidGrad(in.at(r, j));
+      }
+    }
+  }
 }
 
+// Sums the gradients of a number of workspaces and applies them to the
+// index-th of num equal segments of the weights, along with the moments kept
+// by the optimizer, in a single pass
+template <typename T>
+void NeuralNet<T>::UpdateWeights(const T * const * grads, const int num_grads,
+    const int index, const int num, const OptimizerStep& step)
+{
+  const std::size_t first = index * NumWeights() / num;
+  const std::size_t last = (index + 1) * NumWeights() / num;
+  OptimizerStep bias_step = step;
+  bias_step.reg = 0;
+
+  // Walk the segment layer by layer, each of which starts with its biases,
+  // which are not regularized
+  for (std::size_t l = 1; l != layers_.size(); ++l) {
+    const std::size_t biases = offsets_[l] + layers_[l];
+    const std::size_t end = std::min(last, offsets_[l + 1]);
+    std::size_t i = std::max(first, offsets_[l]);
+    if (i < std::min(biases, end)) {
+      ApplyGradients(grads, num_grads, i, std::min(biases, end), bias_step,
+          weights_.memptr(), first_moments_.memptr(),
+          second_moments_.memptr());
+      i = biases;
+    }
+    if (i < end) {
+      ApplyGradients(grads, num_grads, i, end, step, weights_.memptr(),
+          first_moments_.memptr(), second_moments_.memptr());
+    }
+  }
+}
+
+// Single and double precision, each accepting raw images as well as
+// preconverted features of either precision as input
+template class NeuralNet<float>;
+template class NeuralNet<double>;
+
+template void NeuralNet<float>::LearnWeights(const Mat<uint8_t>&,
+    const Col<uint8_t>&, const double, const double, int, Validator<float> *);
+template void NeuralNet<float>::LearnWeights(const Mat<float>&,
+    const Col<uint8_t>&, const double, const double, int, Validator<float> *);
+template void NeuralNet<float>::LearnWeights(const Mat<double>&,
+    const Col<uint8_t>&, const double, const double, int, Validator<float> *);
+template void NeuralNet<float>::LearnWeightsAsync(const Mat<uint8_t>&,
+    const Col<uint8_t>&, const double, const double, int);
+template void NeuralNet<float>::LearnWeightsAsync(const Mat<float>&,
+    const Col<uint8_t>&, const double, const double, int);
+template void NeuralNet<float>::LearnWeightsAsync(const Mat<double>&,
+    const Col<uint8_t>&, const double, const double, int);
+template Col<uint8_t> NeuralNet<float>::Predict(const Mat<uint8_t>&,
+    Mat<float> *) const;
+template Col<uint8_t> NeuralNet<float>::Predict(const Mat<float>&,
+    Mat<float> *) const;
+template Col<uint8_t> NeuralNet<float>::Predict(const Mat<double>&,
+    Mat<float> *) const;
+template double NeuralNet<float>::Evaluate(const Mat<uint8_t>&,
+    const Col<uint8_t>&) const;
+template double NeuralNet<float>::Evaluate(const Mat<float>&,
+    const Col<uint8_t>&) const;
+template double NeuralNet<float>::Evaluate(const Mat<double>&,
+    const Col<uint8_t>&) const;
+
+template void NeuralNet<double>::LearnWeights(const Mat<uint8_t>&,
+    const Col<uint8_t>&, const double, const double, int, Validator<double> *);
+template void NeuralNet<double>::LearnWeights(const Mat<float>&,
+    const Col<uint8_t>&, const double, const double, int, Validator<double> *);
+template void NeuralNet<double>::LearnWeights(const Mat<double>&,
+    const Col<uint8_t>&, const double, const double, int, Validator<double> *);
+template void NeuralNet<double>::LearnWeightsAsync(const Mat<uint8_t>&,
+    const Col<uint8_t>&, const double, const double, int);
+template void NeuralNet<double>::LearnWeightsAsync(const Mat<float>&,
+    const Col<uint8_t>&, const double, const double, int);
+template void NeuralNet<double>::LearnWeightsAsync(const Mat<double>&,
+    const Col<uint8_t>&, const double, const double, int);
+template Col<uint8_t> NeuralNet<double>::Predict(const Mat<uint8_t>&,
+    Mat<double> *) const;
+template Col<uint8_t> NeuralNet<double>::Predict(const Mat<float>&,
+    Mat<double> *) const;
+template Col<uint8_t> NeuralNet<double>::Predict(const Mat<double>&,
+    Mat<double> *) const;
+template double NeuralNet<double>::Evaluate(const Mat<uint8_t>&,
+    const Col<uint8_t>&) const;
+template double NeuralNet<double>::Evaluate(const Mat<float>&,
+    const Col<uint8_t>&) const;
+template double NeuralNet<double>::Evaluate(const Mat<double>&,
+    const Col<uint8_t>&) const;
+
 } // namespace mnist
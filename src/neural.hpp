@@ -1,68 +1,306 @@
 /**
  * @file
- * @brief Interface describing a three-layer feedforward neural network.
+ * @brief Interface describing a multilayer feedforward neural network.
  * @author Arno Bastenhof
  */
 
 #ifndef NEURAL_HPP_
 #define NEURAL_HPP_
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <stdexcept>
 #include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include <armadillo>
 
+#include "activation.hpp"
+#include "augmenter.hpp"
+#include "optimizer.hpp"
+#include "prefetcher.hpp"
+#include "sparse_images.hpp"
+#include "telemetry.hpp"
+#include "thread_pool.hpp"
+
 namespace mnist {
 
+class Communicator;
+class IdxStream;
+class QuantizedNet;
+template <typename T> class NeuralNetBench;
+template <typename T> class Validator;
+
+/**
+ * @brief A feedforward neural network of any number of fully connected
+ *        sigmoid layers, with weights, activations and gradients of type T
+ *        (float or double).
+ *
+ * The layer sizes are given at runtime, with the input layer first and the
+ * output layer last. The weights of each layer (biases in the first column)
+ * follow those of the layer before it.
+ *
+ * Training sets held in memory whose features are mostly zero (as are the
+ * pixels of MNIST) are compressed when training starts, unless distorted.
+ * The first layer then only visits the non-zero inputs of each sample, both
+ * when propagating forward and when computing the gradients of its weights.
+ *
+ * The gradients of each batch are applied by plain gradient descent by
+ * default, or by any other Optimizer set through SetOptimizer.
+ *
+ * Training on a data set held in memory can be distributed over several
+ * processes through Distribute, each propagating its share of every batch.
+ */
+template <typename T>
 class NeuralNet {
 public:
-  explicit          NeuralNet();
+  enum {
+    kDefaultBatchSz = 50,
+    kDefaultHiddenSz = 30,
+    kInputLayerSz = 784,
+    kOutputLayerSz = 10,
+    kMaxLayers = 8                          // as supported by checkpoints
+  };
+  explicit          NeuralNet(const int threads = 1,
+                        const SigmoidMode sigmoid = kSigmoidExact,
+                        const int batch_size = kDefaultBatchSz,
+                        const std::vector<int>& layers = {kInputLayerSz,
+                            kDefaultHiddenSz, kOutputLayerSz});
                     NeuralNet(const NeuralNet &) = delete;
                     NeuralNet(NeuralNet &&) = delete;
   NeuralNet&        operator=(const NeuralNet &) = delete;
   NeuralNet&        operator=(NeuralNet&&) = delete;
-  void              LearnWeights(const arma::Mat<uint8_t>& data,
-                        const double rate, const double reg, int epochs);
-  double            Evaluate(const arma::Mat<uint8_t>& data) const;
+  void              Augment(const Distortions&, const int);
+  void              SetOptimizer(const Optimizer&);
+  void              SetCheckpoint(const std::string&, const int = 0);
+  void              Save(const char *) const;
+  void              Load(const char *);
+  void              Instrument(Telemetry *);
+  void              Distribute(Communicator *);
+  unsigned long     Epochs() const;
+  int               BatchSize() const;
+  const std::vector<int>& Layers() const;
+  std::size_t       NumWeights() const;
+  std::size_t       WorkspaceSize() const;
+  template <typename eT>
+  void              LearnWeights(const arma::Mat<eT>& img,
+                        const arma::Col<uint8_t>& lab, const double rate,
+                        const double reg, int epochs,
+                        Validator<T> * validator = nullptr);
+  void              LearnWeights(IdxStream& stream, const double rate,
+                        const double reg, const int epochs);
+  template <typename eT>
+  void              LearnWeightsAsync(const arma::Mat<eT>& img,
+                        const arma::Col<uint8_t>& lab, const double rate,
+                        const double reg, int epochs);
+  template <typename eT>
+  arma::Col<uint8_t> Predict(const arma::Mat<eT>& img,
+                        arma::Mat<T> * probs = nullptr) const;
+  template <typename eT>
+  double            Evaluate(const arma::Mat<eT>& img,
+                        const arma::Col<uint8_t>& lab) const;
 private:
+  friend class QuantizedNet;                // reads the learned weights
+  friend class NeuralNetBench<T>;           // times the propagation steps
+  friend class Validator<T>;                // evaluates snapshots
   enum {
-    kBatchSz = 50,
-    kInputLayerSz = 784,
-    kHiddenLayerSz = 30,
-    kOutputLayerSz = 10,
-    kWeightsHeadSz = kHiddenLayerSz * (kInputLayerSz + 1),  // rows * cols
-    kWeightsTailSz = kOutputLayerSz * (kHiddenLayerSz + 1), // rows * cols
-    kWeightsSz = kWeightsHeadSz + kWeightsTailSz
+    kPrefetchDepth = 2,                     // batches buffered for training
+    kMaxSparsePercent = 25                  // of non-zero features, up to
+                                            // which inputs are kept sparse
+  };
+  typedef arma::Mat<T> Matrix;
+  typedef arma::Col<T> Vector;
+  typedef typename BatchPrefetcher<T>::Batch Batch;
+  // Scratch state for propagating a part of each batch, owned by one thread
+  struct Workspace {
+                    Workspace(const NeuralNet&, const int);
+    int             offset;                 // first sample within the batch
+    int             size;                   // number of samples, at most the
+                                            // capacity of the matrices
+    Matrix          input;                  // gathered input, if needed
+    arma::Col<uint8_t> labels;
+    std::vector<Matrix> activ;              // per layer, one column per
+                                            // sample, empty for the input
+    std::vector<Matrix> err;                // per layer, as activ
+    Vector          grads;                  // unscaled and unregularized
+    double          loss;                   // summed, if instrumented
   };
-  arma::vec         weights_;
-  mutable arma::mat activ_l1_;
-  mutable arma::mat activ_l2_;
-  mutable arma::mat activ_l3_;
-  static void       ValidateSize(const arma::Mat<uint8_t>&);
+  // Input referring to samples of a compressed data set by index
+  struct SparseBatch {
+    const SparseImages<T> * images;
+    const uint32_t * samples;               // of the part of the batch
+  };
+  // Scratch state for classifying a batch, owned by one thread
+  struct Scratch {
+    void            Reserve(const std::vector<int>&, const int);
+    Matrix          input;                  // converted input, if needed
+    std::vector<Matrix> activ;              // per layer, empty for the input
+  };
+  const std::vector<int> layers_;           // units, excluding biases
+  const std::vector<std::size_t> offsets_;  // first weight into each layer,
+                                            // followed by the total
+  Vector            weights_;
+  const SigmoidMode sigmoid_;
+  const int         batch_size_;
+  Distortions       distortions_;
+  Optimizer         optimizer_;
+  Vector            first_moments_;         // kept by the optimizer, if any
+  Vector            second_moments_;
+  std::atomic<unsigned long> steps_;        // updates since training started
+  int               augment_threads_;       // 0 if not augmenting
+  std::string       checkpoint_file_;       // empty if not checkpointing
+  int               checkpoint_interval_;   // epochs, 0 if only at the end
+  unsigned long     checkpoint_epochs_;     // epochs at the last checkpoint
+  unsigned long     epochs_;                // trained since initialization
+  bool              resume_;                // loaded, not yet trained
+  Telemetry *       telemetry_;             // nullptr if not instrumented
+  Communicator *    comm_;                  // nullptr if training alone
+  mutable ThreadPool pool_;
+  std::vector<Workspace> workspaces_;       // one per thread
+  std::vector<const T *> grads_;            // of each of the workspaces
+  Vector            reduced_;               // summed over all processes
+  template <typename eT>
+  static void       ValidateSize(const arma::Mat<eT>&,
+                        const arma::Col<uint8_t>&);
+  static const std::vector<int>& ValidateLayers(const std::vector<int>&);
+  static std::vector<std::size_t> Offsets(const std::vector<int>&);
+  uint64_t          SampleFlops() const;
+  int               NumParts() const;
+  int               FirstPart() const;
+  uint64_t          DrawSharedSeed() const;
   void              InitWeights();          // randomly initializes weights
-  void              ForwardProp(const arma::Mat<uint8_t>&) const;
-  arma::vec         BackProp(const arma::Col<uint8_t>&, const double) const;
+  void              StartTraining();
+  OptimizerStep     NextStep(const int, const double, const double);
+  void              FinishEpoch();
+  void              FinishTraining();
+  void              CollectLoss(std::vector<Workspace>&);
+  std::unique_ptr<Augmenter<T>> MakeAugmenter(const int) const;
+  template <typename eT>
+  std::unique_ptr<SparseImages<T>> MakeSparse(const arma::Mat<eT>&) const;
+  template <typename eT>
+  void              PredictRange(const arma::Mat<eT>&, const arma::uword,
+                        const arma::uword, arma::Col<uint8_t>&,
+                        arma::Mat<T> *) const;
+  void              TrainBatches(BatchPrefetcher<T>&,
+                        const SparseImages<T> *, Validator<T> *,
+                        const unsigned long, const unsigned long,
+                        const double, const double);
+  void              RestoreBest(Validator<T>&);
+  template <typename Input>
+  void              Propagate(const Input&, const arma::Col<uint8_t>&,
+                        Workspace&) const;
+  void              ForwardProp(const Matrix&, Workspace&) const;
+  void              ForwardProp(const SparseBatch&, Workspace&) const;
+  void              ForwardProp(const T *, const int, std::vector<Matrix>&,
+                        T *) const;
+  void              ForwardUpper(const int, std::vector<Matrix>&, T *) const;
+  void              BackProp(const Matrix&, const arma::Col<uint8_t>&,
+                        Workspace&) const;
+  void              BackProp(const SparseBatch&, const arma::Col<uint8_t>&,
+                        Workspace&) const;
+  void              BackPropLayers(const arma::Col<uint8_t>&,
+                        Workspace&) const;
+  void              UpdateWeights(const T * const *, const int, const int,
+                        const int, const OptimizerStep&);
 };
 
 /**
- * @brief Default constructor.
+ * @brief Constructor for a workspace, initially for its full capacity.
+ * @param[in] nn The network whose layers to hold the activations of.
+ * @param[in] capacity The maximum number of samples.
+ */
+template <typename T>
+inline NeuralNet<T>::Workspace::Workspace(const NeuralNet& nn,
+    const int capacity)
+  : offset(0)
+  , size(capacity)
+  , input(kInputLayerSz, capacity)
+  , labels(capacity)
+  , activ(nn.layers_.size())
+  , err(nn.layers_.size())
+  , grads(nn.NumWeights())
+  , loss(0)
+{
+  for (std::size_t l = 1; l != nn.layers_.size(); ++l) {
+    activ[l].set_size(nn.layers_[l], capacity);
+    err[l].set_size(nn.layers_[l], capacity);
+  }
+}
+
+/**
+ * @brief Ensures a scratch state holds the activations of the given layers for
+ *        at least a given number of samples.
+ * @param[in] layers The number of units of each layer.
+ * @param[in] capacity The number of samples.
+ */
+template <typename T>
+inline void NeuralNet<T>::Scratch::Reserve(const std::vector<int>& layers,
+    const int capacity)
+{
+  const arma::uword cols = capacity;
+  if (input.n_cols < cols) {
+    input.set_size(kInputLayerSz, cols);
+  }
+  activ.resize(layers.size());
+  for (std::size_t l = 1; l != layers.size(); ++l) {
+    if (activ[l].n_rows != static_cast<arma::uword>(layers[l])
+        || activ[l].n_cols < cols) {
+      activ[l].set_size(layers[l], std::max(activ[l].n_cols, cols));
+    }
+  }
+}
+
+/**
+ * @brief Returns the number of epochs the network was trained for since its
+ *        weights were initialized, including those before any checkpoint it
+ *        was resumed from.
+ *
+ * After training with a validator, only the epochs up to the most accurate
+ * snapshot, whose weights are kept, are counted.
+ */
+template <typename T>
+inline unsigned long NeuralNet<T>::Epochs() const
+{
+  return epochs_;
+}
+
+/**
+ * @brief Returns the number of samples per batch.
+ */
+template <typename T>
+inline int NeuralNet<T>::BatchSize() const
+{
+  return batch_size_;
+}
+
+/**
+ * @brief Returns the number of units of each layer, excluding biases, with the
+ *        input layer first.
+ */
+template <typename T>
+inline const std::vector<int>& NeuralNet<T>::Layers() const
+{
+  return layers_;
+}
+
+/**
+ * @brief Returns the number of weights, including biases.
  */
-inline NeuralNet::NeuralNet()
-  : weights_(kWeightsSz)
-  , activ_l1_(kBatchSz, kInputLayerSz + 1)
-  , activ_l2_(kBatchSz, kHiddenLayerSz + 1)
-  , activ_l3_(kBatchSz, kOutputLayerSz)
+template <typename T>
+inline std::size_t NeuralNet<T>::NumWeights() const
 {
-  // set bias activations
-  activ_l1_.col(0).ones();
-  activ_l2_.col(0).ones();
+  return offsets_.back();
 }
 
-inline void NeuralNet::ValidateSize(const arma::Mat<uint8_t>& data)
+template <typename T>
+template <typename eT>
+inline void NeuralNet<T>::ValidateSize(const arma::Mat<eT>& img,
+    const arma::Col<uint8_t>& lab)
 {
-  // Training- and test set sizes known from the MNIST database
-  if (data.n_rows % kBatchSz != 0) {
+  if (img.n_rows != kInputLayerSz || img.n_cols != lab.n_rows) {
     throw std::runtime_error{"Unexpected dimensions of input data"};
   }
 }
@@ -0,0 +1,92 @@
+/**
+ * @file
+ * @brief Selectable rules for applying the gradients of a batch to the
+ *        weights.
+ * @author Arno Bastenhof
+ */
+
+#ifndef OPTIMIZER_HPP_
+#define OPTIMIZER_HPP_
+
+#include <string>
+
+namespace mnist {
+
+/**
+ * @brief Rules for applying the gradients of a batch to the weights.
+ *
+ * Each is applied by a fused kernel (see ApplyGradients in kernels.hpp), which
+ * sums the gradients of the threads, adds the regularization term and updates
+ * the optimizer state along with the weights in a single pass over memory.
+ * Momentum and Nesterov keep one value per weight, and Adam two.
+ */
+enum OptimizerKind {
+  kOptimizerSgd,      /**< @brief w -= rate * g. */
+  kOptimizerMomentum, /**< @brief v = mu * v + g, w -= rate * v. */
+  kOptimizerNesterov, /**< @brief As momentum, w -= rate * (g + mu * v). */
+  kOptimizerAdam      /**< @brief Adam (Kingma and Ba, 2015). */
+};
+
+/** @brief Names of the optimizers, indexed by OptimizerKind. */
+static const char * const kOptimizerNames[] = {
+  "sgd", "momentum", "nesterov", "adam"
+};
+
+/**
+ * @brief An optimizer along with its hyperparameters, other than the learning
+ *        rate and the regularization parameter.
+ */
+struct Optimizer {
+  OptimizerKind         kind;
+  double                momentum;       // decay of the first moment, i.e. mu
+                                        // or Adam's beta1
+  double                decay;          // of Adam's second moment (beta2)
+  double                epsilon;        // added to Adam's denominator
+};
+
+// Default hyperparameters, with those of Adam as proposed by Kingma and Ba
+static const Optimizer kDefaultOptimizer = { kOptimizerSgd, 0.9, 0.999, 1e-8 };
+
+/**
+ * @brief The coefficients of a single update by ApplyGradients, derived from
+ *        an Optimizer for a given batch.
+ */
+struct OptimizerStep {
+  OptimizerKind         kind;
+  double                scale;          // of the summed gradients
+  double                rate;           // including Adam's bias correction
+  double                reg;            // 0 for the biases
+  double                momentum;
+  double                decay;
+  double                epsilon;        // including Adam's bias correction
+};
+
+/**
+ * @brief Returns the number of values an optimizer keeps per weight.
+ * @param[in] kind The optimizer.
+ */
+inline int OptimizerMoments(const OptimizerKind kind)
+{
+  return kind == kOptimizerSgd ? 0 : kind == kOptimizerAdam ? 2 : 1;
+}
+
+/**
+ * @brief Looks up an optimizer by name.
+ * @param[in] name One of "sgd", "momentum", "nesterov" or "adam".
+ * @param[out] kind The optimizer with the given name, if any.
+ * @return Whether the name was recognized.
+ */
+inline bool ParseOptimizer(const std::string& name, OptimizerKind& kind)
+{
+  for (int i = kOptimizerSgd; i <= kOptimizerAdam; ++i) {
+    if (name == kOptimizerNames[i]) {
+      kind = static_cast<OptimizerKind>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace mnist
+
+#endif // OPTIMIZER_HPP_
@@ -0,0 +1,124 @@
+/**
+ * @file
+ * @brief Implementation of preparing batches ahead of time on a background
+ *        thread.
+ * @author Arno Bastenhof
+ */
+
+#include "prefetcher.hpp"
+
+#include <cassert>
+
+using std::exception_ptr;
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+
+namespace mnist {
+
+/**
+ * @brief Destructor that stops and joins the producer.
+ *
+ * Batches not yet consumed are discarded, after the producer has finished
+ * filling the one it is working on, if any.
+ */
+template <typename T>
+BatchPrefetcher<T>::~BatchPrefetcher()
+{
+  {
+    lock_guard<mutex> lock{mutex_};
+    stop_ = true;
+  }
+  free_.notify_one();
+  thread_.join();
+}
+
+/**
+ * @brief Waits for the next batch and returns it.
+ *
+ * The batch remains valid until it is handed back through Release, which must
+ * happen before acquiring the next one. At most as many batches may be
+ * acquired as passed to the constructor.
+ */
+template <typename T>
+auto BatchPrefetcher<T>::Acquire() -> const Batch&
+{
+  assert(acquired_ == released_ && acquired_ < count_);
+  unique_lock<mutex> lock{mutex_};
+  ready_.wait(lock, [this]{ return error_ || produced_ != acquired_; });
+  if (produced_ == acquired_) {
+    std::rethrow_exception(error_);
+  }
+  return buffers_[acquired_++ % buffers_.size()];
+}
+
+/**
+ * @brief Hands the last acquired batch back, so that its buffers can be reused.
+ */
+template <typename T>
+void BatchPrefetcher<T>::Release()
+{
+  {
+    lock_guard<mutex> lock{mutex_};
+    assert(released_ + 1 == acquired_);
+    ++released_;
+  }
+  free_.notify_one();
+}
+
+// Allocates the buffers and starts the producer thread
+template <typename T>
+void BatchPrefetcher<T>::Start(const int rows, const int size,
+    const int depth)
+{
+  assert(depth >= 2);
+  buffers_.resize(depth);
+  for (Batch& batch : buffers_) {
+    batch.img.set_size(rows, size);
+    batch.lab.set_size(size);
+    batch.samples.resize(size);
+    batch.size = size;
+  }
+  thread_ = thread{&BatchPrefetcher::ProducerLoop, this};
+}
+
+// Main loop of the producer thread, filling each batch as soon as a buffer is
+// free
+template <typename T>
+void BatchPrefetcher<T>::ProducerLoop()
+{
+  for (unsigned long i = 0; i != count_; ++i) {
+    {
+      unique_lock<mutex> lock{mutex_};
+      free_.wait(lock, [&]{ return stop_ || i - released_ < buffers_.size(); });
+      if (stop_) {
+        return;
+      }
+    }
+    exception_ptr error;
+    try {
+      invoker_(producer_, i, buffers_[i % buffers_.size()]);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    {
+      lock_guard<mutex> lock{mutex_};
+      if (error) {
+        error_ = error;
+      } else {
+        ++produced_;
+      }
+    }
+    ready_.notify_one();
+    if (error) {
+      return;
+    }
+  }
+}
+
+// Features are prefetched in single or double precision
+template class BatchPrefetcher<float>;
+template class BatchPrefetcher<double>;
+
+} // namespace mnist
@@ -0,0 +1,113 @@
+/**
+ * @file
+ * @brief Interface for preparing batches ahead of time on a background thread.
+ * @author Arno Bastenhof
+ */
+
+#ifndef PREFETCHER_HPP_
+#define PREFETCHER_HPP_
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <armadillo>
+
+namespace mnist {
+
+/**
+ * @brief A bounded ring of batches with features of type T (float or double),
+ *        filled in order by a background thread while the caller consumes
+ *        them.
+ *
+ * Batches are numbered from 0 up to a given count. The producer thread fills
+ * each into the next free buffer by calling a given function, and blocks while
+ * all buffers are either ready or still in use by the consumer. Buffers are
+ * allocated once, up front.
+ */
+template <typename T>
+class BatchPrefetcher {
+public:
+  /** @brief The buffers of a single batch. */
+  struct Batch {
+    arma::Mat<T>        img;            // one sample per column
+    arma::Col<uint8_t>  lab;
+    std::vector<uint32_t> samples;      // indices, if not gathered into img
+    int                 size;           // samples filled, at most n_cols
+  };
+  template <typename F>
+                        BatchPrefetcher(const int, const int, const int,
+                            const unsigned long, const F&);
+                        BatchPrefetcher(const BatchPrefetcher&) = delete;
+                        BatchPrefetcher(BatchPrefetcher&&) = delete;
+                        ~BatchPrefetcher();
+  BatchPrefetcher&      operator=(const BatchPrefetcher&) = delete;
+  const Batch&          Acquire();
+  void                  Release();
+private:
+  // Type-erased producer, invoked without copying (let alone allocating) it
+  using Invoker = void (*)(const void *, unsigned long, Batch&);
+  template <typename F>
+  static void           Invoke(const void *, unsigned long, Batch&);
+  void                  Start(const int, const int, const int);
+  void                  ProducerLoop();
+  const Invoker         invoker_;
+  const void * const    producer_;
+  const unsigned long   count_;         // total number of batches
+  std::vector<Batch>    buffers_;
+  std::mutex            mutex_;         // guards the members below
+  std::condition_variable ready_;
+  std::condition_variable free_;
+  std::exception_ptr    error_;         // thrown by the producer
+  unsigned long         produced_;      // no. of batches filled
+  unsigned long         released_;      // no. of batches released
+  unsigned long         acquired_;      // no. of batches acquired
+  bool                  stop_;
+  std::thread           thread_;
+};
+
+/**
+ * @brief Constructor that allocates the buffers and starts the producer.
+ *
+ * The producer is invoked as producer(i, batch) to fill the i-th batch into
+ * the given buffers, setting batch.size to the number of samples filled, and
+ * must outlive the prefetcher. An exception thrown by it stops the producer,
+ * and is rethrown by the Acquire call awaiting the batch concerned.
+ *
+ * @param[in] rows The number of features per sample, or 0 if the samples
+ *            are referred to by index instead.
+ * @param[in] size The maximum number of samples per batch.
+ * @param[in] depth The number of buffers (at least 2), i.e. the batch being
+ *            consumed and those prepared ahead of it.
+ * @param[in] count The total number of batches.
+ * @param[in] producer The function filling each batch.
+ */
+template <typename T>
+template <typename F>
+inline BatchPrefetcher<T>::BatchPrefetcher(const int rows, const int size,
+    const int depth, const unsigned long count, const F& producer)
+  : invoker_(&Invoke<F>)
+  , producer_(&producer)
+  , count_(count)
+  , produced_(0)
+  , released_(0)
+  , acquired_(0)
+  , stop_(false)
+{
+  Start(rows, size, depth);
+}
+
+template <typename T>
+template <typename F>
+void BatchPrefetcher<T>::Invoke(const void * producer,
+    const unsigned long index, Batch& batch)
+{
+  (*static_cast<const F *>(producer))(index, batch);
+}
+
+} // namespace mnist
+
+#endif // PREFETCHER_HPP_
@@ -0,0 +1,185 @@
+/**
+ * @file
+ * @brief Implementation of int8 inference with a quantized copy of a network.
+ * @author Arno Bastenhof
+ */
+
+#include "quantized.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+using std::runtime_error;
+using std::vector;
+
+using arma::Col;
+using arma::Mat;
+
+// Converts a block of images to raw pixel values, stored in a given buffer.
+// The features must be unscaled pixel values, i.e., whole numbers from 0 to
+// 255, as scaled ones would silently be misclassified once rounded
+template <typename eT>
+static inline const uint8_t * Convert(const eT * img, const int size,
+    vector<uint8_t>& buffer)
+{
+  for (int i = 0; i != size; ++i) {
+    const eT val = img[i];
+    if (!(val >= 0 && val <= 255) || val != std::trunc(val)) {
+      throw runtime_error{"Features must be unscaled pixel values."};
+    }
+    buffer[i] = static_cast<uint8_t>(val);
+  }
+  return buffer.data();
+}
+
+// Raw pixel values are used as is, without copying them
+static inline const uint8_t * Convert(const uint8_t * img, const int,
+    vector<uint8_t>&)
+{
+  return img;
+}
+
+namespace mnist {
+
+/**
+ * @brief Constructor that quantizes the weights of a trained network.
+ *
+ * Each row of the first hidden layer's weights is scaled so that its largest
+ * magnitude maps to kMaxQuantizedWeight, and rounded to the nearest integer.
+ * The biases and the other layers are kept in single precision.
+ *
+ * @param[in] nn The network to quantize, expected to be trained on unscaled
+ *            pixel values.
+ */
+template <typename T>
+QuantizedNet::QuantizedNet(const NeuralNet<T>& nn)
+  : layers_(nn.layers_)
+  , weights_l12_(nn.layers_[1] * kStride, 0)
+  , scales_l12_(nn.layers_[1])
+  , biases_l12_(nn.layers_[1])
+  , weights_upper_(nn.weights_.begin() + nn.offsets_[2], nn.weights_.end())
+{
+  static_assert(static_cast<int>(NeuralNet<T>::kInputLayerSz)
+      == kInputLayerSz, "Input layer size differs from that of NeuralNet");
+
+  // View of the first hidden layer's weights, minus those for the bias
+  const int hidden = layers_[1];
+  const Mat<T> weights(const_cast<T *>(nn.weights_.memptr()) + hidden, hidden,
+      kInputLayerSz, false, true);
+  for (int r = 0; r != hidden; ++r) {
+    double max = 0;
+    for (int k = 0; k != kInputLayerSz; ++k) {
+      max = std::max<double>(max, std::abs(weights(r, k)));
+    }
+    const double scale = max > 0 ? max / kMaxQuantizedWeight : 1;
+    for (int k = 0; k != kInputLayerSz; ++k) {
+      weights_l12_[r * kStride + k] =
+        static_cast<int8_t>(std::lround(weights(r, k) / scale));
+    }
+    scales_l12_[r] = scale;
+    biases_l12_[r] = nn.weights_[r];
+  }
+}
+
+/**
+ * @brief Classifies a set of images.
+ * @param[in] img The input images, one per column, as unscaled pixel values.
+ * @return The predicted labels of the input images.
+ */
+template <typename eT>
+Col<uint8_t> QuantizedNet::Classify(const Mat<eT>& img) const
+{
+  if (img.n_rows != kInputLayerSz) {
+    throw runtime_error{"Unexpected dimensions of input data"};
+  }
+  Col<uint8_t> lab(img.n_cols);
+  vector<uint8_t> buffer(kInputLayerSz * kBlockSz);
+
+  // Accumulators for the first hidden layer, and two blocks of activations
+  // that the layers alternate between
+  const int units = *std::max_element(layers_.begin() + 1, layers_.end());
+  vector<int32_t> acc(layers_[1] * kBlockSz);
+  vector<float> activ(2 * units * kBlockSz);
+  for (unsigned int i = 0; i < img.n_cols; i += kBlockSz) {
+    const int n = std::min<int>(kBlockSz, img.n_cols - i);
+    ClassifyBlock(Convert(img.colptr(i), kInputLayerSz * n, buffer), n,
+        lab.memptr() + i, acc.data(), activ.data(),
+        activ.data() + units * kBlockSz);
+  }
+  return lab;
+}
+
+/**
+ * @brief Evaluates the quantized network on a test set.
+ * @param[in] img The input images, one per column, as unscaled pixel values.
+ * @param[in] lab The labels of the input images.
+ * @return The percentage of examples from the input data that were classified
+ *         correctly.
+ */
+template <typename eT>
+double QuantizedNet::Evaluate(const Mat<eT>& img, const Col<uint8_t>& lab)
+    const
+{
+  if (img.n_cols != lab.n_rows) {
+    throw runtime_error{"Numbers of images and labels differ."};
+  }
+  if (img.n_cols == 0) {
+    throw runtime_error{"No images to evaluate on."};
+  }
+  const Col<uint8_t> predicted = Classify(img);
+  int cnt = 0;
+  for (unsigned int i = 0; i != img.n_cols; ++i) {
+    cnt += predicted[i] == lab[i];
+  }
+  return (static_cast<double>(cnt) / img.n_cols) * 100;
+}
+
+// Classifies a block of at most kBlockSz images, given as raw pixel values
+// (one image after the other), using buffers large enough for the block. All
+// layers use the fast sigmoid, whose error only affects the predictions of
+// near-ties
+void QuantizedNet::ClassifyBlock(const uint8_t * img, const int n,
+    uint8_t * lab, int32_t * acc, float * activ, float * next) const
+{
+  // first hidden layer
+  const int hidden = layers_[1];
+  QuantizedDense(weights_l12_.data(), hidden, kStride, img, kInputLayerSz, n,
+      acc);
+  for (int j = 0; j != n; ++j) {
+    for (int r = 0; r != hidden; ++r) {
+      const int i = j * hidden + r;
+      activ[i] = biases_l12_[r] + scales_l12_[r] * acc[i];
+    }
+  }
+  Sigmoid(activ, hidden * n, kSigmoidFast);
+
+  // remaining layers
+  const float * weights = weights_upper_.data();
+  for (std::size_t l = 2; l != layers_.size(); ++l) {
+    DenseSigmoid(weights, layers_[l], layers_[l - 1], activ, n, next,
+        kSigmoidFast);
+    weights += layers_[l] * (layers_[l - 1] + 1);
+    std::swap(activ, next);
+  }
+  const int classes = layers_.back();
+  for (int j = 0; j != n; ++j) {
+    const float * out = activ + j * classes;
+    lab[j] = std::max_element(out, out + classes) - out;
+  }
+}
+
+template QuantizedNet::QuantizedNet(const NeuralNet<float>&);
+template QuantizedNet::QuantizedNet(const NeuralNet<double>&);
+template Col<uint8_t> QuantizedNet::Classify(const Mat<uint8_t>&) const;
+template Col<uint8_t> QuantizedNet::Classify(const Mat<float>&) const;
+template Col<uint8_t> QuantizedNet::Classify(const Mat<double>&) const;
+template double QuantizedNet::Evaluate(const Mat<uint8_t>&,
+    const Col<uint8_t>&) const;
+template double QuantizedNet::Evaluate(const Mat<float>&,
+    const Col<uint8_t>&) const;
+template double QuantizedNet::Evaluate(const Mat<double>&,
+    const Col<uint8_t>&) const;
+
+} // namespace mnist
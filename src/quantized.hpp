@@ -0,0 +1,55 @@
+/**
+ * @file
+ * @brief Interface for int8 inference with a quantized copy of a network.
+ * @author Arno Bastenhof
+ */
+
+#ifndef QUANTIZED_HPP_
+#define QUANTIZED_HPP_
+
+#include <cstdint>
+#include <vector>
+
+#include <armadillo>
+
+#include "kernels.hpp"
+#include "neural.hpp"
+
+namespace mnist {
+
+/**
+ * @brief A post-training quantization of a NeuralNet, for classification only.
+ *
+ * The weights of the first hidden layer are quantized to int8 with one scale
+ * per row, and multiplied with the raw uint8 pixels using integer arithmetic.
+ * The remaining, much smaller layers are computed in single precision.
+ */
+class QuantizedNet {
+public:
+  template <typename T>
+  explicit          QuantizedNet(const NeuralNet<T>&);
+  template <typename eT>
+  arma::Col<uint8_t> Classify(const arma::Mat<eT>& img) const;
+  template <typename eT>
+  double            Evaluate(const arma::Mat<eT>& img,
+                        const arma::Col<uint8_t>& lab) const;
+private:
+  enum {
+    kBlockSz = 64,                          // samples classified at once
+    kInputLayerSz = 784,
+    kStride = (kInputLayerSz + kQuantizedPadding - 1)
+        / kQuantizedPadding * kQuantizedPadding
+  };
+  std::vector<int>  layers_;                // units, input layer first
+  std::vector<int8_t> weights_l12_;         // row-major, zero-padded rows
+  std::vector<float> scales_l12_;           // one per row
+  std::vector<float> biases_l12_;
+  std::vector<float> weights_upper_;        // of the other layers, as stored
+                                            // by NeuralNet
+  void              ClassifyBlock(const uint8_t *, const int, uint8_t *,
+                        int32_t *, float *, float *) const;
+};
+
+} // namespace mnist
+
+#endif // QUANTIZED_HPP_
@@ -0,0 +1,116 @@
+/**
+ * @file
+ * @brief Implementation of files read sequentially in large chunks.
+ * @author Arno Bastenhof
+ */
+
+#include "sequential_file.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <stdexcept>
+#include <string>
+
+#include "idx_file.hpp"
+
+using std::runtime_error;
+using std::string;
+
+// Size of zlib's input buffer for compressed files, in bytes
+static const unsigned kGzipBufferSz = 1 << 18;
+
+namespace mnist {
+
+/**
+ * @brief Constructor that opens a file for reading from its start.
+ *
+ * The kernel is advised of the sequential access pattern, so that it reads
+ * ahead more aggressively. Gzip-compressed files are recognized by their magic
+ * number, and are decompressed while reading.
+ *
+ * @param[in] filename The full path of the file.
+ */
+SequentialFile::SequentialFile(const char * filename)
+  : fd_(open(filename, O_RDONLY)), size_(0), gz_(nullptr)
+{
+  if (fd_ == -1) {
+    throw runtime_error{string("File not found: ") + filename};
+  }
+  struct stat st;
+  if (fstat(fd_, &st) == -1) {
+    close(fd_);
+    throw runtime_error{string("Could not stat file: ") + filename};
+  }
+  size_ = st.st_size;
+  posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  uint8_t magic[3];
+  if (pread(fd_, magic, sizeof magic, 0) == sizeof magic
+      && IsGzip(magic, sizeof magic)) {
+    // On success, zlib takes over the file descriptor
+    gz_ = gzdopen(fd_, "rb");
+    if (gz_ == nullptr) {
+      close(fd_);
+      throw runtime_error{string("Could not open gzip file: ") + filename};
+    }
+    gzbuffer(gz_, kGzipBufferSz);
+  }
+}
+
+/**
+ * @brief Destructor that closes the file.
+ */
+SequentialFile::~SequentialFile()
+{
+  if (gz_ != nullptr) {
+    gzclose(gz_);
+  } else {
+    close(fd_);
+  }
+}
+
+/**
+ * @brief Reads a given number of bytes from the current position onward.
+ * @param[out] buffer The buffer to read into.
+ * @param[in] size The number of bytes to read.
+ */
+void SequentialFile::Read(uint8_t * buffer, std::size_t size)
+{
+  while (size != 0) {
+    const ssize_t n = gz_ != nullptr
+      ? gzread(gz_, buffer, std::min<std::size_t>(size, INT_MAX))
+      : read(fd_, buffer, size);
+    if (n <= 0) {
+      if (n == -1 && gz_ == nullptr && errno == EINTR) {
+        continue;
+      }
+      throw runtime_error{gz_ != nullptr && n == -1
+          ? "Corrupt gzip file." : "Unexpected end of file."};
+    }
+    buffer += n;
+    size -= n;
+  }
+}
+
+/**
+ * @brief Moves the current position to a given offset from the file's start.
+ *
+ * For compressed files, the offset is into the decompressed contents, and
+ * seeking backward decompresses the file again from its start.
+ */
+void SequentialFile::Seek(const std::size_t offset)
+{
+  const bool failed = gz_ != nullptr
+    ? gzseek(gz_, offset, SEEK_SET) == -1
+    : lseek(fd_, offset, SEEK_SET) == -1;
+  if (failed) {
+    throw runtime_error{"Could not seek in file."};
+  }
+}
+
+} // namespace mnist
@@ -0,0 +1,57 @@
+/**
+ * @file
+ * @brief Interface for files read sequentially in large chunks.
+ * @author Arno Bastenhof
+ */
+
+#ifndef SEQUENTIAL_FILE_HPP_
+#define SEQUENTIAL_FILE_HPP_
+
+#include <zlib.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mnist {
+
+/**
+ * @brief A file read sequentially, which is decompressed on the fly if it is
+ *        gzip-compressed.
+ */
+class SequentialFile {
+public:
+  explicit          SequentialFile(const char *);
+                    SequentialFile(const SequentialFile&) = delete;
+                    SequentialFile(SequentialFile&&) = delete;
+                    ~SequentialFile();
+  SequentialFile&   operator=(const SequentialFile&) = delete;
+  void              Read(uint8_t *, const std::size_t);
+  void              Seek(const std::size_t);
+  std::size_t       Size() const;
+  bool              Compressed() const;
+private:
+  int               fd_;
+  std::size_t       size_;          // size of the file in bytes
+  gzFile            gz_;            // null unless the file is compressed
+};
+
+/**
+ * @brief Returns the size of the file in bytes, which for compressed files is
+ *        that of the compressed contents.
+ */
+inline std::size_t SequentialFile::Size() const
+{
+  return size_;
+}
+
+/**
+ * @brief Returns whether the file is gzip-compressed.
+ */
+inline bool SequentialFile::Compressed() const
+{
+  return gz_ != nullptr;
+}
+
+} // namespace mnist
+
+#endif // SEQUENTIAL_FILE_HPP_
@@ -0,0 +1,77 @@
+/**
+ * @file
+ * @brief Implementation of storing images with mostly zero pixels sparsely.
+ * @author Arno Bastenhof
+ */
+
+#include "sparse_images.hpp"
+
+#include <algorithm>
+
+using arma::Mat;
+
+namespace mnist {
+
+/**
+ * @brief Constructor that compresses a set of images.
+ *
+ * The non-zeros are counted first, so that each buffer is allocated once.
+ *
+ * @param[in] img The images, one per column.
+ */
+template <typename T>
+template <typename eT>
+SparseImages<T>::SparseImages(const Mat<eT>& img)
+  : offsets_(img.n_cols + 1, 0)
+{
+  const arma::uword nnz = img.n_elem - std::count(img.begin(), img.end(),
+      eT(0));
+  indices_.reserve(nnz);
+  values_.reserve(nnz);
+  for (arma::uword j = 0; j != img.n_cols; ++j) {
+    const eT * col = img.colptr(j);
+    for (arma::uword i = 0; i != img.n_rows; ++i) {
+      if (col[i] != 0) {
+        indices_.push_back(i);
+        values_.push_back(col[i]);
+      }
+    }
+    offsets_[j + 1] = indices_.size();
+  }
+}
+
+/**
+ * @brief Returns the fraction of the features of a set of images that are
+ *        non-zero, or 1 if there are none.
+ * @param[in] img The images.
+ */
+template <typename T>
+template <typename eT>
+double SparseImages<T>::Density(const Mat<eT>& img)
+{
+  if (img.n_elem == 0) {
+    return 1;
+  }
+  const arma::uword zeros = std::count(img.begin(), img.end(), eT(0));
+  return 1 - static_cast<double>(zeros) / img.n_elem;
+}
+
+// Single and double precision, each built from raw images as well as
+// preconverted features of either precision
+template class SparseImages<float>;
+template class SparseImages<double>;
+
+template SparseImages<float>::SparseImages(const Mat<uint8_t>&);
+template SparseImages<float>::SparseImages(const Mat<float>&);
+template SparseImages<float>::SparseImages(const Mat<double>&);
+template SparseImages<double>::SparseImages(const Mat<uint8_t>&);
+template SparseImages<double>::SparseImages(const Mat<float>&);
+template SparseImages<double>::SparseImages(const Mat<double>&);
+template double SparseImages<float>::Density(const Mat<uint8_t>&);
+template double SparseImages<float>::Density(const Mat<float>&);
+template double SparseImages<float>::Density(const Mat<double>&);
+template double SparseImages<double>::Density(const Mat<uint8_t>&);
+template double SparseImages<double>::Density(const Mat<float>&);
+template double SparseImages<double>::Density(const Mat<double>&);
+
+} // namespace mnist
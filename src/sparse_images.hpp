@@ -0,0 +1,56 @@
+/**
+ * @file
+ * @brief Interface for storing images with mostly zero pixels sparsely.
+ * @author Arno Bastenhof
+ */
+
+#ifndef SPARSE_IMAGES_HPP_
+#define SPARSE_IMAGES_HPP_
+
+#include <cstdint>
+#include <vector>
+
+#include <armadillo>
+
+#include "kernels.hpp"
+
+namespace mnist {
+
+/**
+ * @brief A set of images in compressed sparse column form, holding only the
+ *        non-zero features of each image, converted to type T (float or
+ *        double).
+ *
+ * Built once from the images of a data set, after which batches refer to
+ * their samples by index rather than gathering them.
+ */
+template <typename T>
+class SparseImages {
+public:
+  template <typename eT>
+  explicit              SparseImages(const arma::Mat<eT>&);
+                        SparseImages(const SparseImages&) = delete;
+                        SparseImages(SparseImages&&) = delete;
+  SparseImages&         operator=(const SparseImages&) = delete;
+  SparseColumns<T>      Columns() const;
+  template <typename eT>
+  static double         Density(const arma::Mat<eT>&);
+private:
+  std::vector<uint64_t> offsets_;       // of each image's non-zeros, followed
+                                        // by their total
+  std::vector<uint32_t> indices_;       // feature of each non-zero
+  std::vector<T>        values_;
+};
+
+/**
+ * @brief Returns a view of the images, one per column.
+ */
+template <typename T>
+inline SparseColumns<T> SparseImages<T>::Columns() const
+{
+  return SparseColumns<T>{offsets_.data(), indices_.data(), values_.data()};
+}
+
+} // namespace mnist
+
+#endif // SPARSE_IMAGES_HPP_
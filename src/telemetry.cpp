@@ -0,0 +1,189 @@
+/**
+ * @file
+ * @brief Implementation of instrumenting training with timers and counters.
+ * @author Arno Bastenhof
+ */
+
+#include "telemetry.hpp"
+
+#include <cstdlib>
+#include <new>
+
+static const char * const kPhaseNames[] = {
+  "read", "prepare", "wait", "forward", "backward", "update", "reduce"
+};
+
+// The number of calls to the global operator new, by any thread
+static std::atomic<uint64_t> allocations{0};
+
+/**
+ * @brief Replacement of the global operator new that counts allocations.
+ *
+ * The array and non-throwing forms forward to this function by default, and
+ * those of operator delete to the two replacements below.
+ */
+void * operator new(std::size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  for (;;) {
+    void * p = std::malloc(size == 0 ? 1 : size);
+    if (p != nullptr) {
+      return p;
+    }
+    const std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr) {
+      throw std::bad_alloc{};
+    }
+    handler();
+  }
+}
+
+/**
+ * @brief Replacement of the global operator delete, matching operator new.
+ */
+void operator delete(void * p) noexcept
+{
+  std::free(p);
+}
+
+/**
+ * @brief Replacement of the global sized operator delete.
+ */
+void operator delete(void * p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+namespace mnist {
+
+/**
+ * @brief Constructor.
+ * @param[in] log The stream to write a line of text to for each epoch, or
+ *            nullptr for none.
+ * @param[in] json The stream to write a line of JSON to for each epoch, or
+ *            nullptr for none.
+ */
+Telemetry::Telemetry(std::ostream * log, std::ostream * json)
+  : log_(log)
+  , json_(json)
+  , samples_{0}
+  , flops_{0}
+  , loss_(0)
+  , allocations_(Allocations())
+  , start_(Clock::now())
+  , epochs_(0)
+  , epoch_totals_()
+  , totals_()
+{
+  for (std::atomic<uint64_t>& ns : ns_) {
+    ns.store(0, std::memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief Starts an epoch, or several when training asynchronously.
+ *
+ * Anything recorded since the previous epoch only counts towards the summary.
+ */
+void Telemetry::StartEpoch()
+{
+  Accumulate(Take(), totals_);
+}
+
+/**
+ * @brief Ends the epochs started last, and starts the next.
+ * @param[in] epoch The number of epochs trained after this one.
+ */
+void Telemetry::EndEpoch(const unsigned long epoch)
+{
+  const Totals t = Take();
+  Accumulate(t, totals_);
+  Accumulate(t, epoch_totals_);
+  ++epochs_;
+
+  const double mean_loss = t.samples != 0 ? t.loss / t.samples : 0;
+  if (log_ != nullptr) {
+    *log_ << "Epoch " << epoch << ": " << t.seconds << " s, "
+          << t.samples / t.seconds << " samples/s, loss " << mean_loss
+          << ", waited " << t.ns[kWait] * 1e-9 << " s\n";
+  }
+  if (json_ != nullptr) {
+    *json_ << "{\"epoch\": " << epoch << ", \"seconds\": " << t.seconds
+           << ", \"samples\": " << t.samples
+           << ", \"samples_per_s\": " << t.samples / t.seconds
+           << ", \"gflops\": " << t.flops / t.seconds * 1e-9
+           << ", \"loss\": " << mean_loss
+           << ", \"allocations\": " << t.allocations;
+    for (int i = 0; i != kNumPhases; ++i) {
+      *json_ << ", \"" << kPhaseNames[i] << "_s\": " << t.ns[i] * 1e-9;
+    }
+    *json_ << '}' << std::endl;
+  }
+}
+
+/**
+ * @brief Writes a summary of everything recorded so far.
+ * @param[out] out The stream to write to.
+ */
+void Telemetry::Summary(std::ostream& out)
+{
+  Accumulate(Take(), totals_);
+  const Totals& e = epoch_totals_;
+  out << "Telemetry\n"
+      << "  Epochs: " << epochs_ << '\n'
+      << "  Training time (s): " << e.seconds << '\n'
+      << "  Samples/s: " << (e.seconds != 0 ? e.samples / e.seconds : 0)
+      << '\n'
+      << "  GFLOP/s: " << (e.seconds != 0 ? e.flops / e.seconds * 1e-9 : 0)
+      << '\n'
+      << "  Allocations: " << totals_.allocations << '\n'
+      << "  Thread time (s):";
+  for (int i = 0; i != kNumPhases; ++i) {
+    out << ' ' << kPhaseNames[i] << ' ' << totals_.ns[i] * 1e-9;
+  }
+  out << '\n';
+}
+
+/**
+ * @brief Returns the number of allocations through the global operator new
+ *        since the program started.
+ */
+uint64_t Telemetry::Allocations()
+{
+  return allocations.load(std::memory_order_relaxed);
+}
+
+// Takes the timers and counters recorded since the last call, resetting them
+Telemetry::Totals Telemetry::Take()
+{
+  const Clock::time_point now = Clock::now();
+  const uint64_t allocs = Allocations();
+  Totals t;
+  t.seconds = std::chrono::duration<double>(now - start_).count();
+  for (int i = 0; i != kNumPhases; ++i) {
+    t.ns[i] = ns_[i].exchange(0, std::memory_order_relaxed);
+  }
+  t.samples = samples_.exchange(0, std::memory_order_relaxed);
+  t.flops = flops_.exchange(0, std::memory_order_relaxed);
+  t.allocations = allocs - allocations_;
+  t.loss = loss_;
+  start_ = now;
+  allocations_ = allocs;
+  loss_ = 0;
+  return t;
+}
+
+// Adds timers and counters to a running total
+void Telemetry::Accumulate(const Totals& t, Totals& total)
+{
+  total.seconds += t.seconds;
+  for (int i = 0; i != kNumPhases; ++i) {
+    total.ns[i] += t.ns[i];
+  }
+  total.samples += t.samples;
+  total.flops += t.flops;
+  total.allocations += t.allocations;
+  total.loss += t.loss;
+}
+
+} // namespace mnist
@@ -0,0 +1,161 @@
+/**
+ * @file
+ * @brief Interface for instrumenting training with timers and counters.
+ * @author Arno Bastenhof
+ */
+
+#ifndef TELEMETRY_HPP_
+#define TELEMETRY_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace mnist {
+
+/**
+ * @brief Timers and counters aggregated per epoch of training.
+ *
+ * Any thread may add to the timers and counters, which are summed over all
+ * threads, such that the time of each phase is measured in thread-seconds and
+ * phases run on different threads may overlap. Epochs are started and ended
+ * by the training thread, which optionally writes a line of text and a line of
+ * JSON for each to the given streams. Time and counts recorded outside of
+ * epochs (e.g. reading the data files) only appear in the summary.
+ *
+ * Allocations are counted through the global operator new, which excludes
+ * the memory Armadillo allocates for matrices directly.
+ */
+class Telemetry {
+public:
+  /** @brief Phases timed by ScopedTimer. */
+  enum Phase {
+    kRead,                              /**< @brief Reading data files. */
+    kPrepare,                           /**< @brief Preparing batches. */
+    kWait,                              /**< @brief Waiting for a batch. */
+    kForward,                           /**< @brief Forward propagation. */
+    kBackward,                          /**< @brief Backpropagation. */
+    kUpdate,                            /**< @brief Updating weights. */
+    kReduce,                            /**< @brief Summing gradients across
+                                             processes. */
+    kNumPhases
+  };
+  explicit              Telemetry(std::ostream * = nullptr,
+                            std::ostream * = nullptr);
+                        Telemetry(const Telemetry&) = delete;
+                        Telemetry(Telemetry&&) = delete;
+  Telemetry&            operator=(const Telemetry&) = delete;
+  void                  AddTime(const Phase, const uint64_t);
+  void                  AddSamples(const uint64_t, const uint64_t);
+  void                  AddLoss(const double);
+  void                  StartEpoch();
+  void                  EndEpoch(const unsigned long);
+  void                  Summary(std::ostream&);
+  static uint64_t       Allocations();
+private:
+  typedef std::chrono::steady_clock Clock;
+  // Timers and counters taken over an interval
+  struct Totals {
+    double              seconds;        // wall time
+    uint64_t            ns[kNumPhases]; // thread time per phase
+    uint64_t            samples;
+    uint64_t            flops;
+    uint64_t            allocations;
+    double              loss;           // summed over the samples
+  };
+  std::ostream * const  log_;
+  std::ostream * const  json_;
+  std::atomic<uint64_t> ns_[kNumPhases];
+  std::atomic<uint64_t> samples_;
+  std::atomic<uint64_t> flops_;
+  double                loss_;          // added by the training thread only
+  uint64_t              allocations_;   // count at the start of the interval
+  Clock::time_point     start_;         // of the interval
+  unsigned long         epochs_;        // no. of epochs ended
+  Totals                epoch_totals_;  // summed over the epochs ended
+  Totals                totals_;        // including time outside of epochs
+  Totals                Take();
+  static void           Accumulate(const Totals&, Totals&);
+};
+
+/**
+ * @brief Adds the time spent in a phase.
+ * @param[in] phase The phase.
+ * @param[in] ns The time in nanoseconds.
+ */
+inline void Telemetry::AddTime(const Phase phase, const uint64_t ns)
+{
+  ns_[phase].fetch_add(ns, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Adds to the number of samples trained on.
+ * @param[in] samples The number of samples.
+ * @param[in] flops The number of floating point operations spent on them.
+ */
+inline void Telemetry::AddSamples(const uint64_t samples, const uint64_t flops)
+{
+  samples_.fetch_add(samples, std::memory_order_relaxed);
+  flops_.fetch_add(flops, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Adds to the training loss, which may only be called by the training
+ *        thread.
+ * @param[in] loss The loss, summed over the samples.
+ */
+inline void Telemetry::AddLoss(const double loss)
+{
+  loss_ += loss;
+}
+
+/**
+ * @brief Times the enclosing scope as a phase of a Telemetry, if given.
+ *
+ * Without a Telemetry, neither the constructor nor the destructor reads the
+ * clock, leaving but a single branch each.
+ */
+class ScopedTimer {
+public:
+                        ScopedTimer(Telemetry *, const Telemetry::Phase);
+                        ScopedTimer(const ScopedTimer&) = delete;
+                        ScopedTimer(ScopedTimer&&) = delete;
+                        ~ScopedTimer();
+  ScopedTimer&          operator=(const ScopedTimer&) = delete;
+private:
+  typedef std::chrono::steady_clock Clock;
+  Telemetry * const     telemetry_;
+  const Telemetry::Phase phase_;
+  Clock::time_point     start_;
+};
+
+/**
+ * @brief Constructor that starts timing a phase.
+ * @param[in] telemetry The Telemetry to add the time to, or nullptr for none.
+ * @param[in] phase The phase.
+ */
+inline ScopedTimer::ScopedTimer(Telemetry * telemetry,
+    const Telemetry::Phase phase)
+  : telemetry_(telemetry)
+  , phase_(phase)
+{
+  if (telemetry_ != nullptr) {
+    start_ = Clock::now();
+  }
+}
+
+/**
+ * @brief Destructor that adds the time taken to the Telemetry, if any.
+ */
+inline ScopedTimer::~ScopedTimer()
+{
+  if (telemetry_ != nullptr) {
+    telemetry_->AddTime(phase_, std::chrono::duration_cast<
+        std::chrono::nanoseconds>(Clock::now() - start_).count());
+  }
+}
+
+} // namespace mnist
+
+#endif // TELEMETRY_HPP_
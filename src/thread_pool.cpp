@@ -0,0 +1,120 @@
+/**
+ * @file
+ * @brief Implementation of a fork-join pool of worker threads.
+ * @author Arno Bastenhof
+ */
+
+#include "thread_pool.hpp"
+
+#include <cassert>
+
+using std::exception_ptr;
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+
+namespace mnist {
+
+/**
+ * @brief Constructor that starts the worker threads.
+ * @param[in] size The number of threads executing each task, including the
+ *            thread calling Run. A size of 1 starts no threads at all.
+ */
+ThreadPool::ThreadPool(const int size)
+  : invoker_(nullptr), task_(nullptr), generation_(0), pending_(0), stop_(false)
+{
+  assert(size > 0);
+  workers_.reserve(size - 1);
+  for (int i = 1; i < size; ++i) {
+    workers_.emplace_back(&ThreadPool::WorkerLoop, this, i);
+  }
+}
+
+/**
+ * @brief Destructor that stops and joins the worker threads.
+ */
+ThreadPool::~ThreadPool()
+{
+  {
+    lock_guard<mutex> lock{mutex_};
+    stop_ = true;
+  }
+  start_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+// Runs a type-erased task on all threads (see Run)
+void ThreadPool::RunTask(const Invoker invoker, const void * task)
+{
+  lock_guard<mutex> run_lock{run_mutex_};
+  {
+    lock_guard<mutex> lock{mutex_};
+    invoker_ = invoker;
+    task_ = task;
+    error_ = nullptr;
+    pending_ = workers_.size();
+    ++generation_;
+  }
+  start_.notify_all();
+
+  // Take part in the work ourselves
+  exception_ptr error;
+  try {
+    invoker(task, 0);
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  // Wait for the workers to finish
+  unique_lock<mutex> lock{mutex_};
+  done_.wait(lock, [this]{ return pending_ == 0; });
+  invoker_ = nullptr;
+  task_ = nullptr;
+  if (!error) {
+    error = error_;
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+// Main loop of a worker thread, running each task submitted to the pool for
+// the given index
+void ThreadPool::WorkerLoop(const int index)
+{
+  unsigned long generation = 0;
+  for (;;) {
+    Invoker invoker;
+    const void * task;
+    {
+      unique_lock<mutex> lock{mutex_};
+      start_.wait(lock, [&]{ return stop_ || generation_ != generation; });
+      if (stop_) {
+        return;
+      }
+      generation = generation_;
+      invoker = invoker_;
+      task = task_;
+    }
+    exception_ptr error;
+    try {
+      invoker(task, index);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    {
+      lock_guard<mutex> lock{mutex_};
+      if (error) {
+        error_ = error;
+      }
+      if (--pending_ == 0) {
+        done_.notify_one();
+      }
+    }
+  }
+}
+
+} // namespace mnist
@@ -0,0 +1,81 @@
+/**
+ * @file
+ * @brief Interface for a fork-join pool of worker threads.
+ * @author Arno Bastenhof
+ */
+
+#ifndef THREAD_POOL_HPP_
+#define THREAD_POOL_HPP_
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mnist {
+
+class ThreadPool {
+public:
+  explicit              ThreadPool(const int);
+                        ThreadPool(const ThreadPool&) = delete;
+                        ThreadPool(ThreadPool&&) = delete;
+                        ~ThreadPool();
+  ThreadPool&           operator=(const ThreadPool&) = delete;
+  int                   Size() const;
+  template <typename F>
+  void                  Run(const F&);
+private:
+  // Type-erased task, invoked without copying (let alone allocating) it
+  using Invoker = void (*)(const void *, int);
+  template <typename F>
+  static void           Invoke(const void *, int);
+  void                  RunTask(const Invoker, const void *);
+  std::vector<std::thread> workers_;
+  std::mutex            run_mutex_;     // serializes calls to Run
+  std::mutex            mutex_;         // guards the members below
+  std::condition_variable start_;
+  std::condition_variable done_;
+  Invoker               invoker_;
+  const void *          task_;
+  std::exception_ptr    error_;
+  unsigned long         generation_;    // incremented for each task
+  int                   pending_;       // no. of workers still running
+  bool                  stop_;
+  void                  WorkerLoop(const int);
+};
+
+/**
+ * @brief Returns the number of threads executing each task, including the
+ *        calling thread.
+ */
+inline int ThreadPool::Size() const
+{
+  return workers_.size() + 1;
+}
+
+/**
+ * @brief Runs a task on all threads and waits for its completion.
+ *
+ * The task is invoked once for each index in [0, Size()), with index 0 being
+ * handled by the calling thread. The same index is always handled by the same
+ * thread. If any invocation throws, one of the exceptions is rethrown after
+ * all invocations have finished.
+ *
+ * @param[in] task The task to run, callable with an int index.
+ */
+template <typename F>
+inline void ThreadPool::Run(const F& task)
+{
+  RunTask(&Invoke<F>, &task);
+}
+
+template <typename F>
+void ThreadPool::Invoke(const void * task, const int index)
+{
+  (*static_cast<const F *>(task))(index);
+}
+
+} // namespace mnist
+
+#endif // THREAD_POOL_HPP_
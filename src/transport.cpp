@@ -0,0 +1,523 @@
+/**
+ * @file
+ * @brief Implementation of exchanging bytes between the processes of a ring,
+ *        over shared memory or local sockets.
+ * @author Arno Bastenhof
+ */
+
+#include "transport.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using std::runtime_error;
+using std::string;
+
+// Capacity of the ring buffer of each shared memory link, in bytes
+static const std::size_t kRingSz = 1 << 20;
+
+// Time to wait for the neighbours of a process to start, and the interval at
+// which to retry in the meantime
+static const std::chrono::seconds kConnectTimeout{60};
+static const std::chrono::milliseconds kConnectRetry{10};
+
+// Busy waits for a shared memory link before sleeping in between, for how
+// long to sleep, and the number of sleeps after which to check that the
+// process at the other end is still alive
+static const int kSpins = 1024;
+static const std::chrono::microseconds kSleep{50};
+static const int kLivenessInterval = 1024;
+
+// Host that the sockets listen on and connect to
+static const uint32_t kLoopback = INADDR_LOOPBACK;
+
+// States of a shared memory link while connecting
+enum {
+  kRingCreated = 1,     // initialized by the receiving process
+  kRingAttached = 2     // mapped by the sending process
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+    "Atomics shared between processes must be lock-free");
+
+// Returns whether a process exists and has not terminated, counting one that
+// terminated as such even while its parent has yet to collect its status
+static bool IsAlive(const int pid)
+{
+  if (kill(pid, 0) != 0 && errno != EPERM) {
+    return false;
+  }
+
+  // The state follows the parenthesized name of the executable, if procfs is
+  // available
+  char filename[32];
+  std::snprintf(filename, sizeof filename, "/proc/%d/stat", pid);
+  const int fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    return true;
+  }
+  char stat[512];
+  const ssize_t n = read(fd, stat, sizeof stat - 1);
+  close(fd);
+  if (n <= 0) {
+    return true;
+  }
+  stat[n] = '\0';
+  const char * const name_end = std::strrchr(stat, ')');
+  return name_end == nullptr || name_end[1] == '\0' || name_end[2] != 'Z';
+}
+
+// Waits for a shared memory link to change, by spinning at first and sleeping
+// once the wait grows long, as when the other process is still computing.
+// While sleeping, checks every so often that the process at the other end is
+// still alive, so as not to wait forever on one that failed
+static void Backoff(int& waits, const int peer)
+{
+  if (++waits < kSpins) {
+    std::this_thread::yield();
+    return;
+  }
+  std::this_thread::sleep_for(kSleep);
+  if (waits == kSpins + kLivenessInterval) {
+    waits = kSpins;
+    if (!IsAlive(peer)) {
+      throw runtime_error{"Lost the process at the other end of a link."};
+    }
+  }
+}
+
+// Returns the rank following a given one in a ring of a given size
+static int Next(const int rank, const int world)
+{
+  return (rank + 1) % world;
+}
+
+// Returns the name of the shared memory link into a given rank
+static string RingName(const string& prefix, const int rank)
+{
+  return prefix + '-' + std::to_string(rank);
+}
+
+// Enables an option of a socket, returning whether successful
+static bool EnableSocketOption(const int fd, const int level, const int name)
+{
+  const int on = 1;
+  return setsockopt(fd, level, name, &on, sizeof on) == 0;
+}
+
+// Returns the address of the socket a given rank listens on
+static sockaddr_in SocketAddress(const int port, const int rank)
+{
+  sockaddr_in addr;
+  std::memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(kLoopback);
+  addr.sin_port = htons(static_cast<uint16_t>(port + rank));
+  return addr;
+}
+
+namespace mnist {
+
+// A shared memory link, written by the sending process and read by the
+// receiving one. Each counter is only written by one of them, and kept on a
+// cache line of its own
+struct SharedMemoryTransport::Ring {
+  alignas(64) std::atomic<uint64_t> head;   // bytes written in total
+  alignas(64) std::atomic<uint64_t> tail;   // bytes read in total
+  alignas(64) std::atomic<int> state;       // while connecting
+  std::atomic<int> receiver;                // process id of the creator
+  std::atomic<int> sender;                  // process id, once attached
+  alignas(64) uint8_t data[kRingSz];
+};
+
+/**
+ * @brief Constructor that creates the link into this process and maps that
+ *        into the next, waiting for the next rank to create it and for the
+ *        previous rank to map it.
+ *
+ * The names of the links are only used while connecting, after which they are
+ * removed again. Links left behind by a process that failed while connecting
+ * are removed before creating them anew, and never mapped in the meantime, as
+ * they are either mapped already or created by a process that has exited.
+ *
+ * @param[in] rank The rank of this process.
+ * @param[in] world The number of processes.
+ * @param[in] prefix The prefix of the names of the links, identifying the
+ *            ring among others on the same host (e.g. "/mnist-29500").
+ */
+SharedMemoryTransport::SharedMemoryTransport(const int rank, const int world,
+    const string& prefix)
+  : in_(nullptr), out_(nullptr), previous_(0), next_(0)
+{
+  const string in_name = RingName(prefix, rank);
+  const string out_name = RingName(prefix, Next(rank, world));
+
+  // Create the link into this process
+  shm_unlink(in_name.c_str());
+  const int fd = shm_open(in_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd == -1) {
+    throw runtime_error{"Could not create shared memory: " + in_name};
+  }
+  if (ftruncate(fd, sizeof(Ring)) == -1) {
+    close(fd);
+    shm_unlink(in_name.c_str());
+    throw runtime_error{"Could not size shared memory: " + in_name};
+  }
+  void * addr = mmap(nullptr, sizeof(Ring), PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    shm_unlink(in_name.c_str());
+    throw runtime_error{"Could not map shared memory: " + in_name};
+  }
+  in_ = new (addr) Ring;
+  in_->head.store(0, std::memory_order_relaxed);
+  in_->tail.store(0, std::memory_order_relaxed);
+  in_->receiver.store(getpid(), std::memory_order_relaxed);
+  in_->sender.store(0, std::memory_order_relaxed);
+  in_->state.store(kRingCreated, std::memory_order_release);
+
+  // Map the link into the next rank once created. One that was already mapped,
+  // or whose creator has exited, was left behind by an earlier run and is
+  // about to be replaced
+  const auto deadline = std::chrono::steady_clock::now() + kConnectTimeout;
+  while (out_ == nullptr) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      Unmap();
+      shm_unlink(in_name.c_str());
+      throw runtime_error{"Timed out waiting for shared memory: " + out_name};
+    }
+    const int out_fd = shm_open(out_name.c_str(), O_RDWR, 0);
+    struct stat st;
+    if (out_fd != -1 && fstat(out_fd, &st) == 0
+        && static_cast<std::size_t>(st.st_size) >= sizeof(Ring)) {
+      addr = mmap(nullptr, sizeof(Ring), PROT_READ | PROT_WRITE, MAP_SHARED,
+          out_fd, 0);
+      if (addr != MAP_FAILED) {
+        // Leave the process id for the creator to find before claiming the
+        // link, which it only initializes once created
+        Ring * const ring = static_cast<Ring *>(addr);
+        if (ring->state.load(std::memory_order_acquire) == kRingCreated
+            && IsAlive(ring->receiver.load(std::memory_order_relaxed))) {
+          ring->sender.store(getpid(), std::memory_order_relaxed);
+          int created = kRingCreated;
+          if (ring->state.compare_exchange_strong(created, kRingAttached,
+              std::memory_order_acq_rel)) {
+            out_ = ring;
+            next_ = ring->receiver.load(std::memory_order_relaxed);
+          }
+        }
+        if (out_ == nullptr) {
+          munmap(addr, sizeof(Ring));
+        }
+      }
+    }
+    if (out_fd != -1) {
+      close(out_fd);
+    }
+    if (out_ == nullptr) {
+      std::this_thread::sleep_for(kConnectRetry);
+    }
+  }
+
+  // Wait for the previous rank to map the link into this process
+  while (in_->state.load(std::memory_order_acquire) != kRingAttached) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      Unmap();
+      shm_unlink(in_name.c_str());
+      throw runtime_error{"Timed out waiting for the previous rank."};
+    }
+    std::this_thread::sleep_for(kConnectRetry);
+  }
+  previous_ = in_->sender.load(std::memory_order_relaxed);
+  shm_unlink(in_name.c_str());
+}
+
+/**
+ * @brief Destructor that unmaps the links.
+ */
+SharedMemoryTransport::~SharedMemoryTransport()
+{
+  Unmap();
+}
+
+// Unmaps the links mapped so far
+void SharedMemoryTransport::Unmap()
+{
+  if (in_ != nullptr) {
+    munmap(in_, sizeof(Ring));
+    in_ = nullptr;
+  }
+  if (out_ != nullptr) {
+    munmap(out_, sizeof(Ring));
+    out_ = nullptr;
+  }
+}
+
+/**
+ * @brief Copies a number of bytes into the ring buffer of the next rank,
+ *        waiting for it to make room whenever full, unless it has exited.
+ * @param[in] data The bytes to send.
+ * @param[in] size The number of bytes.
+ */
+void SharedMemoryTransport::Send(const void * data, std::size_t size)
+{
+  const uint8_t * src = static_cast<const uint8_t *>(data);
+  const uint64_t head = out_->head.load(std::memory_order_relaxed);
+  uint64_t sent = 0;
+  int waits = 0;
+  while (sent != size) {
+    const uint64_t pos = head + sent;
+    const uint64_t room =
+      kRingSz - (pos - out_->tail.load(std::memory_order_acquire));
+    if (room == 0) {
+      Backoff(waits, next_);
+      continue;
+    }
+    waits = 0;
+    const std::size_t n = std::min<uint64_t>({size - sent, room,
+        kRingSz - pos % kRingSz});
+    std::memcpy(out_->data + pos % kRingSz, src + sent, n);
+    sent += n;
+    out_->head.store(head + sent, std::memory_order_release);
+  }
+}
+
+/**
+ * @brief Copies a number of bytes out of the ring buffer of this process,
+ *        waiting for the previous rank to send them whenever empty, unless
+ *        it has exited.
+ * @param[out] data The buffer to receive into.
+ * @param[in] size The number of bytes.
+ */
+void SharedMemoryTransport::Receive(void * data, std::size_t size)
+{
+  uint8_t * dst = static_cast<uint8_t *>(data);
+  const uint64_t tail = in_->tail.load(std::memory_order_relaxed);
+  uint64_t received = 0;
+  int waits = 0;
+  while (received != size) {
+    const uint64_t pos = tail + received;
+    const uint64_t ready = in_->head.load(std::memory_order_acquire) - pos;
+    if (ready == 0) {
+      Backoff(waits, previous_);
+      continue;
+    }
+    waits = 0;
+    const std::size_t n = std::min<uint64_t>({size - received, ready,
+        kRingSz - pos % kRingSz});
+    std::memcpy(dst + received, in_->data + pos % kRingSz, n);
+    received += n;
+    in_->tail.store(tail + received, std::memory_order_release);
+  }
+}
+
+/**
+ * @brief Constructor that listens for the previous rank on a port of its own
+ *        and connects to that of the next rank, waiting for both to start.
+ *
+ * Each rank listens on the loopback device, on the given port plus its rank.
+ * The ranks on both ends of each connection are verified.
+ *
+ * @param[in] rank The rank of this process.
+ * @param[in] world The number of processes.
+ * @param[in] port The port of rank 0, followed by those of the other ranks.
+ */
+SocketTransport::SocketTransport(const int rank, const int world,
+    const int port)
+  : in_(-1), out_(-1)
+{
+  if (port < 1 || port + world > 65536) {
+    throw runtime_error{"Invalid port: " + std::to_string(port)};
+  }
+
+  // Listen before connecting, so that the connection from the previous rank
+  // completes before this process accepts it
+  const int listener = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener == -1) {
+    throw runtime_error{"Could not create socket."};
+  }
+  const sockaddr_in in_addr = SocketAddress(port, rank);
+  if (!EnableSocketOption(listener, SOL_SOCKET, SO_REUSEADDR)
+      || bind(listener, reinterpret_cast<const sockaddr *>(&in_addr),
+          sizeof in_addr) == -1
+      || listen(listener, 1) == -1) {
+    close(listener);
+    throw runtime_error{"Could not listen on port "
+        + std::to_string(port + rank)};
+  }
+
+  // Connect to the next rank once it listens
+  const int next = Next(rank, world);
+  const sockaddr_in out_addr = SocketAddress(port, next);
+  const auto deadline = std::chrono::steady_clock::now() + kConnectTimeout;
+  while (out_ == -1) {
+    out_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (out_ == -1) {
+      close(listener);
+      throw runtime_error{"Could not create socket."};
+    }
+    if (connect(out_, reinterpret_cast<const sockaddr *>(&out_addr),
+        sizeof out_addr) == 0) {
+      break;
+    }
+    close(out_);
+    out_ = -1;
+    if (std::chrono::steady_clock::now() > deadline) {
+      close(listener);
+      throw runtime_error{"Timed out connecting to rank "
+          + std::to_string(next)};
+    }
+    std::this_thread::sleep_for(kConnectRetry);
+  }
+
+  // Accept the connection from the previous rank once it connects
+  pollfd pending = { listener, POLLIN, 0 };
+  int ready;
+  do {
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    ready = poll(&pending, 1, std::max<long>(left.count(), 0));
+  } while (ready == -1 && errno == EINTR);
+  if (ready == 1) {
+    in_ = accept(listener, nullptr, nullptr);
+  }
+  close(listener);
+  if (in_ == -1) {
+    Close();
+    throw runtime_error{"Could not accept connection from previous rank."};
+  }
+
+  // Send small messages right away rather than waiting to coalesce them
+  if (!EnableSocketOption(in_, IPPROTO_TCP, TCP_NODELAY)
+      || !EnableSocketOption(out_, IPPROTO_TCP, TCP_NODELAY)) {
+    Close();
+    throw runtime_error{"Could not set socket option."};
+  }
+
+  // Exchange ranks with the neighbours
+  const uint32_t sent = rank;
+  uint32_t received;
+  try {
+    Send(&sent, sizeof sent);
+    Receive(&received, sizeof received);
+  } catch (...) {
+    Close();
+    throw;
+  }
+  if (received != static_cast<uint32_t>((rank + world - 1) % world)) {
+    Close();
+    throw runtime_error{"Connected to unexpected rank "
+        + std::to_string(received)};
+  }
+}
+
+/**
+ * @brief Destructor that closes the connections.
+ */
+SocketTransport::~SocketTransport()
+{
+  Close();
+}
+
+// Closes the connections made so far
+void SocketTransport::Close()
+{
+  if (in_ != -1) {
+    close(in_);
+    in_ = -1;
+  }
+  if (out_ != -1) {
+    close(out_);
+    out_ = -1;
+  }
+}
+
+/**
+ * @brief Writes a number of bytes to the connection with the next rank.
+ * @param[in] data The bytes to send.
+ * @param[in] size The number of bytes.
+ */
+void SocketTransport::Send(const void * data, std::size_t size)
+{
+  const uint8_t * src = static_cast<const uint8_t *>(data);
+  while (size != 0) {
+    const ssize_t n = send(out_, src, size, MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw runtime_error{"Lost connection to the next rank."};
+    }
+    src += n;
+    size -= n;
+  }
+}
+
+/**
+ * @brief Reads a number of bytes from the connection with the previous rank.
+ * @param[out] data The buffer to receive into.
+ * @param[in] size The number of bytes.
+ */
+void SocketTransport::Receive(void * data, std::size_t size)
+{
+  uint8_t * dst = static_cast<uint8_t *>(data);
+  while (size != 0) {
+    const ssize_t n = recv(in_, dst, size, 0);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw runtime_error{"Lost connection to the previous rank."};
+    }
+    dst += n;
+    size -= n;
+  }
+}
+
+/**
+ * @brief Connects a process to its neighbours in a ring of processes.
+ *
+ * Waits for the neighbours to start, which are all to call this with the
+ * same transport, world size and port.
+ *
+ * @param[in] kind The transport.
+ * @param[in] rank The rank of this process, from 0.
+ * @param[in] world The number of processes (at least 2).
+ * @param[in] port The port of rank 0 when communicating over sockets, and
+ *            otherwise part of the names of the shared memory links.
+ */
+std::unique_ptr<Transport> MakeTransport(const TransportKind kind,
+    const int rank, const int world, const int port)
+{
+  if (world < 2 || rank < 0 || rank >= world) {
+    throw runtime_error{"Invalid rank or world size."};
+  }
+  if (kind == kTransportTcp) {
+    return std::unique_ptr<Transport>{new SocketTransport{rank, world, port}};
+  }
+  return std::unique_ptr<Transport>{new SharedMemoryTransport{rank, world,
+      "/mnist-" + std::to_string(port)}};
+}
+
+} // namespace mnist
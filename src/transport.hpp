@@ -0,0 +1,111 @@
+/**
+ * @file
+ * @brief Interface for exchanging bytes between the processes of a ring, over
+ *        shared memory or local sockets.
+ * @author Arno Bastenhof
+ */
+
+#ifndef TRANSPORT_HPP_
+#define TRANSPORT_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace mnist {
+
+/**
+ * @brief Transports between the processes of a ring.
+ */
+enum TransportKind {
+  kTransportShm,        /**< @brief POSIX shared memory, on a single host. */
+  kTransportTcp         /**< @brief TCP sockets over the loopback device. */
+};
+
+/** @brief Names of the transports, indexed by TransportKind. */
+static const char * const kTransportNames[] = { "shm", "tcp" };
+
+/**
+ * @brief A link of a process to its neighbours in a ring of processes, each
+ *        identified by its rank: one to send to the next rank, and one to
+ *        receive from the previous one.
+ *
+ * Each link delivers bytes in the order sent, buffering a bounded amount in
+ * between, so that a send may wait for the next rank to receive. Sends and
+ * receives may be split and joined arbitrarily, as long as the same number of
+ * bytes is received as is sent.
+ */
+class Transport {
+public:
+                        Transport() = default;
+                        Transport(const Transport&) = delete;
+                        Transport(Transport&&) = delete;
+  virtual               ~Transport() = default;
+  Transport&            operator=(const Transport&) = delete;
+  /** @brief Sends a number of bytes to the next rank. */
+  virtual void          Send(const void *, std::size_t) = 0;
+  /** @brief Receives a number of bytes from the previous rank. */
+  virtual void          Receive(void *, std::size_t) = 0;
+};
+
+/**
+ * @brief A Transport over a ring buffer in POSIX shared memory per link,
+ *        created by the receiving process and mapped by the sending one.
+ */
+class SharedMemoryTransport : public Transport {
+public:
+                        SharedMemoryTransport(const int, const int,
+                            const std::string&);
+                        ~SharedMemoryTransport() override;
+  void                  Send(const void *, std::size_t) override;
+  void                  Receive(void *, std::size_t) override;
+private:
+  struct Ring;
+  void                  Unmap();
+  Ring *                in_;            // created by this process
+  Ring *                out_;           // created by the next rank
+  int                   previous_;      // process id of the previous rank
+  int                   next_;          // process id of the next rank
+};
+
+/**
+ * @brief A Transport over a TCP connection per link, accepted by the
+ *        receiving process on a port of its own and connected to by the
+ *        sending one.
+ */
+class SocketTransport : public Transport {
+public:
+                        SocketTransport(const int, const int, const int);
+                        ~SocketTransport() override;
+  void                  Send(const void *, std::size_t) override;
+  void                  Receive(void *, std::size_t) override;
+private:
+  void                  Close();
+  int                   in_;            // socket accepted from the previous
+                                        // rank
+  int                   out_;           // socket connected to the next rank
+};
+
+std::unique_ptr<Transport> MakeTransport(const TransportKind, const int,
+    const int, const int);
+
+/**
+ * @brief Looks up a transport by name.
+ * @param[in] name One of "shm" or "tcp".
+ * @param[out] kind The transport with the given name, if any.
+ * @return Whether the name was recognized.
+ */
+inline bool ParseTransport(const std::string& name, TransportKind& kind)
+{
+  for (int i = kTransportShm; i <= kTransportTcp; ++i) {
+    if (name == kTransportNames[i]) {
+      kind = static_cast<TransportKind>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace mnist
+
+#endif // TRANSPORT_HPP_
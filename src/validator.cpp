@@ -0,0 +1,150 @@
+/**
+ * @file
+ * @brief Implementation of validating snapshots of a network's weights on a
+ *        background thread while training continues.
+ * @author Arno Bastenhof
+ */
+
+#include "validator.hpp"
+
+using std::exception_ptr;
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+
+namespace mnist {
+
+/**
+ * @brief Destructor that stops and joins the background thread.
+ *
+ * A snapshot still being evaluated is finished first, and then discarded.
+ */
+template <typename T>
+Validator<T>::~Validator()
+{
+  {
+    lock_guard<mutex> lock{mutex_};
+    stop_ = true;
+  }
+  submitted_.notify_one();
+  thread_.join();
+}
+
+/**
+ * @brief Submits a snapshot of the weights for evaluation in the background.
+ *
+ * Waits for the evaluation of the previous snapshot to finish, if it has not
+ * already, and rethrows any exception it threw.
+ *
+ * @param[in] weights The weights of the network being trained.
+ * @param[in] epoch The number of epochs trained when taking the snapshot.
+ */
+template <typename T>
+void Validator<T>::Submit(const arma::Col<T>& weights,
+    const unsigned long epoch)
+{
+  {
+    unique_lock<mutex> lock{mutex_};
+    Wait(lock);
+
+    // Decide whether to stop on the snapshots evaluated by now, those up to
+    // the previous one, regardless of how far the background thread got since
+    patience_exceeded_ = best_epoch_ != 0
+        && epoch_ - best_epoch_ >= static_cast<unsigned long>(patience_);
+
+    // The background thread leaves the network alone while nothing is pending
+    net_.weights_ = weights;
+    epoch_ = epoch;
+    pending_ = true;
+  }
+  submitted_.notify_one();
+}
+
+/**
+ * @brief Returns whether training should stop, as the given number of epochs
+ *        passed without improvement according to the snapshots submitted
+ *        before the last one.
+ *
+ * Those have all been evaluated when submitting the last one, so that the
+ * outcome does not depend on the timing of the background thread.
+ */
+template <typename T>
+bool Validator<T>::ShouldStop()
+{
+  lock_guard<mutex> lock{mutex_};
+  return patience_exceeded_;
+}
+
+/**
+ * @brief Waits for the evaluation of the last snapshot to finish, and
+ *        rethrows any exception it threw.
+ */
+template <typename T>
+void Validator<T>::Finish()
+{
+  unique_lock<mutex> lock{mutex_};
+  Wait(lock);
+}
+
+// Starts the background thread
+template <typename T>
+void Validator<T>::Start()
+{
+  thread_ = thread{&Validator::WorkerLoop, this};
+}
+
+// Main loop of the background thread, evaluating each snapshot as soon as it
+// is submitted and keeping it if it is the most accurate so far
+template <typename T>
+void Validator<T>::WorkerLoop()
+{
+  for (;;) {
+    {
+      unique_lock<mutex> lock{mutex_};
+      submitted_.wait(lock, [this]{ return stop_ || pending_; });
+      if (stop_) {
+        return;
+      }
+    }
+    exception_ptr error;
+    double accuracy = 0;
+    try {
+      accuracy = evaluator_(net_, img_, lab_);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    {
+      lock_guard<mutex> lock{mutex_};
+      if (error) {
+        error_ = error;
+      } else {
+        accuracies_.push_back(accuracy);
+        if (best_epoch_ == 0 || accuracy > best_accuracy_) {
+          best_accuracy_ = accuracy;
+          best_epoch_ = epoch_;
+          best_weights_ = net_.weights_;
+        }
+      }
+      pending_ = false;
+    }
+    evaluated_.notify_one();
+  }
+}
+
+// Waits until no snapshot is pending, rethrowing the exception thrown by the
+// evaluation of the last one, if any
+template <typename T>
+void Validator<T>::Wait(unique_lock<mutex>& lock)
+{
+  evaluated_.wait(lock, [this]{ return !pending_; });
+  if (error_) {
+    std::rethrow_exception(error_);
+  }
+}
+
+// Networks of either precision
+template class Validator<float>;
+template class Validator<double>;
+
+} // namespace mnist
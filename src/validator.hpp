@@ -0,0 +1,179 @@
+/**
+ * @file
+ * @brief Interface for validating snapshots of a network's weights on a
+ *        background thread while training continues.
+ * @author Arno Bastenhof
+ */
+
+#ifndef VALIDATOR_HPP_
+#define VALIDATOR_HPP_
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <armadillo>
+
+#include "neural.hpp"
+
+namespace mnist {
+
+/**
+ * @brief Evaluates snapshots of the weights of a NeuralNet<T> on a held-out
+ *        validation set on a background thread, keeping the most accurate
+ *        one and deciding when training should stop.
+ *
+ * The snapshot taken after each epoch is evaluated while the next epoch
+ * trains, by a network of its own on a single thread. Training stops early
+ * once the given number of epochs has passed without improving on the most
+ * accurate snapshot. As that is only decided once the following epoch has
+ * been trained, one more epoch is trained than strictly needed.
+ */
+template <typename T>
+class Validator {
+public:
+  template <typename eT>
+                        Validator(const NeuralNet<T>&, const arma::Mat<eT>&,
+                            const arma::Col<uint8_t>&, const int);
+                        Validator(const Validator&) = delete;
+                        Validator(Validator&&) = delete;
+                        ~Validator();
+  Validator&            operator=(const Validator&) = delete;
+  void                  Submit(const arma::Col<T>&, const unsigned long);
+  bool                  ShouldStop();
+  void                  Finish();
+  const std::vector<double>& Accuracies() const;
+  double                BestAccuracy() const;
+  unsigned long         BestEpoch() const;
+  const arma::Col<T>&   BestWeights() const;
+private:
+  // Type-erased evaluation of the validation set, as in BatchPrefetcher
+  using Evaluator = double (*)(const NeuralNet<T>&, const void *,
+      const arma::Col<uint8_t>&);
+  template <typename eT>
+  static double         Evaluate(const NeuralNet<T>&, const void *,
+                            const arma::Col<uint8_t>&);
+  void                  Start();
+  void                  WorkerLoop();
+  void                  Wait(std::unique_lock<std::mutex>&);
+  NeuralNet<T>          net_;           // holds the snapshot being evaluated
+  const Evaluator       evaluator_;
+  const void * const    img_;
+  const arma::Col<uint8_t>& lab_;
+  const int             patience_;      // epochs without improvement
+  std::mutex            mutex_;         // guards the members below
+  std::condition_variable submitted_;
+  std::condition_variable evaluated_;
+  std::exception_ptr    error_;         // thrown by the evaluation
+  bool                  pending_;       // snapshot not yet evaluated
+  unsigned long         epoch_;         // of the last snapshot
+  std::vector<double>   accuracies_;    // per snapshot evaluated
+  double                best_accuracy_;
+  unsigned long         best_epoch_;    // 0 if none evaluated
+  arma::Col<T>          best_weights_;
+  bool                  patience_exceeded_;  // as of the previous snapshot
+  bool                  stop_;
+  std::thread           thread_;
+};
+
+/**
+ * @brief Constructor that starts the background thread.
+ *
+ * The validation set must outlive the validator, and should be disjoint from
+ * the training set.
+ *
+ * @param[in] nn The network to validate, whose layers and sigmoid are used.
+ * @param[in] img The images of the validation set, one per column.
+ * @param[in] lab The labels of the validation set.
+ * @param[in] patience The number of epochs without improving on the most
+ *            accurate snapshot after which to stop training (at least 1),
+ *            which ShouldStop only reports after one more epoch.
+ */
+template <typename T>
+template <typename eT>
+inline Validator<T>::Validator(const NeuralNet<T>& nn,
+    const arma::Mat<eT>& img, const arma::Col<uint8_t>& lab,
+    const int patience)
+  : net_(1, nn.sigmoid_, nn.batch_size_, nn.layers_)
+  , evaluator_(&Evaluate<eT>)
+  , img_(&img)
+  , lab_(lab)
+  , patience_(patience)
+  , pending_(false)
+  , epoch_(0)
+  , best_accuracy_(0)
+  , best_epoch_(0)
+  , patience_exceeded_(false)
+  , stop_(false)
+{
+  if (img.n_cols == 0 || img.n_cols != lab.n_rows) {
+    throw std::runtime_error{"Unexpected dimensions of validation data"};
+  }
+  if (patience < 1) {
+    throw std::runtime_error{"Patience must be positive."};
+  }
+  Start();
+}
+
+template <typename T>
+template <typename eT>
+double Validator<T>::Evaluate(const NeuralNet<T>& nn, const void * img,
+    const arma::Col<uint8_t>& lab)
+{
+  return nn.Evaluate(*static_cast<const arma::Mat<eT> *>(img), lab);
+}
+
+/**
+ * @brief Returns the accuracy of each snapshot evaluated so far, as a
+ *        percentage, in the order submitted.
+ *
+ * Only to be called after Finish.
+ */
+template <typename T>
+inline const std::vector<double>& Validator<T>::Accuracies() const
+{
+  return accuracies_;
+}
+
+/**
+ * @brief Returns the accuracy of the most accurate snapshot, as a percentage.
+ *
+ * Only to be called after Finish.
+ */
+template <typename T>
+inline double Validator<T>::BestAccuracy() const
+{
+  return best_accuracy_;
+}
+
+/**
+ * @brief Returns the epoch after which the most accurate snapshot was taken,
+ *        or 0 if none was evaluated.
+ *
+ * Only to be called after Finish.
+ */
+template <typename T>
+inline unsigned long Validator<T>::BestEpoch() const
+{
+  return best_epoch_;
+}
+
+/**
+ * @brief Returns the weights of the most accurate snapshot, empty if none was
+ *        evaluated.
+ *
+ * Only to be called after Finish.
+ */
+template <typename T>
+inline const arma::Col<T>& Validator<T>::BestWeights() const
+{
+  return best_weights_;
+}
+
+} // namespace mnist
+
+#endif // VALIDATOR_HPP_